@@ -0,0 +1,79 @@
+#include "dropbox_server.h"
+
+// POSIX tar framing for ARCHIVE (see handle_archive_task). Each file is a
+// ustar header block, its bytes and zero padding to the next block; the
+// archive ends with two zero blocks, padded out to a whole record the way
+// tar(1) writes it, so readers that consume whole records never read past
+// the end of the archive into the reply that follows it.
+//
+// Names that do not fit the 100-byte ustar name field are carried in a pax
+// extended header ("path=<name>") in front of the file's own header, which
+// keeps the first 100 bytes for readers that ignore pax.
+
+#define TAR_NAME_FIELD 100
+#define TAR_PAX_NAME "././@PaxHeader"
+
+static size_t decimal_digits(size_t n) {
+    size_t digits = 1;
+    while (n >= 10) {
+        n /= 10;
+        digits++;
+    }
+    return digits;
+}
+
+static void put_octal(char *field, size_t width, unsigned long long value) {
+    snprintf(field, width, "%0*llo", (int)(width - 1), value);
+}
+
+static void fill_header(char *block, const char *name, size_t size, time_t mtime, char type) {
+    memset(block, 0, TAR_BLOCK);
+    size_t name_len = strlen(name);
+    memcpy(block, name, name_len < TAR_NAME_FIELD ? name_len : TAR_NAME_FIELD);
+    put_octal(block + 100, 8, 0644);                 // mode
+    put_octal(block + 108, 8, 0);                    // uid
+    put_octal(block + 116, 8, 0);                    // gid
+    put_octal(block + 124, 12, size);
+    put_octal(block + 136, 12, mtime > 0 ? (unsigned long long)mtime : 0);
+    block[156] = type;
+    memcpy(block + 257, "ustar", 6);
+    memcpy(block + 263, "00", 2);
+
+    // The checksum is taken with its own field read as spaces
+    memset(block + 148, ' ', 8);
+    unsigned int sum = 0;
+    for (int i = 0; i < TAR_BLOCK; i++) sum += (unsigned char)block[i];
+    snprintf(block + 148, 8, "%06o", sum);
+    block[155] = ' ';
+}
+
+// Write the header block(s) for one file into out (TAR_HEADER_MAX bytes);
+// returns how many bytes were used
+size_t tar_file_header(char *out, const char *name, size_t size, time_t mtime) {
+    size_t len = 0;
+    size_t name_len = strlen(name);
+    if (name_len >= TAR_NAME_FIELD) {
+        // "<length> path=<name>\n", where <length> counts its own digits
+        size_t body = name_len + strlen(" path=\n");
+        size_t record = body + 1;
+        while (record != body + decimal_digits(record)) record = body + decimal_digits(record);
+        fill_header(out, TAR_PAX_NAME, record, mtime, 'x');
+        memset(out + TAR_BLOCK, 0, TAR_BLOCK);
+        snprintf(out + TAR_BLOCK, TAR_BLOCK, "%zu path=%s\n", record, name);
+        len = 2 * TAR_BLOCK;
+    }
+    fill_header(out + len, name, size, mtime, '0');
+    return len + TAR_BLOCK;
+}
+
+// Zero bytes that follow size bytes of file data
+size_t tar_padding(size_t size) {
+    return (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+}
+
+// Zero bytes that end an archive of written bytes: two blocks, then up to
+// the record boundary
+size_t tar_trailer_size(size_t written) {
+    size_t trailer = 2 * TAR_BLOCK;
+    return trailer + (TAR_RECORD - (written + trailer) % TAR_RECORD) % TAR_RECORD;
+}
@@ -1,11 +1,25 @@
 #include "dropbox_server.h"
 
 // Authentication functions
+// Append "SESSION_TOKEN <token> <ttl>" to a success line so both leave in
+// one write; without a token the line goes out alone
+static void send_with_token(int socket_fd, const char *username, const char *success) {
+    char token[SESSION_TOKEN_LEN + 1];
+    char response[256];
+    if (session_token_issue(username, token) == 0) {
+        snprintf(response, sizeof(response), "%sSESSION_TOKEN %s %d\n", success, token, g_config.session_token_ttl_s);
+        send_response(socket_fd, response);
+    } else {
+        send_response(socket_fd, success);
+    }
+}
+
 int authenticate_user(int socket_fd, char *username) {
     char buffer[BUFFER_SIZE];
     char command[64], user[MAX_USERNAME], pass[MAX_PASSWORD];
     
-    // Send welcome message
+    // Send welcome message. A resuming client does not wait for it: its
+    // RESUME line is already queued on the socket and is read below.
     send_response(socket_fd, "Welcome to DropBox Server!\n");
     send_response(socket_fd, "Please login or signup (LOGIN <username> <password> or SIGNUP <username> <password>): ");
     
@@ -17,21 +31,47 @@ int authenticate_user(int socket_fd, char *username) {
         
         // Parse authentication command
         int parsed = sscanf(buffer, "%63s %49s %49s", command, user, pass);
-        if (parsed != 3) {
-            send_response(socket_fd, "ERROR: Invalid command format. Use LOGIN <username> <password> or SIGNUP <username> <password>\n");
-            continue;
-        }
         
         // Convert command to uppercase for case-insensitive comparison
-        for (int i = 0; command[i]; i++) {
+        for (int i = 0; parsed >= 1 && command[i]; i++) {
             command[i] = toupper(command[i]);
         }
         
+        // RESUME <token>: sign in with a token from an earlier LOGIN/SIGNUP
+        if (parsed >= 1 && strcmp(command, "RESUME") == 0) {
+            char token[SESSION_TOKEN_LEN + 2];
+            char resumed[MAX_USERNAME];
+            int remaining = -1;
+            if (sscanf(buffer, "%*s %33s", token) == 1) {
+                remaining = session_token_resume(token, resumed);
+            }
+            if (remaining > 0) {
+                char response[128];
+                memcpy(username, resumed, MAX_USERNAME);
+                snprintf(response, sizeof(response), "RESUME_SUCCESS: Session resumed (%ds left)\n", remaining);
+                // Corked: it leaves together with the command list the
+                // client thread writes next instead of on its own
+                size_t len = strlen(response);
+                if (send(socket_fd, response, len, MSG_MORE) != (ssize_t)len) {
+                    perror("Failed to send complete response");
+                }
+                printf("User '%s' resumed a session on socket %d\n", username, socket_fd);
+                return 0; // Success
+            }
+            send_response(socket_fd, "RESUME_FAILED: Unknown or expired session token\n");
+            continue;
+        }
+        
+        if (parsed != 3) {
+            send_response(socket_fd, "ERROR: Invalid command format. Use LOGIN <username> <password> or SIGNUP <username> <password>\n");
+            continue;
+        }
+        
         if (strcmp(command, "LOGIN") == 0) {
             if (handle_login(socket_fd, user, pass) == 0) {
                 strncpy(username, user, MAX_USERNAME - 1);
                 username[MAX_USERNAME - 1] = '\0';
-                send_response(socket_fd, "LOGIN_SUCCESS: Authentication successful\n");
+                send_with_token(socket_fd, username, "LOGIN_SUCCESS: Authentication successful\n");
                 printf("User '%s' logged in successfully on socket %d\n", username, socket_fd);
                 return 0; // Success
             } else {
@@ -41,14 +81,14 @@ int authenticate_user(int socket_fd, char *username) {
             if (handle_signup(socket_fd, user, pass) == 0) {
                 strncpy(username, user, MAX_USERNAME - 1);
                 username[MAX_USERNAME - 1] = '\0';
-                send_response(socket_fd, "SIGNUP_SUCCESS: Account created and logged in\n");
+                send_with_token(socket_fd, username, "SIGNUP_SUCCESS: Account created and logged in\n");
                 printf("User '%s' signed up and logged in successfully on socket %d\n", username, socket_fd);
                 return 0; // Success
             } else {
                 send_response(socket_fd, "SIGNUP_FAILED: Username already exists or invalid credentials\n");
             }
         } else {
-            send_response(socket_fd, "ERROR: Unknown command. Use LOGIN or SIGNUP\n");
+            send_response(socket_fd, "ERROR: Unknown command. Use LOGIN, SIGNUP or RESUME\n");
         }
     }
 }
@@ -65,36 +105,13 @@ int handle_signup(int socket_fd, const char *username, const char *password) {
         return -1;
     }
     
-    // Create users directory if it doesn't exist
-    struct stat st = {0};
-    if (stat("users", &st) == -1) {
-        if (mkdir("users", 0700) != 0) {
-            perror("Failed to create users directory");
-            return -1;
-        }
-    }
-    
-    // Check if user already exists
-    char user_file[512];
-    snprintf(user_file, sizeof(user_file), "users/%s.txt", username);
-    
-    FILE *file = fopen(user_file, "r");
-    if (file != NULL) {
-        fclose(file);
-        return -1; // User already exists
-    }
-    
-    // Create user file with password (in a real system, you'd hash the password)
-    file = fopen(user_file, "w");
-    if (!file) {
-        perror("Failed to create user file");
-        return -1;
+    // Durable in the credential log before the account can be used
+    if (credentials_add(username, password) != 0) {
+        return -1; // Name taken, invalid or not recorded
     }
     
-    fprintf(file, "%s\n", password);
-    fclose(file);
-    
     // Create user directory for file storage
+    struct stat st = {0};
     char user_dir[512];
     snprintf(user_dir, sizeof(user_dir), "storage/%s", username);
     if (stat("storage", &st) == -1) {
@@ -104,7 +121,7 @@ int handle_signup(int socket_fd, const char *username, const char *password) {
         }
     }
     
-    if (mkdir(user_dir, 0700) != 0) {
+    if (mkdir(user_dir, 0700) != 0 && errno != EEXIST) {
         perror("Failed to create user storage directory");
         return -1;
     }
@@ -121,27 +138,8 @@ int handle_login(int socket_fd, const char *username, const char *password) {
         return -1;
     }
     
-    char user_file[512];
-    snprintf(user_file, sizeof(user_file), "users/%s.txt", username);
-    
-    FILE *file = fopen(user_file, "r");
-    if (!file) {
-        return -1; // User doesn't exist
-    }
-    
-    char stored_password[MAX_PASSWORD];
-    if (fgets(stored_password, sizeof(stored_password), file) == NULL) {
-        fclose(file);
-        return -1;
-    }
-    fclose(file);
-    
-    // Remove newline from stored password
-    char *newline = strchr(stored_password, '\n');
-    if (newline) *newline = '\0';
-    
-    // Compare passwords
-    if (strcmp(password, stored_password) == 0) {
+    // Resident table lookup; no file access on the login path
+    if (credentials_check(username, password) == 0) {
         printf("User '%s' authentication successful\n", username);
         return 0;
     }
@@ -196,6 +194,21 @@ int parse_command(const char *command_line, char *command, char *filename) {
     return 0;
 }
 
+// Set *priority from a --high/--medium/--low or --priority=<level> flag;
+// returns 0 if flag was one of them
+static int parse_priority_flag(const char *flag, int *priority) {
+    if (strcmp(flag, "--high") == 0 || strcmp(flag, "--priority=high") == 0) {
+        *priority = PRIORITY_HIGH;
+    } else if (strcmp(flag, "--medium") == 0 || strcmp(flag, "--priority=medium") == 0) {
+        *priority = PRIORITY_MEDIUM;
+    } else if (strcmp(flag, "--low") == 0 || strcmp(flag, "--priority=low") == 0) {
+        *priority = PRIORITY_LOW;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
 // Enhanced command parsing with priority support
 int parse_priority_command(const char *command_line, char *command, char *filename, int *priority) {
     if (!command_line || !command || !filename || !priority) return -1;
@@ -228,29 +241,48 @@ int parse_priority_command(const char *command_line, char *command, char *filena
         parsed = 2; // Adjust parsed count
     }
     
-    // Parse priority flag if present
+    // Parse priority flag if present; unrecognized flags keep medium priority
     if (strlen(priority_flag) > 0) {
-        if (strcmp(priority_flag, "--high") == 0 || strcmp(priority_flag, "--priority=high") == 0) {
-            *priority = PRIORITY_HIGH;
-        } else if (strcmp(priority_flag, "--medium") == 0 || strcmp(priority_flag, "--priority=medium") == 0) {
-            *priority = PRIORITY_MEDIUM;
-        } else if (strcmp(priority_flag, "--low") == 0 || strcmp(priority_flag, "--priority=low") == 0) {
-            *priority = PRIORITY_LOW;
-        }
-        // If unrecognized priority flag, keep default medium priority
+        parse_priority_flag(priority_flag, priority);
     }
     
-    // Validate command and filename requirements
+    // Validate command and filename requirements; the batch commands take
+    // their file count in the filename slot
     if (strcmp(temp_command, "UPLOAD") == 0 || 
         strcmp(temp_command, "DOWNLOAD") == 0 || 
-        strcmp(temp_command, "DELETE") == 0) {
+        strcmp(temp_command, "DELETE") == 0 ||
+        strcmp(temp_command, "MUPLOAD") == 0 ||
+        strcmp(temp_command, "MDOWNLOAD") == 0 ||
+        strcmp(temp_command, "MDELETE") == 0) {
         if (strlen(temp_filename) == 0) {
             return -1; // These commands require a filename
         }
         strcpy(filename, temp_filename);
-    } else if (strcmp(temp_command, "LIST") == 0) {
-        // LIST doesn't require a filename
+        if (strcmp(temp_command, "DOWNLOAD") == 0) {
+            // A --version=k option may come before the priority flag
+            const char *p = command_line;
+            char token[MAX_COMMAND];
+            int consumed;
+            while (sscanf(p, "%511s%n", token, &consumed) == 1) {
+                parse_priority_flag(token, priority);
+                p += consumed;
+            }
+        }
+    } else if (strcmp(temp_command, "ARCHIVE") == 0 || strcmp(temp_command, "WATCH") == 0 ||
+               strcmp(temp_command, "CHANGES") == 0) {
+        // Optional name prefix or change cursor, carried in the filename slot
+        strcpy(filename, temp_filename);
+    } else if (strcmp(temp_command, "LIST") == 0 || strcmp(temp_command, "STATS") == 0) {
+        // LIST and STATS don't require a filename. LIST options may come
+        // in any order, so look for a priority flag among all of them.
         filename[0] = '\0';
+        const char *p = command_line;
+        char token[MAX_COMMAND];
+        int consumed;
+        while (sscanf(p, "%511s%n", token, &consumed) == 1) {
+            parse_priority_flag(token, priority);
+            p += consumed;
+        }
     } else if (strcmp(temp_command, "QUIT") == 0 || strcmp(temp_command, "EXIT") == 0) {
         // Quit commands
         filename[0] = '\0';
@@ -260,4 +292,101 @@ int parse_priority_command(const char *command_line, char *command, char *filena
     
     strcpy(command, temp_command);
     return 0;
-}
\ No newline at end of file
+}
+// Parse the options of a LIST command line into query. Priority flags are
+// accepted and ignored here. On a bad option returns -1 with a message.
+int parse_list_query(const char *command_line, list_query_t *query, char *error, size_t error_size) {
+    if (!command_line || !query) return -1;
+    memset(query, 0, sizeof(*query));
+    query->limit = LIST_DEFAULT_LIMIT;
+    query->sort = LIST_SORT_NAME;
+
+    char token[MAX_COMMAND];
+    int consumed;
+    const char *p = command_line;
+    if (sscanf(p, "%511s%n", token, &consumed) != 1) return -1;   // the LIST itself
+    p += consumed;
+
+    while (sscanf(p, "%511s%n", token, &consumed) == 1) {
+        p += consumed;
+        int dummy;
+        if (parse_priority_flag(token, &dummy) == 0) continue;
+
+        // --name value and --name=value are both accepted
+        const char *value = NULL;
+        char name[32] = {0};
+        char next[MAX_COMMAND];
+        if (strncmp(token, "--", 2) == 0) {
+            char *eq = strchr(token, '=');
+            if (eq) {
+                size_t len = (size_t)(eq - token) < sizeof(name) - 1 ? (size_t)(eq - token) : sizeof(name) - 1;
+                memcpy(name, token, len);
+                value = eq + 1;
+            } else {
+                strncpy(name, token, sizeof(name) - 1);
+                if (sscanf(p, "%511s%n", next, &consumed) != 1) {
+                    snprintf(error, error_size, "Option %s needs a value", token);
+                    return -1;
+                }
+                p += consumed;
+                value = next;
+            }
+        }
+
+        if (!value) {
+            if (query->prefix[0]) {
+                snprintf(error, error_size, "LIST takes at most one prefix");
+                return -1;
+            }
+            strncpy(query->prefix, token, sizeof(query->prefix) - 1);
+        } else if (strcmp(name, "--limit") == 0) {
+            char *end;
+            long limit = strtol(value, &end, 10);
+            if (*end != '\0' || limit < 1 || limit > LIST_MAX_LIMIT) {
+                snprintf(error, error_size, "--limit must be between 1 and %d", LIST_MAX_LIMIT);
+                return -1;
+            }
+            query->limit = (size_t)limit;
+        } else if (strcmp(name, "--cursor") == 0) {
+            if (strlen(value) >= sizeof(query->cursor)) {
+                snprintf(error, error_size, "Invalid cursor");
+                return -1;
+            }
+            strcpy(query->cursor, value);
+        } else if (strcmp(name, "--sort") == 0) {
+            if (strcmp(value, "name") == 0) {
+                query->sort = LIST_SORT_NAME;
+            } else if (strcmp(value, "size") == 0) {
+                query->sort = LIST_SORT_SIZE;
+            } else if (strcmp(value, "mtime") == 0) {
+                query->sort = LIST_SORT_MTIME;
+            } else {
+                snprintf(error, error_size, "--sort must be name, size or mtime");
+                return -1;
+            }
+        } else {
+            snprintf(error, error_size, "Unknown LIST option %s", name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Find a --version=k option on a DOWNLOAD command line: *version is k, or 0
+// (the current content) without one. Returns -1 if k is not a positive number.
+int parse_download_version(const char *command_line, int *version) {
+    if (!command_line || !version) return -1;
+    *version = 0;
+    char token[MAX_COMMAND];
+    int consumed;
+    const char *p = command_line;
+    while (sscanf(p, "%511s%n", token, &consumed) == 1) {
+        p += consumed;
+        if (strncmp(token, "--version=", 10) != 0) continue;
+        char *end;
+        long k = strtol(token + 10, &end, 10);
+        if (end == token + 10 || *end != '\0' || k < 1 || k > 1000000) return -1;
+        *version = (int)k;
+    }
+    return 0;
+}
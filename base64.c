@@ -0,0 +1,317 @@
+#include "dropbox_server.h"
+#include <stdint.h>
+
+// Base64 codec for the blob storage format. Every upload is encoded and
+// every download decoded, so the bulk of the work runs in SIMD kernels:
+// SSSE3 handles 12 input bytes (16 characters) per step and AVX2 twice
+// that. The kernel is picked once from the CPU's features; the scalar code
+// is the fallback and also finishes the tail and the padded final quad.
+//
+// Decoding accepts exactly what the scalar decoder accepts. A SIMD block
+// containing anything outside the alphabet (including '=') is left to the
+// scalar loop, which either decodes it or rejects the input.
+
+static const char b64_table[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static unsigned char b64_reverse_table[256];
+
+// Kernels consume whole blocks and return how many input bytes they used
+typedef size_t (*b64_kernel_t)(const unsigned char *in, size_t in_len, unsigned char *out);
+
+static struct {
+    const char *name;
+    b64_kernel_t encode;
+    b64_kernel_t decode;
+} codec;
+
+static pthread_once_t codec_once = PTHREAD_ONCE_INIT;
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define B64_HAVE_X86 1
+
+// 12 input bytes (one 16-byte load) -> 16 characters
+__attribute__((target("ssse3")))
+static inline __m128i enc_reshuffle_ssse3(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+// Map 6-bit indices to the alphabet with one shuffle per 16 characters
+__attribute__((target("ssse3")))
+static inline __m128i enc_translate_ssse3(__m128i in) {
+    const __m128i lut = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i idx = _mm_subs_epu8(in, _mm_set1_epi8(51));
+    const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), in);
+    idx = _mm_or_si128(idx, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    return _mm_add_epi8(in, _mm_shuffle_epi8(lut, idx));
+}
+
+// Pack four 6-bit values per 32-bit lane back into three bytes
+__attribute__((target("ssse3")))
+static inline __m128i dec_reshuffle_ssse3(__m128i in) {
+    const __m128i merged = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+    const __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(packed, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("ssse3")))
+static size_t encode_ssse3(const unsigned char *in, size_t in_len, unsigned char *out) {
+    size_t i = 0;
+    // Each step loads 16 bytes but consumes 12
+    while (i + 16 <= in_len) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(in + i));
+        block = enc_translate_ssse3(enc_reshuffle_ssse3(block));
+        _mm_storeu_si128((__m128i *)out, block);
+        out += 16;
+        i += 12;
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t decode_ssse3(const unsigned char *in, size_t in_len, unsigned char *out) {
+    // Nibble tables: a character is invalid when its lo and hi entries share a bit
+    const __m128i lut_lo = _mm_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+
+    size_t i = 0;
+    // Each step stores 16 bytes but produces 12; keep two quads in reserve
+    // so the overshoot stays inside the output buffer
+    while (i + 24 <= in_len) {
+        __m128i str = _mm_loadu_si128((const __m128i *)(in + i));
+        const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+        const __m128i lo_nibbles = _mm_and_si128(str, mask_2f);
+        const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+        const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0) break;
+
+        const __m128i eq_2f = _mm_cmpeq_epi8(str, mask_2f);
+        const __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+        str = dec_reshuffle_ssse3(_mm_add_epi8(str, roll));
+        _mm_storeu_si128((__m128i *)out, str);
+        out += 12;
+        i += 16;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t encode_avx2(const unsigned char *in, size_t in_len, unsigned char *out) {
+    const __m256i shuffle = _mm256_set_epi8(
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i lut = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    size_t i = 0;
+    // Two 12-byte groups per step, one per 128-bit lane (reads 28 bytes)
+    while (i + 32 <= in_len) {
+        const __m128i lo_half = _mm_loadu_si128((const __m128i *)(in + i));
+        const __m128i hi_half = _mm_loadu_si128((const __m128i *)(in + i + 12));
+        __m256i block = _mm256_inserti128_si256(_mm256_castsi128_si256(lo_half), hi_half, 1);
+
+        block = _mm256_shuffle_epi8(block, shuffle);
+        const __m256i t0 = _mm256_and_si256(block, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(block, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i idx6 = _mm256_or_si256(t1, t3);
+
+        __m256i idx = _mm256_subs_epu8(idx6, _mm256_set1_epi8(51));
+        const __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx6);
+        idx = _mm256_or_si256(idx, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+        block = _mm256_add_epi8(idx6, _mm256_shuffle_epi8(lut, idx));
+
+        _mm256_storeu_si256((__m256i *)out, block);
+        out += 32;
+        i += 24;
+    }
+    return i + encode_ssse3(in + i, in_len - i, out);
+}
+
+__attribute__((target("avx2")))
+static size_t decode_avx2(const unsigned char *in, size_t in_len, unsigned char *out) {
+    const __m256i lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+    const __m256i pack = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    size_t i = 0;
+    // Stores 32 bytes and produces 24; keep four quads in reserve
+    while (i + 48 <= in_len) {
+        __m256i str = _mm256_loadu_si256((const __m256i *)(in + i));
+        const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+        const __m256i lo_nibbles = _mm256_and_si256(str, mask_2f);
+        const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+        if (!_mm256_testz_si256(lo, hi)) break;
+
+        const __m256i eq_2f = _mm256_cmpeq_epi8(str, mask_2f);
+        const __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+        str = _mm256_add_epi8(str, roll);
+        const __m256i merged = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+        str = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        str = _mm256_shuffle_epi8(str, pack);
+        // Close the 4-byte gap between the two lanes' 12 bytes
+        str = _mm256_permutevar8x32_epi32(str, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+        _mm256_storeu_si256((__m256i *)out, str);
+        out += 24;
+        i += 32;
+    }
+    return i + decode_ssse3(in + i, in_len - i, out);
+}
+#endif
+
+static size_t no_kernel(const unsigned char *in, size_t in_len, unsigned char *out) {
+    (void)in;
+    (void)in_len;
+    (void)out;
+    return 0;
+}
+
+static void codec_init(void) {
+    memset(b64_reverse_table, 0xFF, sizeof(b64_reverse_table));
+    for (size_t i = 0; i < 64; ++i) b64_reverse_table[(unsigned char)b64_table[i]] = (unsigned char)i;
+    b64_reverse_table[(unsigned char)'='] = 0;
+
+    codec.name = "scalar";
+    codec.encode = no_kernel;
+    codec.decode = no_kernel;
+#ifdef B64_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        codec.name = "avx2";
+        codec.encode = encode_avx2;
+        codec.decode = decode_avx2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        codec.name = "ssse3";
+        codec.encode = encode_ssse3;
+        codec.decode = decode_ssse3;
+    }
+#endif
+}
+
+// Name of the kernel in use: "avx2", "ssse3" or "scalar"
+const char* base64_impl_name(void) {
+    pthread_once(&codec_once, codec_init);
+    return codec.name;
+}
+
+// Force a kernel (benchmarks and tests). Returns -1 if the CPU lacks it.
+int base64_select_impl(const char *name) {
+    pthread_once(&codec_once, codec_init);
+    if (!name) return -1;
+    if (strcmp(name, "scalar") == 0) {
+        codec.name = "scalar";
+        codec.encode = no_kernel;
+        codec.decode = no_kernel;
+        return 0;
+    }
+#ifdef B64_HAVE_X86
+    if (strcmp(name, "ssse3") == 0 && __builtin_cpu_supports("ssse3")) {
+        codec.name = "ssse3";
+        codec.encode = encode_ssse3;
+        codec.decode = decode_ssse3;
+        return 0;
+    }
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        codec.name = "avx2";
+        codec.encode = encode_avx2;
+        codec.decode = decode_avx2;
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+// Encode into a new NUL-terminated buffer of ((in_len + 2) / 3) * 4 characters
+int base64_encode(const unsigned char *in, size_t in_len, char **out, size_t *out_len) {
+    if ((!in && in_len > 0) || !out || !out_len) return -1;
+    pthread_once(&codec_once, codec_init);
+    size_t enc_len = ((in_len + 2) / 3) * 4;
+    char *enc = malloc(enc_len + 1);
+    if (!enc) return -1;
+
+    size_t i = in_len > 0 ? codec.encode(in, in_len, (unsigned char *)enc) : 0;
+    size_t j = i / 3 * 4;
+    while (i + 3 <= in_len) {
+        uint32_t triple = ((uint32_t)in[i] << 16) | ((uint32_t)in[i + 1] << 8) | in[i + 2];
+        enc[j++] = b64_table[(triple >> 18) & 0x3F];
+        enc[j++] = b64_table[(triple >> 12) & 0x3F];
+        enc[j++] = b64_table[(triple >> 6) & 0x3F];
+        enc[j++] = b64_table[triple & 0x3F];
+        i += 3;
+    }
+    // padding
+    size_t mod = in_len - i;
+    if (mod) {
+        uint32_t triple = (uint32_t)in[i] << 16;
+        if (mod == 2) triple |= (uint32_t)in[i + 1] << 8;
+        enc[j++] = b64_table[(triple >> 18) & 0x3F];
+        enc[j++] = b64_table[(triple >> 12) & 0x3F];
+        enc[j++] = mod == 2 ? b64_table[(triple >> 6) & 0x3F] : '=';
+        enc[j++] = '=';
+    }
+    enc[enc_len] = '\0';
+    *out = enc;
+    *out_len = enc_len;
+    return 0;
+}
+
+// Decode into a new NUL-terminated buffer; -1 on malformed input
+int base64_decode(const char *in, size_t in_len, unsigned char **out, size_t *out_len) {
+    if ((!in && in_len > 0) || !out || !out_len) return -1;
+    if (in_len % 4 != 0) return -1;
+    pthread_once(&codec_once, codec_init);
+    size_t padding = 0;
+    if (in_len >= 1 && in[in_len - 1] == '=') padding++;
+    if (in_len >= 2 && in[in_len - 2] == '=') padding++;
+    size_t dec_len = (in_len / 4) * 3 - padding;
+    unsigned char *dec = malloc(dec_len + 1);
+    if (!dec) return -1;
+
+    size_t i = in_len > 0 ? codec.decode((const unsigned char *)in, in_len, dec) : 0;
+    size_t j = i / 4 * 3;
+    while (i < in_len) {
+        uint32_t sextet_a = b64_reverse_table[(unsigned char)in[i++]];
+        uint32_t sextet_b = b64_reverse_table[(unsigned char)in[i++]];
+        uint32_t sextet_c = b64_reverse_table[(unsigned char)in[i++]];
+        uint32_t sextet_d = b64_reverse_table[(unsigned char)in[i++]];
+        if (sextet_a == 0xFF || sextet_b == 0xFF || sextet_c == 0xFF || sextet_d == 0xFF) { free(dec); return -1; }
+        uint32_t triple = (sextet_a << 18) | (sextet_b << 12) | (sextet_c << 6) | sextet_d;
+        if (j < dec_len) dec[j++] = (triple >> 16) & 0xFF;
+        if (j < dec_len) dec[j++] = (triple >> 8) & 0xFF;
+        if (j < dec_len) dec[j++] = triple & 0xFF;
+    }
+    dec[dec_len] = '\0';
+    *out = dec;
+    *out_len = dec_len;
+    return 0;
+}
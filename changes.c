@@ -0,0 +1,596 @@
+#define _GNU_SOURCE
+#include "dropbox_server.h"
+
+// Per-user change log behind WATCH and CHANGES. Every committed upload and
+// delete is appended to storage/<user>.changes as it is applied, numbered
+// per user in the order the changes land (under the user's mutex, so a log
+// never skips back):
+//
+//   L <log_id> <floor> <crc>                (first line)
+//   <seq> U <sha256> <file> <crc>
+//   <seq> D - <file> <crc>
+//
+// A cursor, "<log_id>.<seq>", names the last change a client has seen.
+// Like the .meta and quota sidecars the log is appended without a sync:
+// the journal holds the durable copy of each change. A crash can therefore
+// cost the log its tail, so a user whose records are replayed at startup
+// gets a new log id, and cursors into the old log are answered with RESYNC
+// (WATCH) or a snapshot (CHANGES). A torn last line fails its checksum and
+// is cut off on load.
+//
+// The newest CHANGE_FEED_SIZE changes of each user stay in memory, so WATCH
+// rarely reads the file. Once the log holds twice change_log_retention
+// changes it is rewritten with the newest change_log_retention and its
+// floor moves up; a cursor below the floor can only get a snapshot.
+
+#define CHANGE_LOG_BUCKETS 1024
+#define CHANGE_LOG_SUFFIX ".changes"
+#define CHANGE_LINE_MAX (MAX_FILENAME + 128)
+
+typedef struct {
+    unsigned long long seq;
+    char op;                             // JOURNAL_UPLOAD or JOURNAL_DELETE
+    char *checksum;                      // "-" for deletes
+    char *filename;                      // shares checksum's allocation
+} change_t;
+
+typedef struct change_log {
+    char username[MAX_USERNAME];
+    int loaded;
+    int on_disk;                         // the file has this log's header
+    int replayed;                        // touched by journal replay
+    unsigned long long id;
+    unsigned long long seq;              // newest change
+    unsigned long long floor;            // every change after this is in the file
+    change_t ring[CHANGE_FEED_SIZE];     // the newest changes
+    size_t head;                         // slot of the oldest one
+    size_t count;
+    pthread_mutex_t mutex;
+    struct change_log *next;
+} change_log_t;
+
+static struct {
+    change_log_t *buckets[CHANGE_LOG_BUCKETS];
+    int live;                            // journal replay is over
+    void (*listener)(void);              // told of every change (the watcher)
+    pthread_mutex_t mutex;               // the table and the fields above
+} changes = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static unsigned int changes_crc(const char *text, size_t len) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void log_path(char *buf, size_t size, const char *username) {
+    snprintf(buf, size, "storage/%s%s", username, CHANGE_LOG_SUFFIX);
+}
+
+// Log ids are wall-clock milliseconds, so a recreated log never reuses one
+static unsigned long long new_log_id(unsigned long long previous) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    unsigned long long id = (unsigned long long)ts.tv_sec * 1000 + (unsigned long long)ts.tv_nsec / 1000000;
+    return id > previous ? id : previous + 1;
+}
+
+static int make_change(change_t *change, unsigned long long seq, char op, const char *checksum,
+                       const char *filename) {
+    if (!checksum || !checksum[0]) checksum = "-";
+    size_t sum_len = strlen(checksum) + 1, name_len = strlen(filename) + 1;
+    char *text = malloc(sum_len + name_len);
+    if (!text) return -1;
+    memcpy(text, checksum, sum_len);
+    memcpy(text + sum_len, filename, name_len);
+    change->seq = seq;
+    change->op = op;
+    change->checksum = text;
+    change->filename = text + sum_len;
+    return 0;
+}
+
+static int format_line(char *line, size_t size, const char *body) {
+    int len = snprintf(line, size, "%s %08x\n", body, changes_crc(body, strlen(body)));
+    return len > 0 && (size_t)len < size ? len : -1;
+}
+
+static int format_change_line(char *line, size_t size, const change_t *change) {
+    char body[CHANGE_LINE_MAX];
+    int len = snprintf(body, sizeof(body), "%llu %c %s %s", change->seq, change->op,
+                       change->checksum, change->filename);
+    if (len < 0 || (size_t)len >= sizeof(body)) return -1;
+    return format_line(line, size, body);
+}
+
+// Whole file in a NUL-terminated buffer; NULL if it does not exist
+static char* read_log_file(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    char *text = NULL;
+    if (fstat(fd, &st) == 0 && (text = malloc((size_t)st.st_size + 1)) != NULL) {
+        size_t got = 0;
+        while (got < (size_t)st.st_size) {
+            ssize_t n = read(fd, text + got, (size_t)st.st_size - got);
+            if (n <= 0) break;
+            got += (size_t)n;
+        }
+        text[got] = '\0';
+        *len = got;
+    }
+    close(fd);
+    return text;
+}
+
+typedef int (*change_fn)(const change_t *change, void *arg);
+
+// Walk a log's text, calling fn for each change in order. Returns the length
+// of the intact part (a torn or damaged tail is left out), or -1 if the
+// header is unreadable.
+static long parse_log(char *text, size_t len, unsigned long long *id, unsigned long long *floor,
+                      change_fn fn, void *arg) {
+    char *line = text;
+    long intact = -1;
+    while ((size_t)(line - text) < len) {
+        char *newline = strchr(line, '\n');
+        if (!newline) break;
+        *newline = '\0';
+        char *crc_field = strrchr(line, ' ');
+        unsigned int crc;
+        if (!crc_field || sscanf(crc_field + 1, "%8x", &crc) != 1 ||
+            crc != changes_crc(line, (size_t)(crc_field - line))) {
+            break;
+        }
+        *crc_field = '\0';
+
+        if (intact < 0) {
+            if (sscanf(line, "L %llu %llu", id, floor) != 2) return -1;
+        } else {
+            change_t change;
+            char checksum[65];
+            int name_at = 0;
+            if (sscanf(line, "%llu %c %64s %n", &change.seq, &change.op, checksum, &name_at) != 3 ||
+                name_at == 0 || !line[name_at]) {
+                break;
+            }
+            change.checksum = checksum;
+            change.filename = line + name_at;
+            if (fn && fn(&change, arg) != 0) break;
+        }
+        intact = newline + 1 - text;
+        line = newline + 1;
+    }
+    return intact;
+}
+
+// Caller holds log->mutex
+static void ring_clear_locked(change_log_t *log) {
+    for (size_t i = 0; i < log->count; i++) free(log->ring[(log->head + i) % CHANGE_FEED_SIZE].checksum);
+    log->head = 0;
+    log->count = 0;
+}
+
+// Takes ownership of change's strings. Caller holds log->mutex.
+static void ring_push_locked(change_log_t *log, const change_t *change) {
+    if (log->count == CHANGE_FEED_SIZE) {
+        free(log->ring[log->head].checksum);
+        log->head = (log->head + 1) % CHANGE_FEED_SIZE;
+        log->count--;
+    }
+    log->ring[(log->head + log->count) % CHANGE_FEED_SIZE] = *change;
+    log->count++;
+}
+
+// Changes must follow on from the floor without gaps
+static int load_change(const change_t *change, void *arg) {
+    change_log_t *log = (change_log_t *)arg;
+    if (change->seq != (log->count ? log->seq : log->floor) + 1) return -1;
+    change_t copy;
+    if (make_change(&copy, change->seq, change->op, change->checksum, change->filename) != 0) return -1;
+    ring_push_locked(log, &copy);
+    log->seq = change->seq;
+    return 0;
+}
+
+typedef struct {
+    unsigned long long after;
+    char *text;
+    size_t len;
+    size_t cap;
+} log_copy_t;
+
+static int copy_change(const change_t *change, void *arg) {
+    log_copy_t *copy = (log_copy_t *)arg;
+    if (change->seq <= copy->after) return 0;
+    if (copy->cap - copy->len < CHANGE_LINE_MAX + 16) {
+        size_t cap = copy->cap * 2 + CHANGE_LINE_MAX + 16;
+        char *grown = realloc(copy->text, cap);
+        if (!grown) return -1;
+        copy->text = grown;
+        copy->cap = cap;
+    }
+    int n = format_change_line(copy->text + copy->len, copy->cap - copy->len, change);
+    if (n < 0) return -1;
+    copy->len += (size_t)n;
+    return 0;
+}
+
+// Replace the file with the log's header and the changes after keep_after,
+// synced before the rename. Caller holds log->mutex.
+static int rewrite_log_locked(change_log_t *log, unsigned long long keep_after) {
+    char path[512], tmp_path[600];
+    log_path(path, sizeof(path), log->username);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    log_copy_t copy = { keep_after, malloc(CHANGE_LINE_MAX), 0, CHANGE_LINE_MAX };
+    if (!copy.text) return -1;
+    char body[96];
+    snprintf(body, sizeof(body), "L %llu %llu", log->id, keep_after);
+    copy.len = (size_t)format_line(copy.text, copy.cap, body);
+
+    if (log->on_disk && keep_after < log->seq) {
+        size_t len = 0;
+        char *text = read_log_file(path, &len);
+        unsigned long long id, floor;
+        if (text) parse_log(text, len, &id, &floor, copy_change, &copy);
+        free(text);
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int rc = fd < 0 ? -1 : 0;
+    if (fd >= 0) {
+        if (write(fd, copy.text, copy.len) != (ssize_t)copy.len || durability_sync_fd(fd) != 0) rc = -1;
+        if (close(fd) != 0) rc = -1;
+    }
+    free(copy.text);
+    if (rc == 0 && rename(tmp_path, path) != 0) rc = -1;
+    if (rc != 0) {
+        perror("Failed to rewrite change log");
+        unlink(tmp_path);
+        return -1;
+    }
+    durability_sync_dir(path);
+
+    log->floor = keep_after;
+    log->on_disk = 1;
+    while (log->count > 0 && log->ring[log->head].seq <= keep_after) {
+        free(log->ring[log->head].checksum);
+        log->head = (log->head + 1) % CHANGE_FEED_SIZE;
+        log->count--;
+    }
+    return 0;
+}
+
+// Start a log with a new id after the newest change, so no cursor into the
+// old one is answered with a delta. If the file cannot be rewritten it is
+// removed, which has the same effect after a restart. Caller holds log->mutex.
+static void restart_log_locked(change_log_t *log) {
+    log->id = new_log_id(log->id);
+    ring_clear_locked(log);
+    log->floor = log->seq;
+    if (rewrite_log_locked(log, log->seq) != 0) {
+        char path[512];
+        log_path(path, sizeof(path), log->username);
+        unlink(path);
+        log->on_disk = 0;
+    }
+}
+
+// Caller holds log->mutex
+static void load_log_locked(change_log_t *log) {
+    char path[512];
+    log_path(path, sizeof(path), log->username);
+    size_t len = 0;
+    char *text = read_log_file(path, &len);
+    long intact = text ? parse_log(text, len, &log->id, &log->floor, load_change, log) : -1;
+    if (intact >= 0) {
+        if (log->count == 0) log->seq = log->floor;
+        if ((size_t)intact < len) {
+            printf("Change log for %s: dropping a damaged tail (%zu bytes)\n", log->username, len - (size_t)intact);
+            if (truncate(path, (off_t)intact) != 0) perror("Failed to truncate change log");
+        }
+        log->on_disk = 1;
+    } else {
+        // No log yet; one without a readable header is started afresh
+        log->id = new_log_id(0);
+        log->seq = log->floor = 0;
+        if (text) restart_log_locked(log);
+    }
+    free(text);
+    log->loaded = 1;
+}
+
+static size_t log_slot(const char *username) {
+    size_t hash = 5381;
+    while (*username) hash = hash * 33 + (unsigned char)*username++;
+    return hash % CHANGE_LOG_BUCKETS;
+}
+
+// The user's log, loaded and locked; NULL if it cannot be allocated
+static change_log_t* lock_log(const char *username) {
+    pthread_mutex_lock(&changes.mutex);
+    size_t slot = log_slot(username);
+    change_log_t *log = changes.buckets[slot];
+    while (log && strcmp(log->username, username) != 0) log = log->next;
+    if (!log && (log = calloc(1, sizeof(change_log_t))) != NULL) {
+        strncpy(log->username, username, MAX_USERNAME - 1);
+        pthread_mutex_init(&log->mutex, NULL);
+        log->next = changes.buckets[slot];
+        changes.buckets[slot] = log;
+    }
+    pthread_mutex_unlock(&changes.mutex);
+    if (!log) return NULL;
+    pthread_mutex_lock(&log->mutex);
+    if (!log->loaded) load_log_locked(log);
+    return log;
+}
+
+// Journal replay is over: from here on changes are logged. Users whose
+// records were replayed start a new log, since theirs may lack them.
+void changes_init(void) {
+    pthread_mutex_lock(&changes.mutex);
+    changes.live = 1;
+    for (size_t b = 0; b < CHANGE_LOG_BUCKETS; b++) {
+        for (change_log_t *log = changes.buckets[b]; log; log = log->next) {
+            pthread_mutex_lock(&log->mutex);
+            if (log->replayed) {
+                restart_log_locked(log);
+                log->replayed = 0;
+            }
+            pthread_mutex_unlock(&log->mutex);
+        }
+    }
+    pthread_mutex_unlock(&changes.mutex);
+}
+
+void changes_listen(void (*listener)(void)) {
+    pthread_mutex_lock(&changes.mutex);
+    changes.listener = listener;
+    pthread_mutex_unlock(&changes.mutex);
+}
+
+// Log a committed upload or delete; called with the user's mutex held
+void changes_record(const char *username, char op, const char *filename, const char *checksum) {
+    if (!username || !filename) return;
+    pthread_mutex_lock(&changes.mutex);
+    int live = changes.live;
+    void (*listener)(void) = changes.listener;
+    pthread_mutex_unlock(&changes.mutex);
+
+    change_log_t *log = lock_log(username);
+    if (!log) {
+        perror("Failed to allocate change log");
+        return;
+    }
+    if (!live) {
+        log->replayed = 1;
+        pthread_mutex_unlock(&log->mutex);
+        return;
+    }
+
+    change_t change;
+    char line[CHANGE_LINE_MAX + 16];
+    int made = make_change(&change, log->seq + 1, op, op == JOURNAL_DELETE ? NULL : checksum, filename) == 0;
+    int logged = 0;
+    if (made) {
+        int len = format_change_line(line, sizeof(line), &change);
+        if (len > 0 && (log->on_disk || rewrite_log_locked(log, log->seq) == 0)) {
+            char path[512];
+            log_path(path, sizeof(path), username);
+            int fd = open(path, O_WRONLY | O_APPEND);
+            if (fd >= 0) {
+                logged = write(fd, line, (size_t)len) == len;
+                close(fd);
+            }
+        }
+    }
+    log->seq++;
+    if (logged) {
+        ring_push_locked(log, &change);
+        if (log->seq - log->floor >= 2 * (unsigned long long)g_config.change_log_retention) {
+            rewrite_log_locked(log, log->seq - (unsigned long long)g_config.change_log_retention);
+        }
+    } else {
+        // A change missing from the log would be skipped silently; start a
+        // new log instead so every cursor gets a snapshot
+        if (made) free(change.checksum);
+        perror("Failed to append to change log");
+        restart_log_locked(log);
+    }
+    pthread_mutex_unlock(&log->mutex);
+    if (listener) listener();
+}
+
+typedef enum {
+    CURSOR_CURRENT,                      // nothing after it yet
+    CURSOR_BEHIND,                       // changes after it are in the log
+    CURSOR_STALE                         // not answerable with a delta
+} cursor_state_t;
+
+// Caller holds log->mutex. An empty cursor counts as stale: the client has
+// no listing yet and needs a cursor to start from.
+static cursor_state_t cursor_state_locked(const change_log_t *log, const char *cursor,
+                                          unsigned long long *since) {
+    unsigned long long id, seq;
+    char extra;
+    if (!cursor || sscanf(cursor, "%llu.%llu%c", &id, &seq, &extra) != 2 || id != log->id ||
+        seq > log->seq || seq < log->floor) {
+        return CURSOR_STALE;
+    }
+    *since = seq;
+    return seq == log->seq ? CURSOR_CURRENT : CURSOR_BEHIND;
+}
+
+// Nonzero if a WATCH from cursor can be answered now
+int changes_pending(const char *username, const char *cursor) {
+    change_log_t *log = lock_log(username);
+    if (!log) return 1;
+    unsigned long long since;
+    int pending = cursor_state_locked(log, cursor, &since) != CURSOR_CURRENT;
+    pthread_mutex_unlock(&log->mutex);
+    return pending;
+}
+
+// The cursor for everything logged so far
+void changes_cursor(const char *username, char *buf, size_t size) {
+    change_log_t *log = lock_log(username);
+    if (!log) {
+        snprintf(buf, size, "0.0");
+        return;
+    }
+    snprintf(buf, size, "%llu.%llu", log->id, log->seq);
+    pthread_mutex_unlock(&log->mutex);
+}
+
+typedef struct {
+    unsigned long long after;
+    change_t *items;
+    size_t count;
+    size_t cap;
+} change_list_t;
+
+static int collect_change(const change_t *change, void *arg) {
+    change_list_t *list = (change_list_t *)arg;
+    if (change->seq <= list->after) return 0;
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 256;
+        change_t *grown = realloc(list->items, cap * sizeof(change_t));
+        if (!grown) return -1;
+        list->items = grown;
+        list->cap = cap;
+    }
+    if (make_change(&list->items[list->count], change->seq, change->op, change->checksum, change->filename) != 0) {
+        return -1;
+    }
+    list->count++;
+    return 0;
+}
+
+// Open-addressed set of names, for keeping each file's latest change only
+typedef struct {
+    const char **slots;
+    size_t mask;
+} name_set_t;
+
+static int name_set_add(name_set_t *set, const char *name) {
+    size_t i = 5381;
+    for (const char *p = name; *p; p++) i = i * 33 + (unsigned char)*p;
+    for (i &= set->mask; set->slots[i]; i = (i + 1) & set->mask) {
+        if (strcmp(set->slots[i], name) == 0) return 0;
+    }
+    set->slots[i] = name;
+    return 1;
+}
+
+// Render changes (oldest first) as one line per file, each with its latest
+// change and in the order of those changes, then the trailer line
+static char* render_changes(const change_t *const *list, size_t count, const char *trailer, size_t *len) {
+    size_t cap = 16;
+    while (cap < count * 2) cap *= 2;
+    name_set_t set = { calloc(cap, sizeof(char *)), cap - 1 };
+    const change_t **picked = malloc((count ? count : 1) * sizeof(change_t *));
+    char *reply = NULL;
+    if (set.slots && picked) {
+        size_t n = 0, size = strlen(trailer) + 1;
+        for (size_t i = count; i-- > 0;) {
+            if (!name_set_add(&set, list[i]->filename)) continue;
+            picked[n++] = list[i];
+            size += strlen(list[i]->filename) + strlen(list[i]->checksum) + 10;
+        }
+        if ((reply = malloc(size)) != NULL) {
+            size_t used = 0;
+            for (size_t j = n; j-- > 0;) {
+                if (picked[j]->op == JOURNAL_DELETE) {
+                    used += (size_t)snprintf(reply + used, size - used, "DELETE %s\n", picked[j]->filename);
+                } else {
+                    used += (size_t)snprintf(reply + used, size - used, "UPLOAD %s %s\n",
+                                             picked[j]->filename, picked[j]->checksum);
+                }
+            }
+            used += (size_t)snprintf(reply + used, size - used, "%s", trailer);
+            *len = used;
+        }
+    }
+    free(set.slots);
+    free(picked);
+    return reply;
+}
+
+// Answer for cursor: one "UPLOAD <name> <sha256>" or "DELETE <name>" line
+// per file changed since, oldest first and each file once with its latest
+// change, then "CURSOR <cursor>". Returns 0 with that in *reply, 1 if the
+// cursor is stale (*reply is then just "RESYNC <cursor>"), -1 on error.
+// Caller frees *reply.
+int changes_reply(const char *username, const char *cursor, char **reply, size_t *len) {
+    *reply = NULL;
+    change_log_t *log = lock_log(username);
+    if (!log) return -1;
+    unsigned long long since = 0;
+    cursor_state_t state = cursor_state_locked(log, cursor, &since);
+    char trailer[CHANGE_CURSOR_LEN + 16];
+    snprintf(trailer, sizeof(trailer), "%s %llu.%llu\n", state == CURSOR_STALE ? "RESYNC" : "CURSOR",
+             log->id, log->seq);
+
+    // The newest changes come from memory, older ones from the file
+    change_list_t disk = { since, NULL, 0, 0 };
+    const change_t **list = NULL;
+    size_t count = 0;
+    int rc = 0;
+    if (state == CURSOR_BEHIND) {
+        size_t first = 0;
+        if (log->count > 0 && since + 1 >= log->ring[log->head].seq) {
+            first = (size_t)(since + 1 - log->ring[log->head].seq);
+            count = log->count - first;
+        } else {
+            char path[512];
+            log_path(path, sizeof(path), username);
+            size_t text_len = 0;
+            char *text = read_log_file(path, &text_len);
+            unsigned long long id, floor;
+            if (!text || parse_log(text, text_len, &id, &floor, collect_change, &disk) < 0 ||
+                disk.count != log->seq - since) {
+                rc = -1;
+            }
+            free(text);
+            count = disk.count;
+        }
+        list = malloc((count ? count : 1) * sizeof(change_t *));
+        if (!list) rc = -1;
+        for (size_t i = 0; rc == 0 && i < count; i++) {
+            list[i] = disk.items ? &disk.items[i] : &log->ring[(log->head + first + i) % CHANGE_FEED_SIZE];
+        }
+    }
+    if (rc == 0) {
+        *reply = render_changes(list, state == CURSOR_BEHIND ? count : 0, trailer, len);
+        if (!*reply) rc = -1;
+    }
+    pthread_mutex_unlock(&log->mutex);
+    for (size_t i = 0; i < disk.count; i++) free(disk.items[i].checksum);
+    free(disk.items);
+    free(list);
+    if (rc != 0) return -1;
+    return state == CURSOR_STALE ? 1 : 0;
+}
+
+void changes_clear(void) {
+    pthread_mutex_lock(&changes.mutex);
+    for (size_t b = 0; b < CHANGE_LOG_BUCKETS; b++) {
+        change_log_t *log = changes.buckets[b];
+        while (log) {
+            change_log_t *next = log->next;
+            ring_clear_locked(log);
+            pthread_mutex_destroy(&log->mutex);
+            free(log);
+            log = next;
+        }
+        changes.buckets[b] = NULL;
+    }
+    changes.live = 0;
+    changes.listener = NULL;
+    pthread_mutex_unlock(&changes.mutex);
+}
@@ -0,0 +1,302 @@
+#define _GNU_SOURCE
+#include "dropbox_server.h"
+#include <math.h>
+#include <zlib.h>
+
+// Blob storage format. New blobs start with a 16-byte header
+//
+//   "\x89DBX" <codec:1> <reserved:3> <logical size:8, little-endian>
+//
+// followed by the file either as-is (raw) or deflated. Blobs written
+// before the header existed are whole-file base64 with no header; base64
+// never starts with 0x89, so the two cannot be confused.
+//
+// Whether to deflate is decided per file: a byte-entropy probe over a
+// sample skips data that is already compressed, and the result is kept only
+// if it saves at least an eighth. Quotas and sizes always use the logical
+// (uncompressed) size. Reads go through blob_reader_t, which decodes in
+// chunks so downloads never hold the whole file in memory.
+
+#define BLOB_MAGIC "\x89" "DBX"
+#define BLOB_HEADER_SIZE 16
+#define BLOB_READ_CHUNK (64 * 1024)
+#define COMPRESS_MIN_BYTES 512
+#define PROBE_WINDOW 4096
+#define PROBE_WINDOWS 16
+#define PROBE_MAX_ENTROPY 7.0        // bits per byte; above this is noise
+
+struct blob_reader {
+    FILE *file;
+    storage_codec_t codec;
+    size_t size;                     // logical bytes
+    size_t produced;                 // logical bytes returned so far
+    z_stream zs;
+    int zs_ready;
+    unsigned char in[BLOB_READ_CHUNK];
+    unsigned char *pending;          // decoded base64 not yet returned
+    size_t pending_len;
+    size_t pending_off;
+};
+
+static struct {
+    unsigned long files[CODEC_COUNT];
+    unsigned long long logical_bytes;
+    unsigned long long stored_bytes;
+    pthread_mutex_t mutex;
+} compression_stats = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+const char* storage_codec_name(storage_codec_t codec) {
+    switch (codec) {
+        case CODEC_BASE64: return "base64";
+        case CODEC_RAW: return "raw";
+        case CODEC_DEFLATE: return "deflate";
+        default: return "unknown";
+    }
+}
+
+int parse_storage_codec(const char *name, storage_codec_t *codec) {
+    for (int c = 0; c < CODEC_COUNT; c++) {
+        if (strcmp(name, storage_codec_name((storage_codec_t)c)) == 0) {
+            *codec = (storage_codec_t)c;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Order-0 entropy of a few windows spread over the data, in bits per byte
+static double probe_entropy(const unsigned char *data, size_t size) {
+    size_t counts[256] = {0};
+    size_t sampled = 0;
+    if (size <= (size_t)PROBE_WINDOW * PROBE_WINDOWS) {
+        for (size_t i = 0; i < size; i++) counts[data[i]]++;
+        sampled = size;
+    } else {
+        size_t stride = (size - PROBE_WINDOW) / (PROBE_WINDOWS - 1);
+        for (int w = 0; w < PROBE_WINDOWS; w++) {
+            const unsigned char *p = data + (size_t)w * stride;
+            for (size_t i = 0; i < PROBE_WINDOW; i++) counts[p[i]]++;
+        }
+        sampled = (size_t)PROBE_WINDOW * PROBE_WINDOWS;
+    }
+    double entropy = 0.0;
+    for (int b = 0; b < 256; b++) {
+        if (!counts[b]) continue;
+        double p = (double)counts[b] / (double)sampled;
+        entropy -= p * log2(p);
+    }
+    return entropy;
+}
+
+static void write_header(unsigned char *out, storage_codec_t codec, size_t size) {
+    memcpy(out, BLOB_MAGIC, 4);
+    out[4] = (unsigned char)codec;
+    out[5] = out[6] = out[7] = 0;
+    unsigned long long v = size;
+    for (int i = 0; i < 8; i++) out[8 + i] = (unsigned char)(v >> (8 * i));
+}
+
+static int parse_header(const unsigned char *in, storage_codec_t *codec, size_t *size) {
+    if (memcmp(in, BLOB_MAGIC, 4) != 0) return -1;
+    if (in[4] != CODEC_RAW && in[4] != CODEC_DEFLATE) return -1;
+    unsigned long long v = 0;
+    for (int i = 0; i < 8; i++) v |= (unsigned long long)in[8 + i] << (8 * i);
+    *codec = (storage_codec_t)in[4];
+    *size = (size_t)v;
+    return 0;
+}
+
+// Build the stored form of data: header plus raw or deflated bytes
+int blob_encode(const char *data, size_t size, char **out, size_t *out_len, storage_codec_t *codec) {
+    if ((!data && size > 0) || !out || !out_len || !codec) return -1;
+    unsigned char *blob = NULL;
+    size_t blob_len = 0;
+    *codec = CODEC_RAW;
+
+    if (strcmp(g_config.compression, "auto") == 0 && size >= COMPRESS_MIN_BYTES &&
+        probe_entropy((const unsigned char *)data, size) <= PROBE_MAX_ENTROPY) {
+        uLongf bound = compressBound((uLong)size);
+        blob = malloc(BLOB_HEADER_SIZE + bound);
+        if (!blob) return -1;
+        uLongf packed = bound;
+        if (compress2(blob + BLOB_HEADER_SIZE, &packed, (const Bytef *)data, (uLong)size,
+                      g_config.compression_level) == Z_OK && packed <= size - size / 8) {
+            *codec = CODEC_DEFLATE;
+            blob_len = BLOB_HEADER_SIZE + packed;
+        } else {
+            free(blob);
+            blob = NULL;
+        }
+    }
+    if (!blob) {
+        blob = malloc(BLOB_HEADER_SIZE + size);
+        if (!blob) return -1;
+        if (size > 0) memcpy(blob + BLOB_HEADER_SIZE, data, size);
+        blob_len = BLOB_HEADER_SIZE + size;
+    }
+    write_header(blob, *codec, size);
+
+    pthread_mutex_lock(&compression_stats.mutex);
+    compression_stats.files[*codec]++;
+    compression_stats.logical_bytes += size;
+    compression_stats.stored_bytes += blob_len;
+    pthread_mutex_unlock(&compression_stats.mutex);
+
+    *out = (char *)blob;
+    *out_len = blob_len;
+    return 0;
+}
+
+// Decoded size of a legacy base64 blob from its length and padding
+static int base64_blob_size(int fd, off_t stored, size_t *size) {
+    if (stored % 4 != 0) return -1;
+    size_t decoded = ((size_t)stored / 4) * 3;
+    if (stored >= 2) {
+        char tail[2];
+        if (pread(fd, tail, 2, stored - 2) != 2) return -1;
+        if (tail[1] == '=') decoded--;
+        if (tail[0] == '=') decoded--;
+    }
+    *size = decoded;
+    return 0;
+}
+
+// Logical size of the blob open on fd, whatever its codec
+int blob_logical_size_fd(int fd, size_t *size) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !size) return -1;
+    unsigned char header[BLOB_HEADER_SIZE];
+    storage_codec_t codec;
+    if (st.st_size >= BLOB_HEADER_SIZE && pread(fd, header, BLOB_HEADER_SIZE, 0) == BLOB_HEADER_SIZE &&
+        parse_header(header, &codec, size) == 0) {
+        return 0;
+    }
+    return base64_blob_size(fd, st.st_size, size);
+}
+
+blob_reader_t* blob_reader_open(const char *path, size_t *size) {
+    if (!path) return NULL;
+    blob_reader_t *reader = calloc(1, sizeof(blob_reader_t));
+    if (!reader) return NULL;
+    reader->file = fopen(path, "rb");
+    if (!reader->file) {
+        free(reader);
+        return NULL;
+    }
+
+    unsigned char header[BLOB_HEADER_SIZE];
+    size_t got = fread(header, 1, BLOB_HEADER_SIZE, reader->file);
+    if (got == BLOB_HEADER_SIZE && parse_header(header, &reader->codec, &reader->size) == 0) {
+        if (reader->codec == CODEC_DEFLATE) {
+            if (inflateInit(&reader->zs) != Z_OK) {
+                blob_reader_close(reader);
+                return NULL;
+            }
+            reader->zs_ready = 1;
+        }
+    } else {
+        // Legacy base64 blob: decode from the start
+        reader->codec = CODEC_BASE64;
+        struct stat st;
+        if (fstat(fileno(reader->file), &st) != 0 ||
+            base64_blob_size(fileno(reader->file), st.st_size, &reader->size) != 0 ||
+            fseek(reader->file, 0, SEEK_SET) != 0) {
+            blob_reader_close(reader);
+            return NULL;
+        }
+    }
+    if (size) *size = reader->size;
+    return reader;
+}
+
+static ssize_t read_deflate(blob_reader_t *reader, char *buf, size_t len) {
+    reader->zs.next_out = (Bytef *)buf;
+    reader->zs.avail_out = (uInt)len;
+    while (reader->zs.avail_out > 0) {
+        if (reader->zs.avail_in == 0) {
+            size_t n = fread(reader->in, 1, sizeof(reader->in), reader->file);
+            if (n == 0) return -1;           // truncated
+            reader->zs.next_in = reader->in;
+            reader->zs.avail_in = (uInt)n;
+        }
+        int rc = inflate(&reader->zs, Z_NO_FLUSH);
+        if (rc == Z_STREAM_END) break;
+        if (rc != Z_OK) return -1;
+    }
+    return (ssize_t)(len - reader->zs.avail_out);
+}
+
+static ssize_t read_base64(blob_reader_t *reader, char *buf, size_t len) {
+    if (reader->pending_off == reader->pending_len) {
+        free(reader->pending);
+        reader->pending = NULL;
+        reader->pending_len = reader->pending_off = 0;
+        size_t n = fread(reader->in, 1, sizeof(reader->in), reader->file);
+        if (n == 0 || base64_decode((const char *)reader->in, n, &reader->pending, &reader->pending_len) != 0) {
+            return -1;
+        }
+    }
+    size_t take = reader->pending_len - reader->pending_off;
+    if (take > len) take = len;
+    memcpy(buf, reader->pending + reader->pending_off, take);
+    reader->pending_off += take;
+    return (ssize_t)take;
+}
+
+// Read up to len logical bytes; 0 at the end, -1 if the blob is damaged
+ssize_t blob_reader_read(blob_reader_t *reader, char *buf, size_t len) {
+    if (!reader || !buf) return -1;
+    size_t left = reader->size - reader->produced;
+    if (left == 0) return 0;
+    if (len > left) len = left;
+
+    ssize_t n;
+    switch (reader->codec) {
+        case CODEC_RAW:
+            n = (ssize_t)fread(buf, 1, len, reader->file);
+            break;
+        case CODEC_DEFLATE:
+            n = read_deflate(reader, buf, len);
+            break;
+        default:
+            n = read_base64(reader, buf, len);
+            break;
+    }
+    if (n <= 0) return -1;                   // ended before the logical size
+    reader->produced += (size_t)n;
+    return n;
+}
+
+storage_codec_t blob_reader_codec(const blob_reader_t *reader) {
+    return reader ? reader->codec : CODEC_BASE64;
+}
+
+// A raw blob's remaining bytes can be sent straight from its file: returns
+// the descriptor and sets *offset to where they start; -1 for encoded blobs
+int blob_reader_raw_fd(const blob_reader_t *reader, off_t *offset) {
+    if (!reader || reader->codec != CODEC_RAW || !offset) return -1;
+    *offset = (off_t)(BLOB_HEADER_SIZE + reader->produced);
+    return fileno(reader->file);
+}
+
+void blob_reader_close(blob_reader_t *reader) {
+    if (!reader) return;
+    if (reader->zs_ready) inflateEnd(&reader->zs);
+    if (reader->file) fclose(reader->file);
+    free(reader->pending);
+    free(reader);
+}
+
+void format_compression_stats(char *buffer, size_t buffer_size) {
+    if (!buffer || buffer_size == 0) return;
+    pthread_mutex_lock(&compression_stats.mutex);
+    unsigned long long logical = compression_stats.logical_bytes;
+    snprintf(buffer, buffer_size,
+             "[compression] mode=%s level=%d raw=%lu deflate=%lu logical_bytes=%llu stored_bytes=%llu ratio=%.2f\n",
+             g_config.compression, g_config.compression_level, compression_stats.files[CODEC_RAW],
+             compression_stats.files[CODEC_DEFLATE], logical, compression_stats.stored_bytes,
+             compression_stats.stored_bytes ? (double)logical / compression_stats.stored_bytes : 0.0);
+    pthread_mutex_unlock(&compression_stats.mutex);
+}
@@ -0,0 +1,398 @@
+#include "dropbox_server.h"
+#include <stddef.h>
+#include <limits.h>
+
+// Runtime configuration, seeded with the compile-time defaults so code that
+// links the storage objects without calling load_server_config still works
+server_config_t g_config = {
+    .port = PORT,
+    .client_threads = CLIENT_THREADPOOL_SIZE,
+    .worker_threads = WORKER_THREADPOOL_SIZE,
+    .worker_threads_max = WORKER_THREADPOOL_MAX,
+    .metadata_threads = METADATA_THREADPOOL_SIZE,
+    .metadata_threads_max = METADATA_THREADPOOL_MAX,
+    .metadata_lane_max_bytes = METADATA_LANE_MAX_BYTES,
+    .fair_quantum = FAIR_QUANTUM,
+    .priority_aging_ms = PRIORITY_AGING_MS,
+    .user_weights = "",
+    .queue_wait_target_ms = QUEUE_WAIT_TARGET_MS,
+    .worker_idle_timeout_ms = WORKER_IDLE_TIMEOUT_MS,
+    .task_timeout_ms = TASK_TIMEOUT_MS,
+    .transfer_stall_timeout_ms = TRANSFER_STALL_TIMEOUT_MS,
+    .durability = DURABILITY_MODE,
+    .commit_interval_ms = COMMIT_INTERVAL_MS,
+    .startup_scan_threads = STARTUP_SCAN_THREADS,
+    .scrub_interval_s = SCRUB_INTERVAL_S,
+    .scrub_rate_kb = SCRUB_RATE_KB,
+    .scrub_quarantine = 1,
+    .session_token_ttl_s = SESSION_TOKEN_TTL_S,
+    .watch_timeout_s = WATCH_TIMEOUT_S,
+    .change_log_retention = CHANGE_LOG_RETENTION,
+    .versions_keep = VERSIONS_KEEP,
+    .versions_max_age_s = VERSIONS_MAX_AGE_S,
+    .hash_threads = HASH_THREADS,
+    .compression = COMPRESSION_MODE,
+    .compression_level = COMPRESSION_LEVEL,
+    .queue_size = QUEUE_SIZE,
+    .max_file_size_mb = MAX_FILE_SIZE_MB,
+    .user_quota_mb = USER_QUOTA_MB,
+    .config_path = DEFAULT_CONFIG_FILE,
+};
+
+typedef enum {
+    CONFIG_INT,
+    CONFIG_SIZE,
+    CONFIG_STRING        // max is the destination buffer size
+} config_type_t;
+
+// One entry per tunable. The same key is used in the config file, as the
+// CLI flag (underscores become dashes) and as the DROPBOX_<KEY> env variable.
+typedef struct {
+    const char *key;
+    config_type_t type;
+    size_t offset;
+    long min;
+    long max;
+    int auto_per_core;   // "auto" = online cores * this (0 = not allowed)
+    const char *help;
+} config_option_t;
+
+static const config_option_t config_options[] = {
+    { "port", CONFIG_INT, offsetof(server_config_t, port), 1, 65535, 0,
+      "TCP port to listen on" },
+    { "client_threads", CONFIG_INT, offsetof(server_config_t, client_threads), 1, 4096, 4,
+      "client (session) threads, or auto" },
+    { "worker_threads", CONFIG_INT, offsetof(server_config_t, worker_threads), 1, 4096, 2,
+      "minimum bulk-lane (upload/download) worker threads, or auto" },
+    { "worker_threads_max", CONFIG_INT, offsetof(server_config_t, worker_threads_max), 1, 4096, 8,
+      "ceiling for the adaptive bulk-lane pool, or auto" },
+    { "metadata_threads", CONFIG_INT, offsetof(server_config_t, metadata_threads), 1, 4096, 1,
+      "minimum metadata-lane (list/delete/small download) threads, or auto" },
+    { "metadata_threads_max", CONFIG_INT, offsetof(server_config_t, metadata_threads_max), 1, 4096, 4,
+      "ceiling for the adaptive metadata-lane pool, or auto" },
+    { "metadata_lane_max_bytes", CONFIG_SIZE, offsetof(server_config_t, metadata_lane_max_bytes), 0, LONG_MAX, 0,
+      "downloads up to this size use the metadata lane" },
+    { "queue_wait_target_ms", CONFIG_INT, offsetof(server_config_t, queue_wait_target_ms), 1, 600000, 0,
+      "grow the worker pool when tasks wait longer than this" },
+    { "worker_idle_timeout_ms", CONFIG_INT, offsetof(server_config_t, worker_idle_timeout_ms), 10, 3600000, 0,
+      "retire extra workers idle for this long" },
+    { "task_timeout_ms", CONFIG_INT, offsetof(server_config_t, task_timeout_ms), 0, 86400000, 0,
+      "drop a request still queued after this long (0 = no deadline)" },
+    { "transfer_stall_timeout_ms", CONFIG_INT, offsetof(server_config_t, transfer_stall_timeout_ms), 0, 86400000, 0,
+      "abort a transfer that moves no bytes for this long (0 = never)" },
+    { "durability", CONFIG_STRING, offsetof(server_config_t, durability), 0,
+      sizeof(((server_config_t *)0)->durability), 0,
+      "none, fsync (per write) or group (batched syncfs commits)" },
+    { "commit_interval_ms", CONFIG_INT, offsetof(server_config_t, commit_interval_ms), 0, 1000, 0,
+      "group mode: extra time to gather writers into one commit" },
+    { "startup_scan_threads", CONFIG_INT, offsetof(server_config_t, startup_scan_threads), 1, 1024, 2,
+      "threads scanning storage/ to rebuild the index at startup, or auto" },
+    { "scrub_interval_s", CONFIG_INT, offsetof(server_config_t, scrub_interval_s), 0, 30 * 86400, 0,
+      "seconds between integrity scrub passes (0 = scrubber off)" },
+    { "scrub_rate_kb", CONFIG_INT, offsetof(server_config_t, scrub_rate_kb), 1, 1024 * 1024, 0,
+      "scrubber read budget in KB per second" },
+    { "scrub_quarantine", CONFIG_INT, offsetof(server_config_t, scrub_quarantine), 0, 1, 0,
+      "1 = move corrupt files to storage/.quarantine, 0 = only report them" },
+    { "session_token_ttl_s", CONFIG_INT, offsetof(server_config_t, session_token_ttl_s), 0, 30 * 86400, 0,
+      "seconds a session resumption token stays valid (0 = no tokens)" },
+    { "watch_timeout_s", CONFIG_INT, offsetof(server_config_t, watch_timeout_s), 1, 3600, 0,
+      "seconds a WATCH waits for a change before answering with none" },
+    { "change_log_retention", CONFIG_INT, offsetof(server_config_t, change_log_retention), CHANGE_FEED_SIZE, 10000000, 0,
+      "changes kept in each user's change log for CHANGES" },
+    { "versions_keep", CONFIG_INT, offsetof(server_config_t, versions_keep), 0, 1000, 0,
+      "earlier versions kept per file when it is overwritten (0 = no versioning)" },
+    { "versions_max_age_s", CONFIG_INT, offsetof(server_config_t, versions_max_age_s), 0, 3650 * 86400, 0,
+      "seconds a replaced version is kept (0 = until versions_keep pushes it out)" },
+    { "hash_threads", CONFIG_INT, offsetof(server_config_t, hash_threads), 1, 256, 1,
+      "threads hashing the chunks of one large file, or auto" },
+    { "compression", CONFIG_STRING, offsetof(server_config_t, compression), 0,
+      sizeof(((server_config_t *)0)->compression), 0,
+      "auto (deflate files that look compressible) or off" },
+    { "compression_level", CONFIG_INT, offsetof(server_config_t, compression_level), 1, 9, 0,
+      "deflate level for compressed blobs (1 = fastest)" },
+    { "fair_quantum", CONFIG_INT, offsetof(server_config_t, fair_quantum), 1, 1000, 0,
+      "tasks a user may dequeue per round-robin turn (times weight)" },
+    { "priority_aging_ms", CONFIG_INT, offsetof(server_config_t, priority_aging_ms), 0, 3600000, 0,
+      "promote a queued task one priority band per this much wait (0 = off)" },
+    { "user_weights", CONFIG_STRING, offsetof(server_config_t, user_weights), 0,
+      sizeof(((server_config_t *)0)->user_weights), 0,
+      "fair-share weights, e.g. alice:4,bob:2 (default 1)" },
+    { "queue_size", CONFIG_INT, offsetof(server_config_t, queue_size), 1, 1000000, 0,
+      "client and task queue capacity" },
+    { "max_file_size_mb", CONFIG_SIZE, offsetof(server_config_t, max_file_size_mb), 1, 1024 * 1024, 0,
+      "largest accepted upload in MB" },
+    { "user_quota_mb", CONFIG_SIZE, offsetof(server_config_t, user_quota_mb), 1, LONG_MAX / (1024 * 1024), 0,
+      "default per-user quota in MB" },
+};
+
+#define CONFIG_OPTION_COUNT (sizeof(config_options) / sizeof(config_options[0]))
+
+static int online_cores(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+static const config_option_t *find_option(const char *key) {
+    for (size_t i = 0; i < CONFIG_OPTION_COUNT; i++) {
+        if (strcmp(config_options[i].key, key) == 0) return &config_options[i];
+    }
+    return NULL;
+}
+
+// Parse and store one value; source is only used for error messages
+static int apply_option(server_config_t *config, const config_option_t *opt,
+                        const char *value, const char *source) {
+    char *field = (char *)config + opt->offset;
+    if (opt->type == CONFIG_STRING) {
+        if (strlen(value) >= (size_t)opt->max) {
+            fprintf(stderr, "Config error (%s): %s is longer than %ld characters\n",
+                    source, opt->key, opt->max - 1);
+            return -1;
+        }
+        strcpy(field, value);
+        return 0;
+    }
+
+    long parsed;
+    if (opt->auto_per_core && strcmp(value, "auto") == 0) {
+        parsed = (long)online_cores() * opt->auto_per_core;
+        if (parsed > opt->max) parsed = opt->max;
+    } else {
+        char *end = NULL;
+        errno = 0;
+        parsed = strtol(value, &end, 10);
+        if (errno != 0 || end == value || *end != '\0') {
+            fprintf(stderr, "Config error (%s): '%s' is not a valid value for %s\n",
+                    source, value, opt->key);
+            return -1;
+        }
+    }
+
+    if (parsed < opt->min || parsed > opt->max) {
+        fprintf(stderr, "Config error (%s): %s must be between %ld and %ld (got %ld)\n",
+                source, opt->key, opt->min, opt->max, parsed);
+        return -1;
+    }
+
+    if (opt->type == CONFIG_INT) {
+        *(int *)field = (int)parsed;
+    } else {
+        *(size_t *)field = (size_t)parsed;
+    }
+    return 0;
+}
+
+static char *trim_whitespace(char *s) {
+    while (*s && isspace((unsigned char)*s)) s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) *--end = '\0';
+    return s;
+}
+
+// Load "key = value" lines; '#' starts a comment. A missing default file is not an error.
+static int load_config_file(server_config_t *config, const char *path, int required) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        if (required) {
+            fprintf(stderr, "Config error: cannot open %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+    char line[512];
+    int line_no = 0;
+    int result = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_no++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char *text = trim_whitespace(line);
+        if (*text == '\0') continue;
+
+        char *eq = strchr(text, '=');
+        if (!eq) {
+            fprintf(stderr, "Config error (%s:%d): expected key = value\n", path, line_no);
+            result = -1;
+            continue;
+        }
+        *eq = '\0';
+        char *key = trim_whitespace(text);
+        char *value = trim_whitespace(eq + 1);
+
+        char source[600];
+        snprintf(source, sizeof(source), "%s:%d", path, line_no);
+        const config_option_t *opt = find_option(key);
+        if (!opt) {
+            fprintf(stderr, "Config error (%s): unknown key '%s'\n", source, key);
+            result = -1;
+            continue;
+        }
+        if (apply_option(config, opt, value, source) != 0) result = -1;
+    }
+
+    fclose(file);
+    return result;
+}
+
+static int load_config_env(server_config_t *config) {
+    int result = 0;
+    for (size_t i = 0; i < CONFIG_OPTION_COUNT; i++) {
+        char env_name[64] = "DROPBOX_";
+        size_t len = strlen(env_name);
+        for (const char *k = config_options[i].key; *k && len < sizeof(env_name) - 1; k++) {
+            env_name[len++] = (char)toupper((unsigned char)*k);
+        }
+        env_name[len] = '\0';
+
+        const char *value = getenv(env_name);
+        if (value && *value) {
+            if (apply_option(config, &config_options[i], value, env_name) != 0) result = -1;
+        }
+    }
+    return result;
+}
+
+// Match "--client-threads" against the "client_threads" key
+static const config_option_t *find_flag(const char *flag) {
+    if (strncmp(flag, "--", 2) != 0) return NULL;
+    char key[64];
+    size_t len = 0;
+    for (const char *f = flag + 2; *f && *f != '=' && len < sizeof(key) - 1; f++) {
+        key[len++] = (*f == '-') ? '_' : *f;
+    }
+    key[len] = '\0';
+    return find_option(key);
+}
+
+static void print_usage(const char *program) {
+    printf("Usage: %s [--config FILE] [options]\n\n", program);
+    printf("Options (also settable as key = value in the config file or DROPBOX_<KEY> env):\n");
+    for (size_t i = 0; i < CONFIG_OPTION_COUNT; i++) {
+        char flag[64];
+        size_t len = 0;
+        for (const char *k = config_options[i].key; *k && len < sizeof(flag) - 1; k++) {
+            flag[len++] = (*k == '_') ? '-' : *k;
+        }
+        flag[len] = '\0';
+        printf("  --%-22s %s\n", flag, config_options[i].help);
+    }
+    printf("\nPrecedence: defaults < config file (%s) < environment < command line\n",
+           DEFAULT_CONFIG_FILE);
+}
+
+// Build the runtime configuration: defaults, then config file, env, CLI.
+// Returns 0 on success, -1 on any invalid setting.
+int load_server_config(server_config_t *config, int argc, char **argv) {
+    if (!config) return -1;
+
+    // The config file location itself can come from the CLI or env
+    const char *path = getenv("DROPBOX_CONFIG");
+    int required = path != NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        }
+        if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            path = argv[i + 1];
+            required = 1;
+        } else if (strncmp(argv[i], "--config=", 9) == 0) {
+            path = argv[i] + 9;
+            required = 1;
+        }
+    }
+    if (!path) path = DEFAULT_CONFIG_FILE;
+    strncpy(config->config_path, path, sizeof(config->config_path) - 1);
+    config->config_path[sizeof(config->config_path) - 1] = '\0';
+
+    int result = 0;
+    if (load_config_file(config, config->config_path, required) != 0) result = -1;
+    if (load_config_env(config) != 0) result = -1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--config") == 0) {
+            i++;
+            continue;
+        }
+        if (strncmp(argv[i], "--config=", 9) == 0) continue;
+
+        const config_option_t *opt = find_flag(argv[i]);
+        if (!opt) {
+            fprintf(stderr, "Config error: unknown option '%s' (see --help)\n", argv[i]);
+            result = -1;
+            continue;
+        }
+        const char *value = strchr(argv[i], '=');
+        if (value) {
+            value++;
+        } else if (i + 1 < argc) {
+            value = argv[++i];
+        } else {
+            fprintf(stderr, "Config error: option '%s' needs a value\n", argv[i]);
+            result = -1;
+            continue;
+        }
+        if (apply_option(config, opt, value, "command line") != 0) result = -1;
+    }
+
+    if (strcmp(config->compression, "auto") != 0 && strcmp(config->compression, "off") != 0) {
+        fprintf(stderr, "Unknown compression mode '%s' (use auto or off)\n", config->compression);
+        result = -1;
+    }
+
+    // The adaptive pool never shrinks below its minimum
+    if (config->worker_threads_max < config->worker_threads) {
+        config->worker_threads_max = config->worker_threads;
+    }
+    if (config->metadata_threads_max < config->metadata_threads) {
+        config->metadata_threads_max = config->metadata_threads;
+    }
+
+    return result;
+}
+
+void print_server_config(const server_config_t *config) {
+    if (!config) return;
+    printf("Server configuration:\n");
+    printf("  Config file: %s\n", config->config_path);
+    printf("  Port: %d\n", config->port);
+    printf("  Max clients: %d\n", MAX_CLIENTS);
+    printf("  Client thread pool size: %d\n", config->client_threads);
+    printf("  Bulk worker pool size: %d-%d\n", config->worker_threads, config->worker_threads_max);
+    printf("  Metadata worker pool size: %d-%d (downloads up to %zu bytes)\n",
+           config->metadata_threads, config->metadata_threads_max, config->metadata_lane_max_bytes);
+    printf("  Pool wait target: %dms, idle timeout: %dms\n",
+           config->queue_wait_target_ms, config->worker_idle_timeout_ms);
+    printf("  Task timeout: %dms%s\n", config->task_timeout_ms,
+           config->task_timeout_ms > 0 ? "" : " (disabled)");
+    printf("  Transfer stall timeout: %dms%s\n", config->transfer_stall_timeout_ms,
+           config->transfer_stall_timeout_ms > 0 ? "" : " (disabled)");
+    printf("  Durability: %s (commit interval %dms)\n", config->durability, config->commit_interval_ms);
+    printf("  Startup scan threads: %d\n", config->startup_scan_threads);
+    if (config->scrub_interval_s > 0) {
+        printf("  Scrubber: every %ds at %d KB/s, %s\n", config->scrub_interval_s, config->scrub_rate_kb,
+               config->scrub_quarantine ? "quarantine" : "report only");
+    } else {
+        printf("  Scrubber: off\n");
+    }
+    if (config->session_token_ttl_s > 0) {
+        printf("  Session tokens: valid %ds\n", config->session_token_ttl_s);
+    } else {
+        printf("  Session tokens: off\n");
+    }
+    printf("  WATCH timeout: %ds\n", config->watch_timeout_s);
+    printf("  Change log retention: %d changes per user\n", config->change_log_retention);
+    if (config->versions_keep > 0) {
+        printf("  File versions: %d per file, max age %ds\n", config->versions_keep, config->versions_max_age_s);
+    } else {
+        printf("  File versions: off\n");
+    }
+    printf("  Chunk hashing threads: %d (%d KB chunks)\n", config->hash_threads, MERKLE_CHUNK_SIZE / 1024);
+    printf("  Compression: %s (level %d)\n", config->compression, config->compression_level);
+    printf("  Fair queueing: quantum %d, aging %dms, weights '%s'\n",
+           config->fair_quantum, config->priority_aging_ms, config->user_weights);
+    printf("  Queue capacity: %d\n", config->queue_size);
+    printf("  Max file size: %zu MB\n", config->max_file_size_mb);
+    printf("  User quota: %zu MB\n", config->user_quota_mb);
+}
@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+#include "dropbox_server.h"
+
+// Resident credential store. Every account lives in one hash table loaded
+// at startup, so LOGIN is a lookup under a read lock instead of an
+// open/read/close of users/<name>.txt.
+//
+// The table is backed by CREDENTIALS_FILE, an append-only log with one
+// account per line:
+//
+//   <username> <password> <fnv1a of the first two fields, 8 hex digits>
+//
+// SIGNUP appends its line and syncs it before the account becomes visible,
+// so an acknowledged signup survives a crash; a torn last line fails its
+// checksum and is cut off at the next load. Accounts from the older
+// one-file-per-user layout (users/<name>.txt) are imported on first load;
+// those files are left in place.
+
+#define CREDENTIALS_MIN_BUCKETS 1024
+#define CREDENTIALS_LINE_MAX (MAX_USERNAME + MAX_PASSWORD + 16)
+
+typedef struct credential {
+    char username[MAX_USERNAME];
+    char password[MAX_PASSWORD];
+    struct credential *next;
+} credential_t;
+
+static struct {
+    credential_t **buckets;
+    size_t bucket_count;
+    size_t count;
+    int fd;                          // CREDENTIALS_FILE, opened O_APPEND
+    pthread_rwlock_t lock;           // table lookups and inserts
+    pthread_mutex_t append_mutex;    // one signup appends at a time
+} credentials = {
+    .fd = -1,
+    .lock = PTHREAD_RWLOCK_INITIALIZER,
+    .append_mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static size_t hash_username(const char *name) {
+    size_t hash = 5381;
+    while (*name) hash = hash * 33 + (unsigned char)*name++;
+    return hash;
+}
+
+static unsigned int credentials_crc(const char *text, size_t len) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Caller holds the table lock
+static credential_t* find_locked(const char *username) {
+    if (!credentials.buckets) return NULL;
+    credential_t *c = credentials.buckets[hash_username(username) % credentials.bucket_count];
+    for (; c; c = c->next) {
+        if (strcmp(c->username, username) == 0) return c;
+    }
+    return NULL;
+}
+
+// Double the buckets once the average chain passes two entries
+static void grow_locked(void) {
+    if (credentials.count < credentials.bucket_count * 2) return;
+    size_t new_count = credentials.bucket_count * 2;
+    credential_t **buckets = calloc(new_count, sizeof(credential_t *));
+    if (!buckets) return;
+    for (size_t b = 0; b < credentials.bucket_count; b++) {
+        credential_t *c = credentials.buckets[b];
+        while (c) {
+            credential_t *next = c->next;
+            size_t slot = hash_username(c->username) % new_count;
+            c->next = buckets[slot];
+            buckets[slot] = c;
+            c = next;
+        }
+    }
+    free(credentials.buckets);
+    credentials.buckets = buckets;
+    credentials.bucket_count = new_count;
+}
+
+// Caller holds the table write lock; a later line for a name replaces it
+static int insert_locked(const char *username, const char *password) {
+    credential_t *c = find_locked(username);
+    if (!c) {
+        c = calloc(1, sizeof(credential_t));
+        if (!c) return -1;
+        strncpy(c->username, username, MAX_USERNAME - 1);
+        size_t slot = hash_username(username) % credentials.bucket_count;
+        c->next = credentials.buckets[slot];
+        credentials.buckets[slot] = c;
+        credentials.count++;
+        grow_locked();
+    }
+    strncpy(c->password, password, MAX_PASSWORD - 1);
+    c->password[MAX_PASSWORD - 1] = '\0';
+    return 0;
+}
+
+// Names become directory and file names, so keep them to one path component
+int valid_username(const char *username) {
+    if (!username || username[0] == '\0' || username[0] == '.') return 0;
+    if (strlen(username) >= MAX_USERNAME) return 0;
+    return strchr(username, '/') == NULL;
+}
+
+static int append_line(const char *username, const char *password) {
+    char line[CREDENTIALS_LINE_MAX];
+    int body = snprintf(line, sizeof(line), "%s %s", username, password);
+    if (body < 0 || (size_t)body >= sizeof(line)) return -1;
+    int len = snprintf(line + body, sizeof(line) - body, " %08x\n", credentials_crc(line, (size_t)body));
+    if (len < 0 || (size_t)(body + len) >= sizeof(line)) return -1;
+    len += body;
+    if (write(credentials.fd, line, (size_t)len) != len) {
+        perror("Failed to append to credentials file");
+        return -1;
+    }
+    return 0;
+}
+
+// Parse the log; returns the length of the valid prefix
+static size_t load_lines(char *contents, size_t size, unsigned long *loaded) {
+    size_t valid = 0;
+    char *line = contents;
+    while ((size_t)(line - contents) < size) {
+        char *end = memchr(line, '\n', size - (size_t)(line - contents));
+        if (!end) break;                             // torn tail
+        *end = '\0';
+        char *crc_field = strrchr(line, ' ');
+        unsigned int crc;
+        char username[MAX_USERNAME], password[MAX_PASSWORD], extra;
+        if (!crc_field || sscanf(crc_field + 1, "%8x", &crc) != 1 ||
+            crc != credentials_crc(line, (size_t)(crc_field - line))) {
+            break;
+        }
+        *crc_field = '\0';
+        if (sscanf(line, "%49s %49s %c", username, password, &extra) != 2 || !valid_username(username)) break;
+        if (insert_locked(username, password) != 0) break;
+        (*loaded)++;
+        line = end + 1;
+        valid = (size_t)(line - contents);
+    }
+    return valid;
+}
+
+// Bring in users/<name>.txt accounts the log does not know yet
+static unsigned long import_legacy(void) {
+    DIR *dir = opendir("users");
+    if (!dir) return 0;
+    unsigned long imported = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len <= 4 || len - 4 >= MAX_USERNAME || strcmp(entry->d_name + len - 4, ".txt") != 0) continue;
+        char username[MAX_USERNAME];
+        memcpy(username, entry->d_name, len - 4);
+        username[len - 4] = '\0';
+        if (!valid_username(username) || find_locked(username)) continue;
+
+        char path[512], password[MAX_PASSWORD];
+        snprintf(path, sizeof(path), "users/%s", entry->d_name);
+        FILE *file = fopen(path, "r");
+        if (!file) continue;
+        char *got = fgets(password, sizeof(password), file);
+        fclose(file);
+        if (!got) continue;
+        password[strcspn(password, "\r\n")] = '\0';
+        if (password[0] == '\0' || strchr(password, ' ')) continue;
+
+        if (append_line(username, password) == 0 && insert_locked(username, password) == 0) imported++;
+    }
+    closedir(dir);
+    return imported;
+}
+
+// Load the credential log (and any legacy per-user files) into memory.
+// Must run after durability_init and before clients are accepted.
+int credentials_load(void) {
+    struct stat st;
+    if (stat("users", &st) == -1 && mkdir("users", 0700) != 0) {
+        perror("Failed to create users directory");
+        return -1;
+    }
+    int created = stat(CREDENTIALS_FILE, &st) != 0;
+    credentials.fd = open(CREDENTIALS_FILE, O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (credentials.fd < 0) {
+        perror("Failed to open credentials file");
+        return -1;
+    }
+    if (created && durability_sync_dir(CREDENTIALS_FILE) != 0) return -1;
+
+    pthread_rwlock_wrlock(&credentials.lock);
+    credentials.bucket_count = CREDENTIALS_MIN_BUCKETS;
+    credentials.buckets = calloc(credentials.bucket_count, sizeof(credential_t *));
+    if (!credentials.buckets) {
+        pthread_rwlock_unlock(&credentials.lock);
+        return -1;
+    }
+
+    unsigned long loaded = 0, imported = 0;
+    int rc = 0;
+    if (fstat(credentials.fd, &st) == 0 && st.st_size > 0) {
+        char *contents = malloc((size_t)st.st_size);
+        if (!contents || pread(credentials.fd, contents, (size_t)st.st_size, 0) != st.st_size) {
+            perror("Failed to read credentials file");
+            rc = -1;
+        } else {
+            size_t valid = load_lines(contents, (size_t)st.st_size, &loaded);
+            if (valid < (size_t)st.st_size) {
+                fprintf(stderr, "Credentials: dropping %lld damaged byte(s) at the end of %s\n",
+                        (long long)st.st_size - (long long)valid, CREDENTIALS_FILE);
+                if (ftruncate(credentials.fd, (off_t)valid) != 0) rc = -1;
+            }
+        }
+        free(contents);
+    }
+    if (rc == 0) {
+        imported = import_legacy();
+        if (imported > 0 && durability_sync_fd(credentials.fd) != 0) rc = -1;
+    }
+    pthread_rwlock_unlock(&credentials.lock);
+
+    if (rc == 0) {
+        printf("Credentials: %lu account(s) loaded, %lu imported from per-user files\n", loaded, imported);
+    }
+    return rc;
+}
+
+void credentials_close(void) {
+    pthread_rwlock_wrlock(&credentials.lock);
+    for (size_t b = 0; credentials.buckets && b < credentials.bucket_count; b++) {
+        credential_t *c = credentials.buckets[b];
+        while (c) {
+            credential_t *next = c->next;
+            free(c);
+            c = next;
+        }
+    }
+    free(credentials.buckets);
+    credentials.buckets = NULL;
+    credentials.count = 0;
+    if (credentials.fd >= 0) close(credentials.fd);
+    credentials.fd = -1;
+    pthread_rwlock_unlock(&credentials.lock);
+}
+
+// 0 if the account exists and the password matches
+int credentials_check(const char *username, const char *password) {
+    pthread_rwlock_rdlock(&credentials.lock);
+    credential_t *c = find_locked(username);
+    int ok = c && strcmp(c->password, password) == 0;
+    pthread_rwlock_unlock(&credentials.lock);
+    return ok ? 0 : -1;
+}
+
+// Create an account: the line is durable before anyone can log in with
+// it. Returns 1 if the name is taken, -1 on failure.
+int credentials_add(const char *username, const char *password) {
+    if (!valid_username(username) || !password || password[0] == '\0' ||
+        strlen(password) >= MAX_PASSWORD || strchr(password, ' ')) {
+        return -1;
+    }
+    // Appends are serialised so two signups cannot claim one name; logins
+    // only wait for the final insert, not for the sync
+    pthread_mutex_lock(&credentials.append_mutex);
+    pthread_rwlock_rdlock(&credentials.lock);
+    int taken = find_locked(username) != NULL;
+    int is_open = credentials.fd >= 0;
+    pthread_rwlock_unlock(&credentials.lock);
+    if (taken || !is_open) {
+        pthread_mutex_unlock(&credentials.append_mutex);
+        return taken ? 1 : -1;
+    }
+
+    int rc = append_line(username, password);
+    if (rc == 0) rc = durability_sync_fd(credentials.fd);
+    if (rc == 0) {
+        pthread_rwlock_wrlock(&credentials.lock);
+        rc = insert_locked(username, password);
+        pthread_rwlock_unlock(&credentials.lock);
+    }
+    pthread_mutex_unlock(&credentials.append_mutex);
+    return rc;
+}
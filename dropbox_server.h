@@ -15,13 +15,61 @@
 #include <sys/stat.h>
 #include <time.h>
 #include <ctype.h>
+#include <dirent.h>
 #include <signal.h>
 
+// Compile-time defaults; override at runtime via the config file,
+// DROPBOX_* environment variables or command-line flags (see config.c)
 #define PORT 8080
 #define MAX_CLIENTS 100
 #define CLIENT_THREADPOOL_SIZE 10
 #define WORKER_THREADPOOL_SIZE 5
 #define QUEUE_SIZE 50
+#define WORKER_THREADPOOL_MAX 20
+#define METADATA_THREADPOOL_SIZE 2
+#define METADATA_THREADPOOL_MAX 8
+#define METADATA_LANE_MAX_BYTES (64 * 1024)
+#define FAIR_QUANTUM 1
+#define PRIORITY_AGING_MS 2000
+#define MAX_QUEUE_USER_STATS 256
+#define QUEUE_WAIT_TARGET_MS 50
+#define WORKER_IDLE_TIMEOUT_MS 10000
+#define TASK_TIMEOUT_MS 60000
+#define TRANSFER_STALL_TIMEOUT_MS 30000
+#define DURABILITY_MODE "group"
+#define COMMIT_INTERVAL_MS 0
+#define STARTUP_SCAN_THREADS 4
+#define SCRUB_INTERVAL_S 3600
+#define SCRUB_RATE_KB 8192
+#define QUARANTINE_DIR ".quarantine"
+#define HASH_THREADS 4
+#define COMPRESSION_MODE "auto"
+#define COMPRESSION_LEVEL 1
+#define MERKLE_CHUNK_SIZE (256 * 1024)
+#define SHARD_FANOUT 64
+#define LIST_DEFAULT_LIMIT 1000
+#define LIST_MAX_LIMIT 10000
+#define LIST_BATCH_ROWS 128
+#define LIST_STREAM_BUFFER (16 * 1024)
+#define LOCAL_TIME_LEN 19               // "YYYY-MM-DD HH:MM:SS"
+#define BATCH_MAX_FILES 1000
+#define TAR_BLOCK 512
+#define TAR_RECORD (20 * TAR_BLOCK)
+#define TAR_HEADER_MAX (3 * TAR_BLOCK)     // pax name header, its data, ustar header
+#define MAX_FILE_SIZE_MB 10
+#define USER_QUOTA_MB 50
+#define DEFAULT_CONFIG_FILE "dropbox.conf"
+#define CREDENTIALS_FILE "users/credentials"
+#define SESSION_TOKEN_TTL_S 3600
+#define SESSION_TOKEN_LEN 32             // hex characters
+#define SESSION_TOKEN_MAX 100000
+#define WATCH_TIMEOUT_S 60
+#define WATCH_MAX_PARKED 4096
+#define CHANGE_FEED_SIZE 1024            // recent changes kept in memory per user
+#define CHANGE_LOG_RETENTION 10000       // changes kept on disk per user
+#define VERSIONS_KEEP 5                  // earlier versions kept per file
+#define VERSIONS_MAX_AGE_S (30 * 86400)
+#define CHANGE_CURSOR_LEN 48             // "<epoch>.<seq>" plus terminator
 #define BUFFER_SIZE 4096
 #define MAX_USERNAME 50
 #define MAX_PASSWORD 50
@@ -40,10 +88,32 @@ typedef enum {
     TASK_DOWNLOAD,
     TASK_DELETE,
     TASK_LIST,
-    TASK_SHUTDOWN
+    TASK_MUPLOAD,
+    TASK_MDOWNLOAD,
+    TASK_MDELETE,
+    TASK_ARCHIVE,
+    TASK_CHANGES,
+    TASK_SHUTDOWN,
+    TASK_SCRUB              // background checksum verification, no client
 } task_type_t;
 
 
+// Worker lanes: cheap metadata operations never queue behind bulk transfers
+typedef enum {
+    LANE_METADATA,
+    LANE_BULK,
+    LANE_COUNT
+} task_lane_t;
+
+
+// How storage writes are made crash-safe (see durability.c)
+typedef enum {
+    DURABILITY_NONE,
+    DURABILITY_FSYNC,
+    DURABILITY_GROUP
+} durability_mode_t;
+
+
 typedef enum {
     TASK_PENDING,
     TASK_IN_PROGRESS,
@@ -54,9 +124,49 @@ typedef enum {
 
 typedef struct client_queue client_queue_t;
 typedef struct task_queue task_queue_t;
+typedef struct worker_pool worker_pool_t;
+typedef struct user_flow user_flow_t;
 typedef struct task task_t;
 typedef struct user_session user_session_t;
 typedef struct file_metadata file_metadata_t;
+typedef struct blob_reader blob_reader_t;
+typedef struct watch watch_t;
+
+// Called for each leaf directory of a user's sharded tree (see storage_layout.c)
+typedef int (*storage_dir_fn)(const char *dir_path, DIR *dir, void *arg);
+
+// LIST [prefix] [--limit N] [--cursor C] [--sort name|size|mtime]; rows
+// are ordered by the sort key, ties broken by name (see storage_index.c)
+typedef enum {
+    LIST_SORT_NAME = 0,
+    LIST_SORT_SIZE,
+    LIST_SORT_MTIME,
+    LIST_SORT_COUNT
+} list_sort_t;
+
+typedef struct {
+    char prefix[MAX_FILENAME];
+    size_t limit;
+    list_sort_t sort;
+    char cursor[MAX_FILENAME + 32];      // "" for the first page
+} list_query_t;
+
+typedef struct {
+    char name[MAX_FILENAME];
+    size_t size;
+    time_t modified;
+} list_row_t;
+
+// Receives each filled buffer of a streamed listing; nonzero stops it
+typedef int (*list_sink_fn)(const char *data, size_t len, void *arg);
+
+// How a blob's bytes are kept on disk (see compression.c)
+typedef enum {
+    CODEC_BASE64 = 0,                // legacy: whole-file base64, no header
+    CODEC_RAW = 1,
+    CODEC_DEFLATE = 2,
+    CODEC_COUNT
+} storage_codec_t;
 
 
 struct file_metadata {
@@ -65,14 +175,65 @@ struct file_metadata {
     time_t created_time;
     time_t modified_time;
     char checksum[65];
+    storage_codec_t codec;
+    // Chunk tree for files larger than one chunk (see merkle.c); chunk_size
+    // is 0 for smaller files. chunk_hashes holds chunk_count raw digests.
+    size_t chunk_size;
+    int chunk_count;
+    char merkle_root[65];
+    unsigned char *chunk_hashes;
 };
 
 
+// Incremental SHA-256 (see utilities.c); ctx is an EVP_MD_CTX
+#define SHA256_DIGEST_BYTES 32
+
+typedef struct {
+    void *ctx;
+    size_t length;
+} sha256_stream_t;
+
+// One journaled upload or delete (see journal.c)
+#define JOURNAL_UPLOAD 'U'
+#define JOURNAL_DELETE 'D'
+
+typedef struct {
+    char op;
+    unsigned long long seq;          // also names the transaction's temp blob
+    char username[MAX_USERNAME];
+    file_metadata_t metadata;        // filename always; the rest for uploads
+    size_t quota_used;               // user's quota usage after the operation
+} journal_record_t;
+
+
+// Outcome for one file of an MUPLOAD, MDOWNLOAD or MDELETE
+typedef enum {
+    BATCH_OK = 0,
+    BATCH_FAILED,
+    BATCH_BUSY,                      // locked by another operation
+    BATCH_NOT_FOUND,
+    BATCH_TOO_LARGE,
+    BATCH_QUOTA,
+    BATCH_DUPLICATE                  // named twice in one batch
+} batch_status_t;
+
+typedef struct {
+    char filename[MAX_FILENAME];
+    batch_status_t status;
+    size_t size;                     // bytes uploaded, sent or freed
+    int locked;                      // holds its file lock
+    int staged;                      // upload: blob written to its temp file
+    journal_record_t rec;
+} batch_entry_t;
+
+
 struct user_session {
     char username[MAX_USERNAME];
     int socket_fd;
     int authenticated;
     pthread_t client_thread_id;
+    int cancelled;          // set when the client goes away; queued work is dropped
+    pthread_mutex_t mutex;
 };
 
 
@@ -89,6 +250,14 @@ struct task {
     int priority;           
     int encoding_type;     
     time_t creation_time;
+    long long enqueue_ms;   // monotonic time the task entered the queue
+    int band;               // priority band it is queued in (aging may raise it)
+    task_lane_t lane;       // lane queue the task was dispatched to
+    long long deadline_ms;  // monotonic deadline for leaving the queue, 0 = none
+    user_session_t *session; // cancellation token of the submitting client
+    int detached;           // no waiter: the worker frees the task when done
+    int response_sent;      // the worker already wrote the reply to the client
+    int stalled;            // a transfer moved no bytes for transfer_stall_timeout_ms
     
     
     task_status_t status;
@@ -106,54 +275,149 @@ struct task {
 };
 
 
+// A connection parked by WATCH (see watch.c): waiting for a change, or
+// idle after its answer until the client sends the next command
+struct watch {
+    int socket;
+    char username[MAX_USERNAME];
+    char cursor[CHANGE_CURSOR_LEN];
+    int idle;
+    long long deadline_ms;               // monotonic, 0 when idle
+    int poll_slot;                       // index in the watcher's poll set, -1 if not polled yet
+    struct watch *next;
+};
+
+
 struct client_queue {
     int *sockets;
     int front;
     int rear;
     int count;
     int capacity;
+    watch_t *resumed_head;               // sessions the watcher hands back,
+    watch_t *resumed_tail;               // served before new connections
     pthread_mutex_t mutex;
     pthread_cond_t not_empty;
     pthread_cond_t not_full;
 };
 
 
-struct task_queue {
+// Per-user sub-queue inside one priority band, served by deficit round-robin
+struct user_flow {
+    char username[MAX_USERNAME];
     task_t *head;
     task_t *tail;
+    int deficit;             // tasks this flow may still dequeue in its turn
+    int in_turn;             // quantum already granted for the current round
+    struct user_flow *next;
+};
+
+
+typedef struct {
+    user_flow_t *head;       // flow being served; rotated to the tail when its deficit runs out
+    user_flow_t *tail;
+} priority_band_t;
+
+
+typedef struct {
+    char username[MAX_USERNAME];
+    unsigned long dequeued;
+    long long total_wait_ms;
+    long long max_wait_ms;
+} user_wait_stats_t;
+
+
+struct task_queue {
+    priority_band_t bands[MAX_PRIORITY];
     int count;
     int capacity;
+    unsigned long dequeued;       // tasks handed to workers so far
+    long long total_wait_ms;      // summed queue wait of those tasks
+    unsigned long promoted;       // tasks aged into a higher band
+    user_wait_stats_t user_stats[MAX_QUEUE_USER_STATS];
+    int user_stats_count;
     pthread_mutex_t mutex;
     pthread_cond_t not_empty;
     pthread_cond_t not_full;
 };
 
 
+typedef struct {
+    int port;
+    int client_threads;
+    int worker_threads;
+    int worker_threads_max;
+    int metadata_threads;
+    int metadata_threads_max;
+    size_t metadata_lane_max_bytes;
+    int fair_quantum;
+    int priority_aging_ms;
+    char user_weights[512];
+    int queue_wait_target_ms;
+    int worker_idle_timeout_ms;
+    int task_timeout_ms;
+    int transfer_stall_timeout_ms;
+    char durability[16];
+    int commit_interval_ms;
+    int startup_scan_threads;
+    int scrub_interval_s;
+    int scrub_rate_kb;
+    int scrub_quarantine;
+    int session_token_ttl_s;
+    int watch_timeout_s;
+    int change_log_retention;
+    int versions_keep;
+    int versions_max_age_s;
+    int hash_threads;
+    char compression[16];
+    int compression_level;
+    int queue_size;
+    size_t max_file_size_mb;
+    size_t user_quota_mb;
+    char config_path[512];
+} server_config_t;
+
+
 typedef struct {
     client_queue_t *client_queue;
-    task_queue_t *task_queue;
+    task_queue_t *task_queues[LANE_COUNT];
     pthread_t *client_threads;
-    pthread_t *worker_threads;
+    worker_pool_t *worker_pools[LANE_COUNT];
     int server_socket;
     int shutdown_flag;
     pthread_mutex_t shutdown_mutex;
 } server_context_t;
 
 
+int load_server_config(server_config_t *config, int argc, char **argv);
+void print_server_config(const server_config_t *config);
+
 client_queue_t* create_client_queue(int capacity);
 void destroy_client_queue(client_queue_t *queue);
 int enqueue_client(client_queue_t *queue, int socket_fd);
-int dequeue_client(client_queue_t *queue);
+int dequeue_client(client_queue_t *queue, watch_t **resumed);
+void requeue_watch(client_queue_t *queue, watch_t *watch);
 
 task_queue_t* create_task_queue(int capacity);
 void destroy_task_queue(task_queue_t *queue);
 int enqueue_task(task_queue_t *queue, task_t *task);
 task_t* dequeue_task(task_queue_t *queue);
+task_t* dequeue_task_timed(task_queue_t *queue, int timeout_ms);
+int task_queue_depth(task_queue_t *queue);
+long long task_queue_oldest_wait_ms(task_queue_t *queue);
+void format_task_queue_user_stats(task_queue_t *queue, const char *name, char *buffer, size_t buffer_size);
+int remove_task(task_queue_t *queue, task_t *task);
 
 
 task_t* create_task(task_type_t type, int client_socket, const char *username, const char *command);
 task_t* create_priority_task(task_type_t type, int client_socket, const char *username, const char *command, int priority);
 void destroy_task(task_t *task);
+const char* task_abort_reason(task_t *task);
+const char* task_cancel_reason(task_t *task);
+
+int init_user_session(user_session_t *session, int socket_fd, const char *username);
+void destroy_user_session(user_session_t *session);
+void cancel_user_session(user_session_t *session);
 
 
 int enqueue_priority_task(task_queue_t *queue, task_t *task);
@@ -161,24 +425,87 @@ int enqueue_priority_task(task_queue_t *queue, task_t *task);
 void* client_thread_function(void *arg);
 void* worker_thread_function(void *arg);
 
+task_lane_t classify_task(const task_t *task);
+const char* task_lane_name(task_lane_t lane);
+int dispatch_task(server_context_t *server, task_t *task);
+int cancel_queued_task(server_context_t *server, task_t *task);
+
+worker_pool_t* create_worker_pool(server_context_t *server, task_queue_t *queue, const char *name, int min_workers, int max_workers);
+void destroy_worker_pool(worker_pool_t *pool);
+int worker_pool_size(worker_pool_t *pool);
+int worker_pool_idle(worker_pool_t *pool);
+void format_worker_pool_stats(worker_pool_t *pool, char *buffer, size_t buffer_size);
+
 int authenticate_user(int socket_fd, char *username);
 int handle_signup(int socket_fd, const char *username, const char *password);
 int handle_login(int socket_fd, const char *username, const char *password);
+int credentials_load(void);
+void credentials_close(void);
+int credentials_check(const char *username, const char *password);
+int credentials_add(const char *username, const char *password);
+int valid_username(const char *username);
+int session_token_issue(const char *username, char *token);
+int session_token_resume(const char *token, char *username);
+void session_tokens_clear(void);
 
 int parse_command(const char *command_line, char *command, char *filename);
 int parse_priority_command(const char *command_line, char *command, char *filename, int *priority);
+int parse_list_query(const char *command_line, list_query_t *query, char *error, size_t error_size);
+int parse_download_version(const char *command_line, int *version);
 
 
 void handle_upload_task(task_t *task);
 void handle_download_task(task_t *task);
 void handle_delete_task(task_t *task);
 void handle_list_task(task_t *task);
+void handle_mupload_task(task_t *task);
+void handle_mdownload_task(task_t *task);
+void handle_mdelete_task(task_t *task);
+void handle_archive_task(task_t *task);
+void handle_changes_task(task_t *task);
+void handle_scrub_task(task_t *task);
+
+int scrubber_start(server_context_t *server);
+void scrubber_stop(void);
+void scrubber_file_done(size_t bytes, int corrupt, int quarantined);
+void format_scrubber_stats(char *buffer, size_t buffer_size);
+
+int watch_start(server_context_t *server);
+void watch_stop(void);
+int watch_command(int socket_fd, const char *username, const char *cursor);
+int watch_resume(watch_t *watch);
+void format_watch_stats(char *buffer, size_t buffer_size);
+void changes_init(void);
+void changes_listen(void (*listener)(void));
+void changes_record(const char *username, char op, const char *filename, const char *checksum);
+int changes_pending(const char *username, const char *cursor);
+void changes_cursor(const char *username, char *buf, size_t size);
+int changes_reply(const char *username, const char *cursor, char **reply, size_t *len);
+void changes_clear(void);
 
 
 int save_file_to_storage(const char *username, const char *filename, const char *data, size_t data_size);
+int save_file_with_checksum(const char *username, const char *filename, const char *data, size_t data_size,
+                            const char *checksum);
+void storage_shard_dir(char *buf, size_t size, const char *username, const char *filename);
+void storage_file_path(char *buf, size_t size, const char *username, const char *filename);
+int storage_ensure_shard(const char *username, const char *filename);
+int storage_walk_user(const char *username, storage_dir_fn fn, void *arg);
+int storage_migrate_all(void);
 int load_file_from_storage(const char *username, const char *filename, char **data, size_t *data_size);
+blob_reader_t* open_file_from_storage(const char *username, const char *filename, size_t *size);
+blob_reader_t* open_file_version(const char *username, const char *filename, int version, size_t *size);
 int delete_file_from_storage(const char *username, const char *filename);
-int list_user_files(const char *username, char **file_list, size_t *list_size);
+int storage_stage_upload(const char *username, batch_entry_t *entry, const char *data, size_t data_size,
+                         const char *checksum);
+int storage_commit_uploads(const char *username, batch_entry_t *entries, int count);
+void storage_discard_uploads(const char *username, batch_entry_t *entries, int count);
+int storage_delete_files(const char *username, batch_entry_t *entries, int count);
+const char* batch_status_text(batch_status_t status);
+size_t tar_file_header(char *out, const char *name, size_t size, time_t mtime);
+size_t tar_padding(size_t size);
+size_t tar_trailer_size(size_t written);
+int list_user_files(const char *username, const list_query_t *query, list_sink_fn sink, void *arg);
 
 int save_file_metadata(const char *username, const file_metadata_t *metadata);
 file_metadata_t* load_file_metadata(const char *username, const char *filename);
@@ -187,18 +514,79 @@ void destroy_file_metadata(file_metadata_t *metadata);
 
 int acquire_file_lock(const char *username, const char *filename);
 int release_file_lock(const char *username, const char *filename);
+int acquire_file_locks(const char *username, batch_entry_t *entries, int count);
+void release_file_locks(const char *username, batch_entry_t *entries, int count);
 
 
 void send_response(int socket_fd, const char *response);
 int receive_data(int socket_fd, char *buffer, size_t buffer_size);
 void cleanup_server(server_context_t *server);
 void signal_shutdown(server_context_t *server);
+int durability_init(void);
+void durability_shutdown(void);
+int durability_sync_fd(int fd);
+int durability_sync_dir(const char *path);
+int durability_sync_all(void);
+int durability_sync_batch(void);
+const char* durability_mode_name(durability_mode_t mode);
+void format_durability_stats(char *buffer, size_t buffer_size);
+
+int journal_open(void);
+void journal_close(void);
+int journal_is_open(void);
+unsigned long long journal_next_seq(void);
+int journal_append(const journal_record_t *rec);
+int journal_append_batch(journal_record_t *const *recs, int count);
+void journal_applied(void);
+void format_journal_stats(char *buffer, size_t buffer_size);
+int storage_apply_journal_record(const journal_record_t *rec);
+int reconcile_user_quota(const char *username, size_t used_bytes);
+int verify_stored_file(const char *username, const char *filename, int quarantine,
+                       size_t *bytes_read, int *quarantined);
+
+int storage_index_build(int threads);
+void storage_index_destroy(void);
+int storage_index_ready(void);
+void storage_index_put(const char *username, const file_metadata_t *metadata);
+void storage_index_remove(const char *username, const char *filename);
+int storage_index_size(const char *username, const char *filename, size_t *size);
+int storage_index_rows(const char *username, const list_query_t *query, const char *after,
+                       list_row_t *rows, size_t max_rows, int *more);
+void storage_index_cursor(char *buf, size_t size, list_sort_t sort, const list_row_t *row);
+
+void format_local_time(time_t t, char *buf);
+
 char* calculate_sha256(const char *data, size_t data_size);
+void sha256_to_hex(const unsigned char *digest, char *hex);
+int sha256_raw(const void *data, size_t len, unsigned char *digest);
+int sha256_stream_init(sha256_stream_t *stream);
+int sha256_stream_update(sha256_stream_t *stream, const void *data, size_t len);
+int sha256_stream_final(sha256_stream_t *stream, char *hex);
+void sha256_stream_abort(sha256_stream_t *stream);
+const char* storage_codec_name(storage_codec_t codec);
+int parse_storage_codec(const char *name, storage_codec_t *codec);
+int blob_encode(const char *data, size_t size, char **out, size_t *out_len, storage_codec_t *codec);
+int blob_logical_size_fd(int fd, size_t *size);
+blob_reader_t* blob_reader_open(const char *path, size_t *size);
+ssize_t blob_reader_read(blob_reader_t *reader, char *buf, size_t len);
+storage_codec_t blob_reader_codec(const blob_reader_t *reader);
+int blob_reader_raw_fd(const blob_reader_t *reader, off_t *offset);
+void blob_reader_close(blob_reader_t *reader);
+void format_compression_stats(char *buffer, size_t buffer_size);
+int merkle_build(const char *data, size_t size, file_metadata_t *metadata);
+int merkle_check_root(const file_metadata_t *metadata);
+int merkle_verify_range(const file_metadata_t *metadata, const char *data, size_t offset, size_t length);
+void merkle_release(file_metadata_t *metadata);
+int base64_encode(const unsigned char *in, size_t in_len, char **out, size_t *out_len);
+int base64_decode(const char *in, size_t in_len, unsigned char **out, size_t *out_len);
+const char* base64_impl_name(void);
+int base64_select_impl(const char *name);
+long long monotonic_ms(void);
 
 extern server_context_t *g_server_context;
 
-// Server port (fixed to PORT defined above, default 8080)
-extern int g_server_port;
+// Runtime configuration, filled in by init_server
+extern server_config_t g_config;
 
 void cleanup_user_mutexes();
 
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include "dropbox_server.h"
+
+// Durability layer: every storage write that must survive a crash goes
+// through durability_sync_fd (file data before its rename) and
+// durability_sync_dir (the rename itself).
+//
+// Modes:
+//   none   - no syncing at all (benchmarks, throwaway data)
+//   fsync  - fsync each file and directory as it is written
+//   group  - group commit: callers queue up and a committer thread flushes
+//            the whole storage filesystem with one syncfs() per batch, so
+//            concurrent uploads share a single flush instead of each paying
+//            for several. A batch starts as soon as the previous flush ends,
+//            or after commit_interval_ms to gather more callers.
+//
+// In every mode a caller only returns once its data is durable (or the
+// flush failed, in which case it gets -1).
+
+typedef struct durability_waiter {
+    int done;
+    int result;
+    struct durability_waiter *next;
+} durability_waiter_t;
+
+static struct {
+    durability_mode_t mode;
+    int storage_fd;                 // any fd on the storage filesystem, for syncfs
+    int running;                    // committer thread started
+    int stopping;
+    pthread_t committer;
+    durability_waiter_t *pending;   // callers waiting for the next batch
+    unsigned long batches;
+    unsigned long requests;
+    unsigned long max_batch;
+    long long total_flush_ms;
+    pthread_mutex_t mutex;
+    pthread_cond_t work;            // signalled when a caller queues up
+    pthread_cond_t done;            // broadcast when a batch completes
+} durability = {
+    .mode = DURABILITY_FSYNC,
+    .storage_fd = -1,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+const char* durability_mode_name(durability_mode_t mode) {
+    switch (mode) {
+        case DURABILITY_NONE: return "none";
+        case DURABILITY_FSYNC: return "fsync";
+        case DURABILITY_GROUP: return "group";
+        default: return "unknown";
+    }
+}
+
+static int parse_durability_mode(const char *name, durability_mode_t *mode) {
+    for (int m = DURABILITY_NONE; m <= DURABILITY_GROUP; m++) {
+        if (strcmp(name, durability_mode_name((durability_mode_t)m)) == 0) {
+            *mode = (durability_mode_t)m;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void* durability_committer(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&durability.mutex);
+    while (1) {
+        while (!durability.pending && !durability.stopping) {
+            pthread_cond_wait(&durability.work, &durability.mutex);
+        }
+        if (!durability.pending && durability.stopping) break;
+
+        // Optionally linger so more callers can join this batch. Each joiner
+        // signals work, so keep waiting until the deadline itself passes.
+        if (g_config.commit_interval_ms > 0 && !durability.stopping) {
+            struct timespec wake;
+            clock_gettime(CLOCK_REALTIME, &wake);
+            wake.tv_nsec += (long)g_config.commit_interval_ms * 1000000L;
+            while (wake.tv_nsec >= 1000000000L) {
+                wake.tv_sec++;
+                wake.tv_nsec -= 1000000000L;
+            }
+            while (!durability.stopping &&
+                   pthread_cond_timedwait(&durability.work, &durability.mutex, &wake) != ETIMEDOUT) {
+            }
+        }
+
+        durability_waiter_t *batch = durability.pending;
+        durability.pending = NULL;
+        pthread_mutex_unlock(&durability.mutex);
+
+        long long start = monotonic_ms();
+        int rc = syncfs(durability.storage_fd);
+        if (rc != 0) perror("Group commit syncfs failed");
+        long long elapsed = monotonic_ms() - start;
+
+        pthread_mutex_lock(&durability.mutex);
+        unsigned long size = 0;
+        for (durability_waiter_t *w = batch; w; w = w->next) {
+            w->result = rc == 0 ? 0 : -1;
+            w->done = 1;
+            size++;
+        }
+        durability.batches++;
+        durability.requests += size;
+        durability.total_flush_ms += elapsed;
+        if (size > durability.max_batch) durability.max_batch = size;
+        pthread_cond_broadcast(&durability.done);
+    }
+    pthread_mutex_unlock(&durability.mutex);
+    return NULL;
+}
+
+// Join the next group commit and wait for it; returns its result
+static int group_commit_wait(void) {
+    durability_waiter_t waiter = { 0, 0, NULL };
+    pthread_mutex_lock(&durability.mutex);
+    waiter.next = durability.pending;
+    durability.pending = &waiter;
+    pthread_cond_signal(&durability.work);
+    while (!waiter.done) {
+        pthread_cond_wait(&durability.done, &durability.mutex);
+    }
+    pthread_mutex_unlock(&durability.mutex);
+    return waiter.result;
+}
+
+// Select the configured mode and start the committer for group mode.
+// Code that never calls this (e.g. the storage benchmark) gets plain fsync.
+int durability_init(void) {
+    durability_mode_t mode;
+    if (parse_durability_mode(g_config.durability, &mode) != 0) {
+        fprintf(stderr, "Unknown durability mode '%s' (use none, fsync or group)\n", g_config.durability);
+        return -1;
+    }
+    durability.mode = mode;
+    if (mode != DURABILITY_GROUP) return 0;
+
+    struct stat st;
+    if (stat("storage", &st) == -1 && mkdir("storage", 0700) != 0) {
+        perror("Failed to create storage directory");
+        return -1;
+    }
+    durability.storage_fd = open("storage", O_RDONLY);
+    if (durability.storage_fd < 0) {
+        perror("Failed to open storage directory");
+        return -1;
+    }
+    durability.stopping = 0;
+    if (pthread_create(&durability.committer, NULL, durability_committer, NULL) != 0) {
+        perror("Failed to create group commit thread");
+        close(durability.storage_fd);
+        durability.storage_fd = -1;
+        return -1;
+    }
+    durability.running = 1;
+    printf("Group commit enabled (commit interval %dms)\n", g_config.commit_interval_ms);
+    return 0;
+}
+
+// Flush whatever is still queued and stop the committer
+void durability_shutdown(void) {
+    if (!durability.running) return;
+    pthread_mutex_lock(&durability.mutex);
+    durability.stopping = 1;
+    pthread_cond_signal(&durability.work);
+    pthread_mutex_unlock(&durability.mutex);
+    pthread_join(durability.committer, NULL);
+    durability.running = 0;
+    close(durability.storage_fd);
+    durability.storage_fd = -1;
+}
+
+// Make the written contents of fd durable
+int durability_sync_fd(int fd) {
+    switch (durability.mode) {
+        case DURABILITY_NONE:
+            return 0;
+        case DURABILITY_GROUP:
+            if (durability.running) return group_commit_wait();
+            return fsync(fd);
+        default:
+            return fsync(fd);
+    }
+}
+
+// Make a rename or unlink inside path's parent directory durable
+int durability_sync_dir(const char *path) {
+    if (!path || durability.mode == DURABILITY_NONE) return 0;
+    if (durability.mode == DURABILITY_GROUP && durability.running) return group_commit_wait();
+
+    char dir[1024];
+    strncpy(dir, path, sizeof(dir) - 1);
+    dir[sizeof(dir) - 1] = '\0';
+    char *slash = strrchr(dir, '/');
+    if (slash) {
+        *slash = '\0';
+    } else {
+        strcpy(dir, ".");
+    }
+    int fd = open(dir, O_RDONLY);
+    if (fd < 0) return -1;
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+// Flush the whole storage filesystem (journal checkpoints)
+int durability_sync_all(void) {
+    if (durability.mode == DURABILITY_NONE) return 0;
+    int fd = durability.storage_fd >= 0 ? durability.storage_fd : open("storage", O_RDONLY);
+    if (fd < 0) return -1;
+    int rc = syncfs(fd);
+    if (rc != 0) perror("Failed to sync storage");
+    if (fd != durability.storage_fd) close(fd);
+    return rc;
+}
+
+// Make everything written so far durable with one flush, for batches that
+// write many files without syncing each: a group commit, or a syncfs
+int durability_sync_batch(void) {
+    if (durability.mode == DURABILITY_NONE) return 0;
+    if (durability.mode == DURABILITY_GROUP && durability.running) return group_commit_wait();
+    return durability_sync_all();
+}
+
+void format_durability_stats(char *buffer, size_t buffer_size) {
+    if (!buffer || buffer_size == 0) return;
+    pthread_mutex_lock(&durability.mutex);
+    unsigned long batches = durability.batches;
+    snprintf(buffer, buffer_size,
+             "[durability] mode=%s commit_interval_ms=%d batches=%lu syncs=%lu avg_batch=%.1f max_batch=%lu avg_flush_ms=%.1f\n",
+             durability_mode_name(durability.mode), g_config.commit_interval_ms, batches,
+             durability.requests, batches ? (double)durability.requests / batches : 0.0,
+             durability.max_batch, batches ? (double)durability.total_flush_ms / batches : 0.0);
+    pthread_mutex_unlock(&durability.mutex);
+}
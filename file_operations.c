@@ -1,21 +1,103 @@
+#define _GNU_SOURCE
 #include "dropbox_server.h"
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
 #include <openssl/sha.h>
 #include <openssl/evp.h>
+#include <poll.h>
 
-#define MAX_FILE_SIZE_MB 10
+// How often a blocked transfer re-checks cancellation and progress
+#define TRANSFER_POLL_MS 200
 
-static int recv_all(int sock, void *buf, size_t len) {
+// Uploads are received and hashed in chunks of this size
+#define UPLOAD_HASH_CHUNK (256 * 1024)
+
+// Downloads are decoded and sent in chunks of this size
+#define DOWNLOAD_CHUNK (256 * 1024)
+
+// Wait until the client socket is ready for the given poll events.
+// Gives up once the session is cancelled, the peer hangs up or no bytes
+// have moved for transfer_stall_timeout_ms, so a dead or stalled client
+// cannot pin a worker while a slow but steady transfer runs to the end.
+static int wait_for_client(task_t *task, short events) {
+    long long stall_ms = g_config.transfer_stall_timeout_ms;
+    long long give_up = stall_ms > 0 ? monotonic_ms() + stall_ms : 0;
+    while (1) {
+        if (task_cancel_reason(task)) return -1;
+        struct pollfd pfd;
+        pfd.fd = task->client_socket;
+        pfd.events = events;
+        pfd.revents = 0;
+        int rc = poll(&pfd, 1, TRANSFER_POLL_MS);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (rc == 0) {
+            if (give_up > 0 && monotonic_ms() > give_up) {
+                task->stalled = 1;
+                return -1;
+            }
+            continue;
+        }
+        if (pfd.revents & (POLLERR | POLLNVAL)) return -1;
+        if ((pfd.revents & POLLHUP) && !(pfd.revents & POLLIN)) return -1;
+        return 0;
+    }
+}
+
+static int recv_all(task_t *task, void *buf, size_t len) {
     size_t total = 0;
     while (total < len) {
-        ssize_t n = recv(sock, (char*)buf + total, len - total, 0);
+        if (wait_for_client(task, POLLIN) != 0) return -1;
+        ssize_t n = recv(task->client_socket, (char*)buf + total, len - total, 0);
         if (n <= 0) return -1; // connection closed or error
         total += (size_t)n;
     }
     return 0;
 }
 
+static int send_all(task_t *task, const void *buf, size_t len) {
+    size_t total = 0;
+    while (total < len) {
+        if (wait_for_client(task, POLLOUT) != 0) return -1;
+        ssize_t n = send(task->client_socket, (const char*)buf + total, len - total, MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+        if (n <= 0) return -1;
+        total += (size_t)n;
+    }
+    return 0;
+}
+
+// Error text for a failed transfer: why it was aborted, if it was
+static void set_transfer_error(task_t *task, const char *fallback) {
+    const char *reason = task_cancel_reason(task);
+    if (!reason && task->stalled) reason = "Transfer stalled: no data moved in time";
+    task->result_code = -1;
+    strncpy(task->error_message, reason ? reason : fallback, sizeof(task->error_message) - 1);
+}
+
+// A file name must be a plain name: it ends up in storage paths and in
+// the space separated journal, metadata and change log records, and
+// dot-names are reserved for versions and temp blobs stored beside it
+static int valid_filename(const char *name) {
+    if (name[0] == '\0' || name[0] == '.' || strchr(name, '/') || strstr(name, "..")) return 0;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        if (isspace(*p) || iscntrl(*p)) return 0;
+    }
+    return 1;
+}
+
+// Reject a name valid_filename refuses; returns nonzero if it was
+static int reject_invalid_filename(task_t *task) {
+    if (valid_filename(task->filename)) return 0;
+    task->result_code = -1;
+    strncpy(task->error_message, "Invalid filename: names may not start with '.' or contain '/' or '..'",
+            sizeof(task->error_message) - 1);
+    return 1;
+}
+
 void sanitize_filename_inplace(char *name) {
     if (!name) return;
     // Extract basename
@@ -48,6 +130,10 @@ void handle_upload_task(task_t *task) {
         pthread_mutex_unlock(&task->task_mutex);
         return;
     }
+    if (reject_invalid_filename(task)) {
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
 
     if (acquire_file_lock(task->username, task->filename) != 0) {
         task->result_code = -1;
@@ -62,74 +148,69 @@ void handle_upload_task(task_t *task) {
 
     send_response(task->client_socket, "SEND_FILE_DATA\n");
 
-    file_data = malloc(MAX_FILE_SIZE_MB * 1024 * 1024);
-    if (!file_data) {
-        task->result_code = -1;
-        strncpy(task->error_message, "Memory allocation failed", sizeof(task->error_message) - 1);
+    if (recv_all(task, buffer, sizeof(size_t)) != 0) {
+        set_transfer_error(task, "Failed to receive file size");
         release_file_lock(task->username, task->filename);
         pthread_mutex_unlock(&task->task_mutex);
         return;
     }
-
-    if (recv_all(task->client_socket, buffer, sizeof(size_t)) != 0) {
+    for (size_t i = 0; i < sizeof(size_t); ++i) printf("%02x ", (unsigned char)buffer[i]);
+    printf("\n");
+    size_t expected_size = *((size_t*)buffer);
+    if (expected_size > g_config.max_file_size_mb * 1024 * 1024) {
         task->result_code = -1;
-        strncpy(task->error_message, "Failed to receive file size", sizeof(task->error_message) - 1);
-        free(file_data);
+        strncpy(task->error_message, "File too large", sizeof(task->error_message) - 1);
         release_file_lock(task->username, task->filename);
         pthread_mutex_unlock(&task->task_mutex);
         return;
     }
-    for (size_t i = 0; i < sizeof(size_t); ++i) printf("%02x ", (unsigned char)buffer[i]);
-    printf("\n");
-    size_t expected_size = *((size_t*)buffer);
-    if (expected_size > MAX_FILE_SIZE_MB * 1024 * 1024) {
+
+    // Size the buffer to the announced upload rather than the configured maximum
+    file_data = malloc(expected_size > 0 ? expected_size : 1);
+    if (!file_data) {
         task->result_code = -1;
-        strncpy(task->error_message, "File too large", sizeof(task->error_message) - 1);
-        free(file_data);
+        strncpy(task->error_message, "Memory allocation failed", sizeof(task->error_message) - 1);
         release_file_lock(task->username, task->filename);
         pthread_mutex_unlock(&task->task_mutex);
         return;
     }
 
+    // Hash each chunk while it is still in cache, overlapping with the network
+    sha256_stream_t hash;
+    char checksum[SHA256_DIGEST_BYTES * 2 + 1];
+    int hashing = sha256_stream_init(&hash) == 0;
     while (total_received < expected_size) {
-        ssize_t bytes_received = recv(task->client_socket, file_data + total_received, expected_size - total_received, 0);
-        if (bytes_received <= 0) {
-            task->result_code = -1;
-            strncpy(task->error_message, "Failed to receive file data", sizeof(task->error_message) - 1);
-            free(file_data);
-            release_file_lock(task->username, task->filename);
-            pthread_mutex_unlock(&task->task_mutex);
-            return;
+        size_t chunk = expected_size - total_received;
+        if (chunk > UPLOAD_HASH_CHUNK) chunk = UPLOAD_HASH_CHUNK;
+        if (recv_all(task, file_data + total_received, chunk) != 0) break;
+        if (hashing && sha256_stream_update(&hash, file_data + total_received, chunk) != 0) {
+            sha256_stream_abort(&hash);
+            hashing = 0;
         }
-        total_received += bytes_received;
+        total_received += chunk;
+    }
+    if (total_received < expected_size) {
+        if (hashing) sha256_stream_abort(&hash);
+        set_transfer_error(task, "Failed to receive file data");
+        free(file_data);
+        release_file_lock(task->username, task->filename);
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
     }
-    int save_result = save_file_to_storage(task->username, task->filename, file_data, total_received);
-    printf("DEBUG: After save_file_to_storage: result=%d\n", save_result);
+    if (hashing && sha256_stream_final(&hash, checksum) != 0) hashing = 0;
+    // Blob, metadata and quota are committed as one journaled transaction
+    int save_result = save_file_with_checksum(task->username, task->filename, file_data, total_received,
+                                              hashing ? checksum : NULL);
     if (save_result != 0) {
         task->result_code = -1;
-        strncpy(task->error_message, "Failed to save file", sizeof(task->error_message) - 1);
+        strncpy(task->error_message, save_result == -2 ? "Quota exceeded" : "Failed to save file",
+                sizeof(task->error_message) - 1);
         free(file_data);
         release_file_lock(task->username, task->filename);
         pthread_mutex_unlock(&task->task_mutex);
         return;
     }
 
-    file_metadata_t metadata;
-    strncpy(metadata.filename, task->filename, MAX_FILENAME - 1);
-    metadata.filename[MAX_FILENAME - 1] = '\0';
-    metadata.file_size = total_received;
-    metadata.created_time = time(NULL);
-    metadata.modified_time = metadata.created_time;
-
-    char *checksum = calculate_sha256(file_data, total_received);
-    if (checksum) {
-        strncpy(metadata.checksum, checksum, sizeof(metadata.checksum) - 1);
-        metadata.checksum[sizeof(metadata.checksum) - 1] = '\0';
-        free(checksum);
-    }
-
-    save_file_metadata(task->username, &metadata);
-
     task->result_code = 0;
     char success_msg[256];
     snprintf(success_msg, sizeof(success_msg), "File '%s' uploaded successfully (%zu bytes)", 
@@ -154,6 +235,10 @@ void handle_download_task(task_t *task) {
         pthread_mutex_unlock(&task->task_mutex);
         return;
     }
+    if (reject_invalid_filename(task)) {
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
     
     
     if (acquire_file_lock(task->username, task->filename) != 0) {
@@ -164,41 +249,71 @@ void handle_download_task(task_t *task) {
     }
     
     
-    char *file_data = NULL;
+    // Decoded chunk by chunk, so a compressed file is never held whole.
+    // --version=k reads the k-th earlier version instead.
+    int version = 0;
+    if (parse_download_version(task->command, &version) != 0) {
+        task->result_code = -1;
+        strncpy(task->error_message, "--version must be a positive number", sizeof(task->error_message) - 1);
+        release_file_lock(task->username, task->filename);
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
     size_t file_size = 0;
-    
-    if (load_file_from_storage(task->username, task->filename, &file_data, &file_size) != 0) {
+    blob_reader_t *reader = version > 0 ? open_file_version(task->username, task->filename, version, &file_size)
+                                        : open_file_from_storage(task->username, task->filename, &file_size);
+    char *chunk = reader ? malloc(DOWNLOAD_CHUNK) : NULL;
+    if (!chunk) {
         task->result_code = -1;
-        strncpy(task->error_message, "File not found or access error", sizeof(task->error_message) - 1);
+        if (version > 0 && !reader) {
+            snprintf(task->error_message, sizeof(task->error_message), "Version %d of %s not found",
+                     version, task->filename);
+        } else {
+            strncpy(task->error_message, "File not found or access error", sizeof(task->error_message) - 1);
+        }
+        blob_reader_close(reader);
         release_file_lock(task->username, task->filename);
         pthread_mutex_unlock(&task->task_mutex);
         return;
     }
     
     
-    if (send(task->client_socket, &file_size, sizeof(size_t), 0) != sizeof(size_t)) {
-        task->result_code = -1;
-        strncpy(task->error_message, "Failed to send file size", sizeof(task->error_message) - 1);
-        free(file_data);
+    if (send_all(task, &file_size, sizeof(size_t)) != 0) {
+        set_transfer_error(task, "Failed to send file size");
+        free(chunk);
+        blob_reader_close(reader);
         release_file_lock(task->username, task->filename);
         pthread_mutex_unlock(&task->task_mutex);
         return;
     }
     
     
-    size_t total_sent = 0;
-    while (total_sent < file_size) {
-        ssize_t bytes_sent = send(task->client_socket, file_data + total_sent, 
-                                file_size - total_sent, 0);
-        if (bytes_sent <= 0) {
+    size_t sent = 0;
+    int damaged = 0;
+    while (sent < file_size) {
+        ssize_t n = blob_reader_read(reader, chunk, DOWNLOAD_CHUNK);
+        if (n <= 0) {
+            damaged = 1;
+            break;
+        }
+        if (send_all(task, chunk, (size_t)n) != 0) break;
+        sent += (size_t)n;
+    }
+    free(chunk);
+    blob_reader_close(reader);
+    if (sent < file_size) {
+        if (damaged) {
+            // The size is already on the wire; drop the connection rather
+            // than leave the client waiting for bytes that will never come
             task->result_code = -1;
-            strncpy(task->error_message, "Failed to send file data", sizeof(task->error_message) - 1);
-            free(file_data);
-            release_file_lock(task->username, task->filename);
-            pthread_mutex_unlock(&task->task_mutex);
-            return;
+            strncpy(task->error_message, "Stored file is damaged", sizeof(task->error_message) - 1);
+            shutdown(task->client_socket, SHUT_RDWR);
+        } else {
+            set_transfer_error(task, "Failed to send file data");
         }
-        total_sent += bytes_sent;
+        release_file_lock(task->username, task->filename);
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
     }
     
     
@@ -208,7 +323,6 @@ void handle_download_task(task_t *task) {
              task->filename, file_size);
     strncpy(task->error_message, success_msg, sizeof(task->error_message) - 1);
     
-    free(file_data);
     release_file_lock(task->username, task->filename);
     pthread_mutex_unlock(&task->task_mutex);
 }
@@ -226,6 +340,10 @@ void handle_delete_task(task_t *task) {
         pthread_mutex_unlock(&task->task_mutex);
         return;
     }
+    if (reject_invalid_filename(task)) {
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
     
     
     if (acquire_file_lock(task->username, task->filename) != 0) {
@@ -262,27 +380,618 @@ void handle_delete_task(task_t *task) {
     pthread_mutex_unlock(&task->task_mutex);
 }
 
+// Batch commands: MUPLOAD, MDOWNLOAD and MDELETE <count>. The server
+// answers "SEND_BATCH <count>" and the client sends a manifest of count
+// frames, each a size_t name length and the name; for MUPLOAD every name is
+// followed by the file as in UPLOAD (size_t size, then the bytes).
+// MDOWNLOAD replies with one frame per name, in manifest order: the size_t
+// size and the bytes, or a size of (size_t)-1 for a file that could not be
+// sent. Every command ends with one "FAILED <name>: <reason>" line per
+// failed file and a SUCCESS summary.
+
+// Parse the count, ask for the manifest and allocate its entries
+static batch_entry_t *begin_batch(task_t *task, int *count) {
+    char *end = NULL;
+    long n = strtol(task->filename, &end, 10);
+    if (!end || *end != '\0' || n < 1 || n > BATCH_MAX_FILES) {
+        task->result_code = -1;
+        snprintf(task->error_message, sizeof(task->error_message),
+                 "Batch size must be a number from 1 to %d", BATCH_MAX_FILES);
+        return NULL;
+    }
+    batch_entry_t *entries = calloc((size_t)n, sizeof(batch_entry_t));
+    if (!entries) {
+        task->result_code = -1;
+        strncpy(task->error_message, "Memory allocation failed", sizeof(task->error_message) - 1);
+        return NULL;
+    }
+    char ready[64];
+    snprintf(ready, sizeof(ready), "SEND_BATCH %ld\n", n);
+    send_response(task->client_socket, ready);
+    *count = (int)n;
+    return entries;
+}
+
+
+// Read one manifest name; -2 for a length or name the protocol does not allow
+static int recv_batch_name(task_t *task, char *name) {
+    size_t len = 0;
+    if (recv_all(task, &len, sizeof(len)) != 0) return -1;
+    if (len == 0 || len >= MAX_FILENAME) return -2;
+    if (recv_all(task, name, len) != 0) return -1;
+    name[len] = '\0';
+    return strlen(name) == len && valid_filename(name) ? 0 : -2;
+}
+
+// A transfer or manifest error leaves the stream out of step; report it
+static void set_manifest_error(task_t *task, int rc) {
+    if (rc == -2) {
+        task->result_code = -1;
+        strncpy(task->error_message, "Invalid batch manifest", sizeof(task->error_message) - 1);
+        shutdown(task->client_socket, SHUT_RDWR);
+    } else {
+        set_transfer_error(task, "Failed to receive batch manifest");
+    }
+}
+
+// Later mentions of a name already in the batch are not processed
+static void mark_duplicates(batch_entry_t *entries, int count) {
+    for (int i = 1; i < count; i++) {
+        for (int j = 0; j < i; j++) {
+            if (entries[j].status != BATCH_DUPLICATE && strcmp(entries[i].filename, entries[j].filename) == 0) {
+                entries[i].status = BATCH_DUPLICATE;
+                break;
+            }
+        }
+    }
+}
+
+// Failure lines plus the summary, handed to the client thread to send
+static void finish_batch(task_t *task, batch_entry_t *entries, int count, const char *verb) {
+    size_t cap = (size_t)count * (MAX_FILENAME + 96) + 256, len = 0;
+    char *report = malloc(cap);
+    if (!report) {
+        task->result_code = -1;
+        strncpy(task->error_message, "Memory allocation failed", sizeof(task->error_message) - 1);
+        return;
+    }
+    int ok = 0;
+    size_t bytes = 0;
+    for (int i = 0; i < count; i++) {
+        if (entries[i].status == BATCH_OK) {
+            ok++;
+            bytes += entries[i].size;
+        } else {
+            len += (size_t)snprintf(report + len, cap - len, "FAILED %s: %s\n",
+                                    entries[i].filename, batch_status_text(entries[i].status));
+        }
+    }
+    len += (size_t)snprintf(report + len, cap - len, "SUCCESS: %d of %d files %s (%zu bytes)\n",
+                            ok, count, verb, bytes);
+    task->result_code = 0;
+    task->result_data = report;
+    task->result_size = len;
+}
+
+void handle_mupload_task(task_t *task) {
+    printf("Processing MUPLOAD task for %s files (user: %s, priority: %d)\n",
+           task->filename, task->username, task->priority);
+    pthread_mutex_lock(&task->task_mutex);
+
+    int count = 0;
+    batch_entry_t *entries = begin_batch(task, &count);
+    if (!entries) {
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
+
+    // Each file is hashed and written to its temp blob as it arrives, so
+    // only one file of the batch is in memory at a time
+    size_t max_size = g_config.max_file_size_mb * 1024 * 1024;
+    char *data = NULL;
+    size_t data_cap = 0;
+    int rc = 0;
+    for (int i = 0; i < count && rc == 0; i++) {
+        batch_entry_t *entry = &entries[i];
+        size_t size = 0;
+        if ((rc = recv_batch_name(task, entry->filename)) != 0) break;
+        if ((rc = recv_all(task, &size, sizeof(size))) != 0) break;
+        for (int j = 0; j < i; j++) {
+            if (strcmp(entries[j].filename, entry->filename) == 0) entry->status = BATCH_DUPLICATE;
+        }
+        if (size > max_size) entry->status = BATCH_TOO_LARGE;
+        if (entry->status == BATCH_OK && size > data_cap) {
+            char *grown = realloc(data, size);
+            if (grown) {
+                data = grown;
+                data_cap = size;
+            } else {
+                entry->status = BATCH_FAILED;
+            }
+        }
+
+        // Rejected files are still read off the wire to stay in step
+        sha256_stream_t hash;
+        char checksum[SHA256_DIGEST_BYTES * 2 + 1];
+        char discard[BUFFER_SIZE];
+        int keep = entry->status == BATCH_OK;
+        int hashing = keep && sha256_stream_init(&hash) == 0;
+        for (size_t got = 0; got < size && rc == 0; ) {
+            size_t chunk = size - got, limit = keep ? UPLOAD_HASH_CHUNK : sizeof(discard);
+            if (chunk > limit) chunk = limit;
+            char *dst = keep ? data + got : discard;
+            if ((rc = recv_all(task, dst, chunk)) != 0) break;
+            if (hashing && sha256_stream_update(&hash, dst, chunk) != 0) {
+                sha256_stream_abort(&hash);
+                hashing = 0;
+            }
+            got += chunk;
+        }
+        if (rc != 0) {
+            if (hashing) sha256_stream_abort(&hash);
+            break;
+        }
+        if (hashing && sha256_stream_final(&hash, checksum) != 0) hashing = 0;
+        if (keep) storage_stage_upload(task->username, entry, data, size, hashing ? checksum : NULL);
+    }
+    free(data);
+    if (rc != 0) {
+        set_manifest_error(task, rc);
+        storage_discard_uploads(task->username, entries, count);
+        free(entries);
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
+
+    // One pass over the lock table, one flush, one journal sync
+    acquire_file_locks(task->username, entries, count);
+    storage_commit_uploads(task->username, entries, count);
+    release_file_locks(task->username, entries, count);
+    finish_batch(task, entries, count, "uploaded");
+    free(entries);
+    pthread_mutex_unlock(&task->task_mutex);
+}
+
+void handle_mdownload_task(task_t *task) {
+    printf("Processing MDOWNLOAD task for %s files (user: %s, priority: %d)\n",
+           task->filename, task->username, task->priority);
+    pthread_mutex_lock(&task->task_mutex);
+
+    int count = 0;
+    batch_entry_t *entries = begin_batch(task, &count);
+    if (!entries) {
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
+    int rc = 0;
+    for (int i = 0; i < count && rc == 0; i++) rc = recv_batch_name(task, entries[i].filename);
+    char *chunk = rc == 0 ? malloc(DOWNLOAD_CHUNK) : NULL;
+    if (!chunk) {
+        if (rc != 0) {
+            set_manifest_error(task, rc);
+        } else {
+            task->result_code = -1;
+            strncpy(task->error_message, "Memory allocation failed", sizeof(task->error_message) - 1);
+        }
+        free(entries);
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
+
+    mark_duplicates(entries, count);
+    acquire_file_locks(task->username, entries, count);
+    int damaged = 0;
+    for (int i = 0; i < count && rc == 0; i++) {
+        batch_entry_t *entry = &entries[i];
+        size_t file_size = (size_t)-1;
+        blob_reader_t *reader = NULL;
+        if (entry->status == BATCH_OK) {
+            reader = open_file_from_storage(task->username, entry->filename, &file_size);
+            if (!reader) {
+                entry->status = BATCH_NOT_FOUND;
+                file_size = (size_t)-1;
+            }
+        }
+        if ((rc = send_all(task, &file_size, sizeof(file_size))) != 0 || !reader) {
+            blob_reader_close(reader);
+            continue;
+        }
+        size_t sent = 0;
+        while (sent < file_size) {
+            ssize_t n = blob_reader_read(reader, chunk, DOWNLOAD_CHUNK);
+            if (n <= 0) {
+                damaged = 1;
+                break;
+            }
+            if (send_all(task, chunk, (size_t)n) != 0) break;
+            sent += (size_t)n;
+        }
+        blob_reader_close(reader);
+        entry->size = sent;
+        if (sent < file_size) rc = -1;
+    }
+    release_file_locks(task->username, entries, count);
+    free(chunk);
+
+    if (rc != 0) {
+        if (damaged) {
+            // A size is already on the wire; see handle_download_task
+            task->result_code = -1;
+            strncpy(task->error_message, "Stored file is damaged", sizeof(task->error_message) - 1);
+            shutdown(task->client_socket, SHUT_RDWR);
+        } else {
+            set_transfer_error(task, "Failed to send file data");
+        }
+    } else {
+        finish_batch(task, entries, count, "downloaded");
+    }
+    free(entries);
+    pthread_mutex_unlock(&task->task_mutex);
+}
+
+void handle_mdelete_task(task_t *task) {
+    printf("Processing MDELETE task for %s files (user: %s, priority: %d)\n",
+           task->filename, task->username, task->priority);
+    pthread_mutex_lock(&task->task_mutex);
+
+    int count = 0;
+    batch_entry_t *entries = begin_batch(task, &count);
+    if (!entries) {
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
+    int rc = 0;
+    for (int i = 0; i < count && rc == 0; i++) rc = recv_batch_name(task, entries[i].filename);
+    if (rc != 0) {
+        set_manifest_error(task, rc);
+        free(entries);
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
+
+    mark_duplicates(entries, count);
+    acquire_file_locks(task->username, entries, count);
+    storage_delete_files(task->username, entries, count);
+    release_file_locks(task->username, entries, count);
+    finish_batch(task, entries, count, "deleted");
+    free(entries);
+    pthread_mutex_unlock(&task->task_mutex);
+}
+
+// ARCHIVE [prefix] streams every file whose name starts with the prefix
+// (all files without one) as a tar, in name order: "SEND_ARCHIVE" on its
+// own line, the archive, then the same FAILED lines and SUCCESS summary as
+// a batch. Files are taken from the index a page at a time and locked one
+// at a time, so an archive never holds a lock while it waits on the index.
+// Raw blobs go to the socket with sendfile; the next file of the page is
+// read ahead into the page cache while the current one is sent.
+
+typedef struct {
+    size_t written;                  // archive bytes sent so far
+    int files;
+    int archived;
+    size_t bytes;                    // file bytes in the archive
+    char *report;                    // FAILED lines
+    size_t report_len;
+    size_t report_cap;
+} archive_t;
+
+static void archive_failed(archive_t *ar, const char *name, const char *reason) {
+    size_t need = strlen(name) + strlen(reason) + 16;
+    if (ar->report_len + need > ar->report_cap) {
+        size_t cap = ar->report_cap ? ar->report_cap * 2 : 4096;
+        while (cap < ar->report_len + need) cap *= 2;
+        char *grown = realloc(ar->report, cap);
+        if (!grown) return;
+        ar->report = grown;
+        ar->report_cap = cap;
+    }
+    ar->report_len += (size_t)snprintf(ar->report + ar->report_len, ar->report_cap - ar->report_len,
+                                       "FAILED %s: %s\n", name, reason);
+}
+
+static int archive_send(task_t *task, archive_t *ar, const void *buf, size_t len) {
+    if (send_all(task, buf, len) != 0) return -1;
+    ar->written += len;
+    return 0;
+}
+
+static int archive_send_zeros(task_t *task, archive_t *ar, size_t len) {
+    static const char zeros[TAR_BLOCK];
+    while (len > 0) {
+        size_t n = len < sizeof(zeros) ? len : sizeof(zeros);
+        if (archive_send(task, ar, zeros, n) != 0) return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+// Send up to len bytes of fd from *offset without copying them through
+// user space; the socket is non-blocking for the whole archive. Returns
+// the bytes sent, 0 if the file ended early, -1 on a send failure.
+static ssize_t archive_sendfile(task_t *task, archive_t *ar, int fd, off_t *offset, size_t len) {
+    if (len > DOWNLOAD_CHUNK) len = DOWNLOAD_CHUNK;
+    while (1) {
+        if (wait_for_client(task, POLLOUT) != 0) return -1;
+        ssize_t n = sendfile(task->client_socket, fd, offset, len);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+        if (n > 0) ar->written += (size_t)n;
+        return n;
+    }
+}
+
+// Start reading a file into the page cache ahead of its turn
+static void prefetch_stored_file(const char *username, const char *filename) {
+    char path[768];
+    storage_file_path(path, sizeof(path), username, filename);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+// Add one file; -1 only when the stream itself failed. A file that turns
+// out to be damaged part way is zero-filled to its announced size so the
+// archive stays readable, and reported as failed.
+static int archive_file(task_t *task, archive_t *ar, const list_row_t *row, char *chunk) {
+    ar->files++;
+    if (acquire_file_lock(task->username, row->name) != 0) {
+        archive_failed(ar, row->name, batch_status_text(BATCH_BUSY));
+        return 0;
+    }
+    size_t size = 0;
+    blob_reader_t *reader = open_file_from_storage(task->username, row->name, &size);
+    if (!reader) {
+        release_file_lock(task->username, row->name);
+        archive_failed(ar, row->name, batch_status_text(BATCH_NOT_FOUND));
+        return 0;
+    }
+
+    char header[TAR_HEADER_MAX];
+    size_t header_len = tar_file_header(header, row->name, size, row->modified);
+    int rc = archive_send(task, ar, header, header_len);
+    off_t offset = 0;
+    int fd = blob_reader_raw_fd(reader, &offset);
+    if (fd >= 0) posix_fadvise(fd, offset, (off_t)size, POSIX_FADV_SEQUENTIAL);
+    size_t sent = 0;
+    while (rc == 0 && sent < size) {
+        ssize_t n;
+        if (fd >= 0) {
+            n = archive_sendfile(task, ar, fd, &offset, size - sent);
+            if (n < 0) rc = -1;
+        } else {
+            n = blob_reader_read(reader, chunk, DOWNLOAD_CHUNK);
+            if (n > 0 && archive_send(task, ar, chunk, (size_t)n) != 0) rc = -1;
+        }
+        if (n <= 0) break;
+        sent += (size_t)n;
+    }
+    blob_reader_close(reader);
+    release_file_lock(task->username, row->name);
+    if (rc != 0) return -1;
+
+    if (sent < size) {
+        archive_failed(ar, row->name, "Stored file is damaged; its archived copy is incomplete");
+    } else {
+        ar->archived++;
+        ar->bytes += size;
+    }
+    return archive_send_zeros(task, ar, size - sent + tar_padding(size));
+}
+
+// Archives of a whole account can run for a long time; like every
+// transfer they stop only on cancellation or a stalled client (see
+// wait_for_client), never on the request deadline
+void handle_archive_task(task_t *task) {
+    printf("Processing ARCHIVE task for prefix '%s' (user: %s, priority: %d)\n",
+           task->filename, task->username, task->priority);
+    pthread_mutex_lock(&task->task_mutex);
+
+    if (!storage_index_ready()) {
+        task->result_code = -1;
+        strncpy(task->error_message, "Archives are unavailable until the file index is built",
+                sizeof(task->error_message) - 1);
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
+    list_query_t query;
+    memset(&query, 0, sizeof(query));
+    query.sort = LIST_SORT_NAME;
+    strncpy(query.prefix, task->filename, MAX_FILENAME - 1);
+    list_row_t *rows = malloc(LIST_BATCH_ROWS * sizeof(list_row_t));
+    char *chunk = malloc(DOWNLOAD_CHUNK);
+    if (!rows || !chunk) {
+        task->result_code = -1;
+        strncpy(task->error_message, "Memory allocation failed", sizeof(task->error_message) - 1);
+        free(rows);
+        free(chunk);
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
+
+    send_response(task->client_socket, "SEND_ARCHIVE\n");
+    int flags = fcntl(task->client_socket, F_GETFL);
+    if (flags >= 0) fcntl(task->client_socket, F_SETFL, flags | O_NONBLOCK);
+
+    archive_t ar;
+    memset(&ar, 0, sizeof(ar));
+    char after[MAX_FILENAME + 32] = "";
+    int more = 1, rc = 0;
+    while (more && rc == 0) {
+        int n = storage_index_rows(task->username, &query, after, rows, LIST_BATCH_ROWS, &more);
+        if (n <= 0) break;
+        for (int i = 0; i < n && rc == 0; i++) {
+            if (i + 1 < n) prefetch_stored_file(task->username, rows[i + 1].name);
+            rc = archive_file(task, &ar, &rows[i], chunk);
+        }
+        storage_index_cursor(after, sizeof(after), LIST_SORT_NAME, &rows[n - 1]);
+    }
+    if (rc == 0) rc = archive_send_zeros(task, &ar, tar_trailer_size(ar.written));
+    if (flags >= 0) fcntl(task->client_socket, F_SETFL, flags);
+    free(rows);
+    free(chunk);
+
+    if (rc != 0) {
+        // The client is part way through a tar it cannot resynchronise with
+        set_transfer_error(task, "Failed to send archive");
+        shutdown(task->client_socket, SHUT_RDWR);
+        free(ar.report);
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
+    size_t summary = 128;
+    char *report = realloc(ar.report, ar.report_len + summary);
+    if (!report) {
+        task->result_code = -1;
+        strncpy(task->error_message, "Memory allocation failed", sizeof(task->error_message) - 1);
+        free(ar.report);
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
+    ar.report_len += (size_t)snprintf(report + ar.report_len, summary, "SUCCESS: %d of %d files archived (%zu bytes)\n",
+                                      ar.archived, ar.files, ar.bytes);
+    task->result_code = 0;
+    task->result_data = report;
+    task->result_size = ar.report_len;
+    pthread_mutex_unlock(&task->task_mutex);
+}
+
+// CHANGES [cursor]: the changes since cursor (see changes_reply) or, for a
+// stale or empty cursor, a snapshot: "FILE <name> <sha256>" per file, then
+// "SNAPSHOT <cursor>". The cursor is taken before listing, so a change that
+// lands meanwhile is reported again by the next CHANGES rather than lost.
+void handle_changes_task(task_t *task) {
+    printf("Processing CHANGES task (user: %s, priority: %d)\n", task->username, task->priority);
+    pthread_mutex_lock(&task->task_mutex);
+
+    char *reply = NULL;
+    size_t len = 0;
+    int rc = changes_reply(task->username, task->filename, &reply, &len);
+    if (rc == 0) {
+        task->result_code = 0;
+        task->result_data = reply;
+        task->result_size = len;
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
+    free(reply);
+    if (rc < 0 || !storage_index_ready()) {
+        task->result_code = -1;
+        strncpy(task->error_message, "Failed to read changes", sizeof(task->error_message) - 1);
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
+
+    char cursor[CHANGE_CURSOR_LEN];
+    changes_cursor(task->username, cursor, sizeof(cursor));
+    list_query_t query;
+    memset(&query, 0, sizeof(query));
+    query.sort = LIST_SORT_NAME;
+    size_t page_size = LIST_BATCH_ROWS * (MAX_FILENAME + 80);
+    list_row_t *rows = malloc(LIST_BATCH_ROWS * sizeof(list_row_t));
+    char *page = malloc(page_size);
+    if (!rows || !page) {
+        task->result_code = -1;
+        strncpy(task->error_message, "Memory allocation failed", sizeof(task->error_message) - 1);
+        free(rows);
+        free(page);
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
+
+    char after[MAX_FILENAME + 32] = "";
+    int more = 1;
+    rc = 0;
+    while (more && rc == 0) {
+        int n = storage_index_rows(task->username, &query, after, rows, LIST_BATCH_ROWS, &more);
+        if (n <= 0) break;
+        size_t used = 0;
+        for (int i = 0; i < n; i++) {
+            // Files deleted since the page was read are left out
+            file_metadata_t *metadata = load_file_metadata(task->username, rows[i].name);
+            if (!metadata) continue;
+            used += (size_t)snprintf(page + used, page_size - used, "FILE %s %s\n",
+                                     rows[i].name, metadata->checksum[0] ? metadata->checksum : "-");
+            destroy_file_metadata(metadata);
+        }
+        rc = send_all(task, page, used);
+        task->response_sent = 1;
+        storage_index_cursor(after, sizeof(after), LIST_SORT_NAME, &rows[n - 1]);
+    }
+    free(rows);
+    if (rc == 0) {
+        int n = snprintf(page, page_size, "SNAPSHOT %s\n", cursor);
+        rc = send_all(task, page, (size_t)n);
+        task->response_sent = 1;
+    }
+    free(page);
+    if (rc != 0) {
+        set_transfer_error(task, "Failed to send snapshot");
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
+    task->result_code = 0;
+    strncpy(task->error_message, "Snapshot sent", sizeof(task->error_message) - 1);
+    pthread_mutex_unlock(&task->task_mutex);
+}
+
+// Listing text goes straight to the client as each buffer fills
+static int send_list_chunk(const char *data, size_t len, void *arg) {
+    task_t *task = (task_t *)arg;
+    if (send_all(task, data, len) != 0) return -1;
+    task->response_sent = 1;
+    return 0;
+}
+
 void handle_list_task(task_t *task) {
     printf("Processing LIST task (user: %s, priority: %d)\n", task->username, task->priority);
     
     pthread_mutex_lock(&task->task_mutex);
     
     
-    char *file_list = NULL;
-    size_t list_size = 0;
+    list_query_t query;
+    char query_error[256] = "Invalid LIST options";
     
-    if (list_user_files(task->username, &file_list, &list_size) != 0) {
+    if (parse_list_query(task->command, &query, query_error, sizeof(query_error)) != 0) {
         task->result_code = -1;
-        strncpy(task->error_message, "Failed to list files", sizeof(task->error_message) - 1);
+        strncpy(task->error_message, query_error, sizeof(task->error_message) - 1);
+        pthread_mutex_unlock(&task->task_mutex);
+        return;
+    }
+    
+    int rc = list_user_files(task->username, &query, send_list_chunk, task);
+    if (rc != 0) {
+        if (rc == -2) {
+            task->result_code = -1;
+            strncpy(task->error_message, "Invalid cursor for this listing", sizeof(task->error_message) - 1);
+        } else {
+            set_transfer_error(task, "Failed to list files");
+        }
         pthread_mutex_unlock(&task->task_mutex);
         return;
     }
     
     
-    task->result_data = file_list;
-    task->result_size = list_size;
     task->result_code = 0;
     strncpy(task->error_message, "File list retrieved successfully", sizeof(task->error_message) - 1);
     
     pthread_mutex_unlock(&task->task_mutex);
-}
\ No newline at end of file
+}
+// Verify one file for the background scrubber (detached task, no client)
+void handle_scrub_task(task_t *task) {
+    size_t bytes = 0;
+    int quarantined = 0;
+    int result = verify_stored_file(task->username, task->filename, g_config.scrub_quarantine,
+                                    &bytes, &quarantined);
+    if (result == 1) {
+        printf("Scrub: %s/%s does not match its stored SHA-256\n", task->username, task->filename);
+        if (quarantined) {
+            printf("Scrub: moved %s/%s to storage/%s/%s/\n",
+                   task->username, task->filename, QUARANTINE_DIR, task->username);
+        } else if (g_config.scrub_quarantine) {
+            printf("Scrub: failed to quarantine %s/%s\n", task->username, task->filename);
+        }
+    }
+    task->result_code = result == 1 ? -1 : 0;
+    scrubber_file_done(bytes, result == 1, quarantined);
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "dropbox_server.h"
 #include <dirent.h>
 #include <sys/stat.h>
@@ -9,7 +10,6 @@
 
 #define METADATA_FILE_SUFFIX ".meta"
 #define USER_QUOTA_META_SUFFIX ".quota.meta"
-#define USER_QUOTA_MB 50 // 50 MB quota per user
 
 
 typedef struct {
@@ -50,27 +50,51 @@ static pthread_mutex_t *get_user_mutex(const char *username) {
     return NULL; // table full
 }
 
-static int atomic_write_file(const char *final_path, const char *buf, size_t len) {
-    if (!final_path) return -1;
-    char tmp_path[1024];
-    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", final_path);
-    FILE *f = fopen(tmp_path, "wb");
+// Write buf to path, making the data durable unless sync is 0 (batches
+// flush all their blobs at once); no rename
+static int write_data_file(const char *path, const char *buf, size_t len, int sync) {
+    FILE *f = fopen(path, "wb");
     if (!f) return -1;
     size_t w = fwrite(buf, 1, len, f);
-    if (w != len) {
+    if (w != len || fflush(f) != 0 || (sync && durability_sync_fd(fileno(f)) != 0)) {
         fclose(f);
-        unlink(tmp_path);
+        unlink(path);
         return -1;
     }
-    fflush(f);
-    int fd = fileno(f);
-    if (fd >= 0) fsync(fd);
-    fclose(f);
+    if (fclose(f) != 0) {
+        unlink(path);
+        return -1;
+    }
+    return 0;
+}
+
+static int write_synced_file(const char *path, const char *buf, size_t len) {
+    return write_data_file(path, buf, len, 1);
+}
+
+static int atomic_write_file(const char *final_path, const char *buf, size_t len) {
+    if (!final_path) return -1;
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", final_path);
+    // The data must be durable before the rename makes it visible
+    if (write_synced_file(tmp_path, buf, len) != 0) return -1;
     if (rename(tmp_path, final_path) != 0) {
         unlink(tmp_path);
         return -1;
     }
-    return 0;
+    return durability_sync_dir(final_path);
+}
+
+// Rewrite a small sidecar file covered by a journal record. The journal
+// holds the durable copy, so this is a plain overwrite with no temp file,
+// rename or fsync; replay repairs it after a crash.
+static int write_journaled_file(const char *path, const char *buf, size_t len) {
+    if (!journal_is_open()) return atomic_write_file(path, buf, len);
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    size_t w = fwrite(buf, 1, len, f);
+    int rc = fclose(f);
+    return (w == len && rc == 0) ? 0 : -1;
 }
 
 // Load user quota metadata (no locking; callers that modify should lock per-user mutex)
@@ -79,13 +103,13 @@ int load_user_quota(const char *username, user_quota_t *quota) {
     snprintf(quota_path, sizeof(quota_path), "storage/%s%s", username, USER_QUOTA_META_SUFFIX);
     FILE *file = fopen(quota_path, "r");
     if (!file) {
-        quota->quota_limit = USER_QUOTA_MB * 1024 * 1024;
+        quota->quota_limit = g_config.user_quota_mb * 1024 * 1024;
         quota->used_bytes = 0;
         return 0;
     }
     if (fscanf(file, "%zu\n%zu\n", &quota->quota_limit, &quota->used_bytes) != 2) {
         // fallback to defaults
-        quota->quota_limit = USER_QUOTA_MB * 1024 * 1024;
+        quota->quota_limit = g_config.user_quota_mb * 1024 * 1024;
         quota->used_bytes = 0;
     }
     fclose(file);
@@ -100,316 +124,909 @@ int save_user_quota(const char *username, const user_quota_t *quota) {
     char buf[256];
     int len = snprintf(buf, sizeof(buf), "%zu\n%zu\n", quota->quota_limit, quota->used_bytes);
     if (len < 0 || (size_t)len >= sizeof(buf)) return -1;
-    return atomic_write_file(quota_path, buf, (size_t)len);
+    return write_journaled_file(quota_path, buf, (size_t)len);
 }
 
-// Update quota on file upload (locks per-user)
-int update_quota_on_upload(const char *username, size_t file_size) {
-    if (!username) return -1;
-    pthread_mutex_t *m = get_user_mutex(username);
-    if (!m) return -1;
-    pthread_mutex_lock(m);
+// Make the quota file agree with the bytes actually stored.
+// Returns 1 if it was rewritten, 0 if it already matched, -1 on error.
+int reconcile_user_quota(const char *username, size_t used_bytes) {
     user_quota_t quota;
     load_user_quota(username, &quota);
-    quota.used_bytes += file_size;
-    int res = save_user_quota(username, &quota);
-    pthread_mutex_unlock(m);
-    return res;
+    if (quota.used_bytes == used_bytes) return 0;
+    printf("Quota for %s drifted (recorded %zu, stored %zu); fixing\n", username, quota.used_bytes, used_bytes);
+    quota.used_bytes = used_bytes;
+    return save_user_quota(username, &quota) == 0 ? 1 : -1;
 }
 
-// Update quota on file delete (locks per-user)
-int update_quota_on_delete(const char *username, size_t file_size) {
-    if (!username) return -1;
-    pthread_mutex_t *m = get_user_mutex(username);
-    if (!m) return -1;
-    pthread_mutex_lock(m);
-    user_quota_t quota;
-    load_user_quota(username, &quota);
-    if (quota.used_bytes >= file_size) quota.used_bytes -= file_size;
-    else quota.used_bytes = 0;
-    int res = save_user_quota(username, &quota);
-    pthread_mutex_unlock(m);
-    return res;
+// Temp blob of an in-flight transaction, hidden from LIST by the leading dot
+static void blob_tmp_path(char *buf, size_t size, const char *username, const char *filename,
+                          unsigned long long seq) {
+    char dir[512];
+    storage_shard_dir(dir, sizeof(dir), username, filename);
+    snprintf(buf, size, "%s/.%s.%llu.tmp", dir, filename, seq);
 }
 
-// Base64 alphabet
-static const char b64_table[] =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-static int base64_encode(const unsigned char *in, size_t in_len, char **out, size_t *out_len) {
-    if (!in || !out || !out_len) return -1;
-    size_t enc_len = ((in_len + 2) / 3) * 4;
-    char *enc = malloc(enc_len + 1);
-    if (!enc) return -1;
-    size_t i = 0, j = 0;
-    while (i < in_len) {
-        uint32_t octet_a = i < in_len ? in[i++] : 0;
-        uint32_t octet_b = i < in_len ? in[i++] : 0;
-        uint32_t octet_c = i < in_len ? in[i++] : 0;
-        uint32_t triple = (octet_a << 16) | (octet_b << 8) | octet_c;
-        enc[j++] = b64_table[(triple >> 18) & 0x3F];
-        enc[j++] = b64_table[(triple >> 12) & 0x3F];
-        enc[j++] = b64_table[(triple >> 6) & 0x3F];
-        enc[j++] = b64_table[triple & 0x3F];
-    }
-    // padding
-    size_t mod = in_len % 3;
-    if (mod) {
-        if (mod == 1) {
-            enc[enc_len - 1] = '=';
-            enc[enc_len - 2] = '=';
-        } else if (mod == 2) {
-            enc[enc_len - 1] = '=';
+// Earlier versions of a file are hard links to the blobs that uploads
+// replaced, named ".<file>.v<seq>" in the file's shard after the upload
+// that replaced them. Keeping one costs a directory entry, no data copy;
+// the blob header carries its codec and size, so no .meta is kept. The
+// leading dot hides them from LIST, the startup scan and the scrubber,
+// and they are not charged to the quota.
+typedef struct {
+    unsigned long long seq;
+    time_t replaced;                     // link time: the blob's ctime
+} file_version_t;
+
+static void version_path(char *buf, size_t size, const char *username, const char *filename,
+                         unsigned long long seq) {
+    char dir[512];
+    storage_shard_dir(dir, sizeof(dir), username, filename);
+    snprintf(buf, size, "%s/.%s.v%llu", dir, filename, seq);
+}
+
+static int compare_versions(const void *a, const void *b) {
+    unsigned long long x = ((const file_version_t *)a)->seq, y = ((const file_version_t *)b)->seq;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// The file's versions, newest first. Returns the count, or -1.
+static int list_versions(const char *username, const char *filename, file_version_t **versions) {
+    *versions = NULL;
+    char dir_path[512], prefix[MAX_FILENAME + 8];
+    storage_shard_dir(dir_path, sizeof(dir_path), username, filename);
+    int prefix_len = snprintf(prefix, sizeof(prefix), ".%s.v", filename);
+    DIR *dir = opendir(dir_path);
+    if (!dir) return errno == ENOENT ? 0 : -1;
+
+    int count = 0, cap = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *digits = entry->d_name + prefix_len;
+        if (strncmp(entry->d_name, prefix, (size_t)prefix_len) != 0 || !*digits ||
+            strspn(digits, "0123456789") != strlen(digits)) {
+            continue;
+        }
+        struct stat st;
+        if (fstatat(dirfd(dir), entry->d_name, &st, 0) != 0) continue;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 8;
+            file_version_t *grown = realloc(*versions, (size_t)cap * sizeof(file_version_t));
+            if (!grown) break;
+            *versions = grown;
+        }
+        (*versions)[count].seq = strtoull(digits, NULL, 10);
+        (*versions)[count].replaced = st.st_ctime;
+        count++;
+    }
+    closedir(dir);
+    if (count > 1) qsort(*versions, (size_t)count, sizeof(file_version_t), compare_versions);
+    return count;
+}
+
+// Drop the versions beyond the newest keep, and with keep > 0 those
+// replaced more than versions_max_age_s ago
+static void prune_versions(const char *username, const char *filename, int keep) {
+    file_version_t *versions = NULL;
+    int count = list_versions(username, filename, &versions);
+    time_t now = time(NULL);
+    for (int i = 0; i < count; i++) {
+        int expired = keep > 0 && g_config.versions_max_age_s > 0 &&
+                      now - versions[i].replaced > g_config.versions_max_age_s;
+        if (i < keep && !expired) continue;
+        char path[1024];
+        version_path(path, sizeof(path), username, filename, versions[i].seq);
+        unlink(path);
+    }
+    free(versions);
+}
+
+// Open version k of a file (1 = the content the latest upload replaced)
+blob_reader_t* open_file_version(const char *username, const char *filename, int version, size_t *size) {
+    if (!username || !filename || version < 1) return NULL;
+    file_version_t *versions = NULL;
+    int count = list_versions(username, filename, &versions);
+    blob_reader_t *reader = NULL;
+    if (version <= count) {
+        char path[1024];
+        version_path(path, sizeof(path), username, filename, versions[version - 1].seq);
+        reader = blob_reader_open(path, size);
+    }
+    free(versions);
+    return reader;
+}
+
+// Render a .meta file: the five fixed lines, a "codec <name>" line for
+// blobs in the headered format, then for chunked files a
+// "<chunk_size> <root>" line and one leaf digest per line. Caller frees.
+static char *format_metadata(const file_metadata_t *metadata, size_t *out_len) {
+    int leaves = metadata->chunk_size > 0 && metadata->chunk_hashes ? metadata->chunk_count : 0;
+    size_t size = 1024 + (size_t)leaves * (SHA256_DIGEST_BYTES * 2 + 1);
+    char *buf = malloc(size);
+    if (!buf) return NULL;
+    int len = snprintf(buf, size, "%s\n%zu\n%ld\n%ld\n%s\n",
+            metadata->filename,
+            metadata->file_size,
+            metadata->created_time,
+            metadata->modified_time,
+            metadata->checksum);
+    if (len < 0 || (size_t)len >= 1024) {
+        free(buf);
+        return NULL;
+    }
+    if (metadata->codec != CODEC_BASE64) {
+        len += snprintf(buf + len, size - (size_t)len, "codec %s\n", storage_codec_name(metadata->codec));
+    }
+    if (leaves > 0) {
+        len += snprintf(buf + len, size - (size_t)len, "%zu %s\n", metadata->chunk_size, metadata->merkle_root);
+        for (int i = 0; i < leaves; i++) {
+            sha256_to_hex(metadata->chunk_hashes + (size_t)i * SHA256_DIGEST_BYTES, buf + len);
+            len += SHA256_DIGEST_BYTES * 2;
+            buf[len++] = '\n';
         }
     }
-    enc[enc_len] = '\0';
-    *out = enc;
-    *out_len = enc_len;
+    *out_len = (size_t)len;
+    return buf;
+}
+
+// Apply the blob and .meta part of a committed journal record. Called with
+// the user's mutex held, or single-threaded during replay. Replaying a
+// file's last record again is safe; replay skips its earlier records, which
+// would undo the later ones (see journal.c).
+static int apply_record_files(const journal_record_t *rec) {
+    char file_path[768], meta_path[1024];
+    storage_file_path(file_path, sizeof(file_path), rec->username, rec->metadata.filename);
+    snprintf(meta_path, sizeof(meta_path), "%s%s", file_path, METADATA_FILE_SUFFIX);
+
+    if (rec->op == JOURNAL_UPLOAD) {
+        char tmp_path[1024];
+        blob_tmp_path(tmp_path, sizeof(tmp_path), rec->username, rec->metadata.filename, rec->seq);
+        // Keep the blob being replaced as a version. Only while the temp
+        // blob is still waiting: on replay after the rename, file_path
+        // already holds the new blob.
+        int versioned = 0;
+        if (g_config.versions_keep > 0 && access(tmp_path, F_OK) == 0) {
+            char keep_path[1024];
+            version_path(keep_path, sizeof(keep_path), rec->username, rec->metadata.filename, rec->seq);
+            versioned = link(file_path, keep_path) == 0;
+        }
+        if (rename(tmp_path, file_path) != 0) {
+            // Already renamed before a crash, or the blob is gone
+            if (errno != ENOENT) return -1;
+            struct stat st;
+            if (stat(file_path, &st) != 0) return -1;
+        }
+        if (!journal_is_open()) durability_sync_dir(file_path);
+
+        // The journal only carries the chunk root; on replay the leaves are
+        // recomputed from the blob
+        file_metadata_t metadata = rec->metadata;
+        int rebuilt = 0;
+        if (metadata.chunk_size > 0 && !metadata.chunk_hashes) {
+            char *data = NULL;
+            size_t size = 0;
+            if (load_file_from_storage(rec->username, metadata.filename, &data, &size) == 0 &&
+                merkle_build(data, size, &metadata) == 0) {
+                rebuilt = 1;
+            } else {
+                metadata.chunk_size = 0;
+            }
+            free(data);
+        }
+        size_t len = 0;
+        char *buf = format_metadata(&metadata, &len);
+        int res = buf ? write_journaled_file(meta_path, buf, len) : -1;
+        free(buf);
+        if (rebuilt) merkle_release(&metadata);
+        if (res != 0) return -1;
+        if (versioned) prune_versions(rec->username, rec->metadata.filename, g_config.versions_keep);
+        storage_index_put(rec->username, &rec->metadata);
+        changes_record(rec->username, rec->op, rec->metadata.filename, rec->metadata.checksum);
+    } else if (rec->op == JOURNAL_DELETE) {
+        unlink(file_path);
+        unlink(meta_path);
+        prune_versions(rec->username, rec->metadata.filename, 0);
+        if (!journal_is_open()) durability_sync_dir(file_path);
+        storage_index_remove(rec->username, rec->metadata.filename);
+        changes_record(rec->username, rec->op, rec->metadata.filename, NULL);
+    } else {
+        return -1;
+    }
     return 0;
 }
 
-static unsigned char b64_reverse_table[256];
-static int b64_reverse_init = 0;
-
-static void init_b64_reverse() {
-    if (b64_reverse_init) return;
-    memset(b64_reverse_table, 0xFF, sizeof(b64_reverse_table));
-    for (size_t i = 0; i < 64; ++i) b64_reverse_table[(unsigned char)b64_table[i]] = (unsigned char)i;
-    b64_reverse_table[(unsigned char)'='] = 0;
-    b64_reverse_init = 1;
-}
-
-static int base64_decode(const char *in, size_t in_len, unsigned char **out, size_t *out_len) {
-    if (!in || !out || !out_len) return -1;
-    if (in_len % 4 != 0) return -1;
-    init_b64_reverse();
-    size_t padding = 0;
-    if (in_len >= 1 && in[in_len - 1] == '=') padding++;
-    if (in_len >= 2 && in[in_len - 2] == '=') padding++;
-    size_t dec_len = (in_len / 4) * 3 - padding;
-    unsigned char *dec = malloc(dec_len + 1);
-    if (!dec) return -1;
-    size_t i = 0, j = 0;
-    while (i < in_len) {
-        uint32_t sextet_a = b64_reverse_table[(unsigned char)in[i++]];
-        uint32_t sextet_b = b64_reverse_table[(unsigned char)in[i++]];
-        uint32_t sextet_c = b64_reverse_table[(unsigned char)in[i++]];
-        uint32_t sextet_d = b64_reverse_table[(unsigned char)in[i++]];
-        if (sextet_a == 0xFF || sextet_b == 0xFF || sextet_c == 0xFF || sextet_d == 0xFF) { free(dec); return -1; }
-        uint32_t triple = (sextet_a << 18) | (sextet_b << 12) | (sextet_c << 6) | sextet_d;
-        if (j < dec_len) dec[j++] = (triple >> 16) & 0xFF;
-        if (j < dec_len) dec[j++] = (triple >> 8) & 0xFF;
-        if (j < dec_len) dec[j++] = triple & 0xFF;
-    }
-    dec[dec_len] = '\0';
-    *out = dec;
-    *out_len = dec_len;
+static int apply_record_quota(const char *username, size_t quota_used) {
+    user_quota_t quota;
+    load_user_quota(username, &quota);
+    quota.used_bytes = quota_used;
+    return save_user_quota(username, &quota);
+}
+
+// Apply a committed journal record to the blob, .meta and quota files
+int storage_apply_journal_record(const journal_record_t *rec) {
+    if (!rec || apply_record_files(rec) != 0) return -1;
+    return apply_record_quota(rec->username, rec->quota_used);
+}
+
+// Hash, chunk and encode data into rec and write it to the record's temp
+// blob. With sync 0 the blob is not flushed; the caller must make it
+// durable before journaling the record. On failure nothing is left behind.
+static int stage_blob(const char *username, const char *filename, const char *data, size_t data_size,
+                      const char *checksum, journal_record_t *rec, int sync) {
+    if (storage_ensure_shard(username, filename) != 0) return -1;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->op = JOURNAL_UPLOAD;
+    strncpy(rec->username, username, MAX_USERNAME - 1);
+    strncpy(rec->metadata.filename, filename, MAX_FILENAME - 1);
+    rec->metadata.file_size = data_size;
+    rec->metadata.created_time = rec->metadata.modified_time = time(NULL);
+    if (checksum) {
+        strncpy(rec->metadata.checksum, checksum, sizeof(rec->metadata.checksum) - 1);
+    } else {
+        char *computed = calculate_sha256(data, data_size);
+        strncpy(rec->metadata.checksum, computed ? computed : "-", sizeof(rec->metadata.checksum) - 1);
+        free(computed);
+    }
+
+    // Chunk tree, hashed across cores for large files
+    if (merkle_build(data, data_size, &rec->metadata) != 0) return -1;
+
+    // Raw or deflated, whichever the probe picks
+    char *blob = NULL; size_t blob_len = 0;
+    if (blob_encode(data, data_size, &blob, &blob_len, &rec->metadata.codec) != 0) {
+        merkle_release(&rec->metadata);
+        return -1;
+    }
+
+    rec->seq = journal_next_seq();
+    char tmp_path[1024];
+    blob_tmp_path(tmp_path, sizeof(tmp_path), username, filename, rec->seq);
+    int write_res = write_data_file(tmp_path, blob, blob_len, sync);
+    free(blob);
+    if (write_res != 0) {
+        merkle_release(&rec->metadata);
+        return -1;
+    }
     return 0;
 }
 
+// Store a file as one journaled transaction: blob, metadata (size, times,
+// SHA-256) and quota usage commit together. Overwrites only charge the
+// quota for the size difference. Returns -2 if the quota would be exceeded.
 int save_file_to_storage(const char *username, const char *filename, const char *data, size_t data_size) {
-    printf("DEBUG: Entering save_file_to_storage: user=%s, filename=%s, size=%zu\n", username, filename, data_size);
+    return save_file_with_checksum(username, filename, data, data_size, NULL);
+}
+
+// As save_file_to_storage, for callers that already hashed the data while
+// receiving it. checksum is the hex SHA-256 ("-" for empty data), or NULL.
+int save_file_with_checksum(const char *username, const char *filename, const char *data, size_t data_size,
+                            const char *checksum) {
     if (!username || !filename || (!data && data_size>0)) return -1;
-    user_quota_t quota; load_user_quota(username, &quota);
-    if (quota.used_bytes + data_size > quota.quota_limit) return -2;
-    char user_dir[512]; snprintf(user_dir, sizeof(user_dir), "storage/%s", username);
-    struct stat st={0};
-    if (stat("storage", &st)==-1 && mkdir("storage",0700)!=0) return -1;
-    if (stat(user_dir,&st)==-1 && mkdir(user_dir,0700)!=0) return -1;
-    char file_path[768]; snprintf(file_path,sizeof(file_path),"%s/%s", user_dir, filename);
-
-    // Base64 encode
-    char *b64 = NULL; size_t b64_len = 0;
-    if (base64_encode((const unsigned char*)data, data_size, &b64, &b64_len) != 0) { return -1; }
-
-    // Write atomically to temp file and rename
-    int write_res = atomic_write_file(file_path, b64, b64_len);
-    free(b64);
-    if (write_res != 0) return -1;
-
-    // update quota under per-user mutex
-    if (update_quota_on_upload(username, data_size) != 0) {
-        // Attempt to remove file if quota update fails
-        unlink(file_path);
+
+    // The blob must be durable before the record that publishes it
+    journal_record_t rec;
+    if (stage_blob(username, filename, data, data_size, checksum, &rec, 1) != 0) return -1;
+    char tmp_path[1024];
+    blob_tmp_path(tmp_path, sizeof(tmp_path), username, filename, rec.seq);
+
+    pthread_mutex_t *m = get_user_mutex(username);
+    if (!m) {
+        merkle_release(&rec.metadata);
+        unlink(tmp_path);
         return -1;
     }
+    pthread_mutex_lock(m);
 
-    return 0;
+    user_quota_t quota; load_user_quota(username, &quota);
+    size_t old_size = 0;
+    file_metadata_t *old = load_file_metadata(username, filename);
+    if (old) {
+        old_size = old->file_size;
+        rec.metadata.created_time = old->created_time;
+        destroy_file_metadata(old);
+    }
+    size_t used = quota.used_bytes >= old_size ? quota.used_bytes - old_size : 0;
+    int res;
+    if (used + data_size > quota.quota_limit) {
+        res = -2;
+    } else {
+        rec.quota_used = used + data_size;
+        res = journal_append(&rec) == 0 ? 0 : -1;
+    }
+    if (res != 0) {
+        pthread_mutex_unlock(m);
+        merkle_release(&rec.metadata);
+        unlink(tmp_path);
+        return res;
+    }
+    res = storage_apply_journal_record(&rec);
+    pthread_mutex_unlock(m);
+    journal_applied();
+    merkle_release(&rec.metadata);
+    return res;
+}
+
+// Open a stored file for streaming; *size is its logical size
+blob_reader_t* open_file_from_storage(const char *username, const char *filename, size_t *size) {
+    if (!username || !filename) return NULL;
+    char file_path[768];
+    storage_file_path(file_path, sizeof(file_path), username, filename);
+    return blob_reader_open(file_path, size);
 }
 
 int load_file_from_storage(const char *username, const char *filename, char **data, size_t *data_size) {
     if (!username || !filename || !data || !data_size) return -1;
-    char file_path[768]; snprintf(file_path,sizeof(file_path),"storage/%s/%s", username, filename);
-    struct stat file_stat; if (stat(file_path,&file_stat)!=0) return -1;
-    FILE *file = fopen(file_path, "rb"); if(!file) return -1;
-    size_t file_size = file_stat.st_size;
-    char *b64 = malloc(file_size + 1); if(!b64){ fclose(file); return -1; }
-    size_t read_sz = fread(b64,1,file_size,file); fclose(file);
-    if (read_sz != file_size) { free(b64); return -1; }
-    b64[file_size] = '\0';
-    unsigned char *decoded = NULL; size_t decoded_len = 0;
-    if (base64_decode(b64, file_size, &decoded, &decoded_len) != 0) { free(b64); return -1; }
-    free(b64);
-    *data = (char*)decoded;
-    *data_size = decoded_len;
+    size_t size = 0;
+    blob_reader_t *reader = open_file_from_storage(username, filename, &size);
+    if (!reader) return -1;
+    char *buf = malloc(size + 1);
+    if (!buf) {
+        blob_reader_close(reader);
+        return -1;
+    }
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = blob_reader_read(reader, buf + got, size - got);
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    blob_reader_close(reader);
+    if (got != size) {
+        free(buf);
+        return -1;
+    }
+    buf[size] = '\0';
+    *data = buf;
+    *data_size = size;
     return 0;
 }
 
+// Remove a file, its metadata and its quota charge as one journaled transaction
 int delete_file_from_storage(const char *username, const char *filename) {
     if (!username || !filename) return -1;
     
     char file_path[768];
-    snprintf(file_path, sizeof(file_path), "storage/%s/%s", username, filename);
+    storage_file_path(file_path, sizeof(file_path), username, filename);
     
     struct stat st;
-    size_t file_size = 0;
-    if (stat(file_path, &st) == 0 && S_ISREG(st.st_mode)) file_size = st.st_size; // stored size (base64)
-    // Before unlinking, compute original data size if possible by loading metadata file if exists
-    file_metadata_t *m = load_file_metadata(username, filename);
-    size_t orig_size = 0;
-    if (m) { orig_size = m->file_size; destroy_file_metadata(m); }
+    if (stat(file_path, &st) != 0 || !S_ISREG(st.st_mode)) return -1;
 
-    if (unlink(file_path) != 0) return -1;
-    
-    char meta_path[768];
-    snprintf(meta_path, sizeof(meta_path), "storage/%s/%s%s", username, filename, METADATA_FILE_SUFFIX);
-    unlink(meta_path);
-    // update quota using original size if present, else best-effort using stored size
-    if (orig_size > 0) update_quota_on_delete(username, orig_size);
-    else update_quota_on_delete(username, file_size);
+    pthread_mutex_t *m = get_user_mutex(username);
+    if (!m) return -1;
+    pthread_mutex_lock(m);
+
+    // Release the original size if metadata exists, else best-effort the stored size
+    size_t file_size = st.st_size;
+    file_metadata_t *meta = load_file_metadata(username, filename);
+    if (meta) { file_size = meta->file_size; destroy_file_metadata(meta); }
+
+    journal_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.op = JOURNAL_DELETE;
+    rec.seq = journal_next_seq();
+    strncpy(rec.username, username, MAX_USERNAME - 1);
+    strncpy(rec.metadata.filename, filename, MAX_FILENAME - 1);
+    user_quota_t quota; load_user_quota(username, &quota);
+    rec.quota_used = quota.used_bytes >= file_size ? quota.used_bytes - file_size : 0;
+
+    if (journal_append(&rec) != 0) {
+        pthread_mutex_unlock(m);
+        return -1;
+    }
+    int res = storage_apply_journal_record(&rec);
+    pthread_mutex_unlock(m);
+    journal_applied();
+    return res;
+}
+
+const char* batch_status_text(batch_status_t status) {
+    switch (status) {
+        case BATCH_OK: return "ok";
+        case BATCH_BUSY: return "File is currently being accessed by another operation";
+        case BATCH_NOT_FOUND: return "File not found";
+        case BATCH_TOO_LARGE: return "File too large";
+        case BATCH_QUOTA: return "Quota exceeded";
+        case BATCH_DUPLICATE: return "Named more than once in this batch";
+        default: return "Failed";
+    }
+}
+
+// First half of a batch upload: write one file's blob to its temp file
+// without flushing it. The temp file is private to the entry, so no file
+// lock is needed until the commit.
+int storage_stage_upload(const char *username, batch_entry_t *entry, const char *data, size_t data_size,
+                         const char *checksum) {
+    if (!username || !entry || (!data && data_size > 0)) return -1;
+    if (stage_blob(username, entry->filename, data, data_size, checksum, &entry->rec, 0) != 0) {
+        entry->status = BATCH_FAILED;
+        return -1;
+    }
+    entry->staged = 1;
+    entry->size = data_size;
     return 0;
 }
 
-int list_user_files(const char *username, char **file_list, size_t *list_size) {
-    if (!username || !file_list || !list_size) return -1;
-    
-    char user_dir[512];
-    snprintf(user_dir, sizeof(user_dir), "storage/%s", username);
-    
-    DIR *dir = opendir(user_dir);
-    if (!dir) {
-       
-        *file_list = malloc(256);
-        if (!*file_list) return -1;
-        strcpy(*file_list, "No files found.\n");
-        *list_size = strlen(*file_list);
-        return 0;
+// Drop the temp blobs of staged entries that were not committed
+void storage_discard_uploads(const char *username, batch_entry_t *entries, int count) {
+    if (!username || !entries) return;
+    for (int i = 0; i < count; i++) {
+        if (!entries[i].staged) continue;
+        char tmp_path[1024];
+        blob_tmp_path(tmp_path, sizeof(tmp_path), username, entries[i].filename, entries[i].rec.seq);
+        unlink(tmp_path);
+        merkle_release(&entries[i].rec.metadata);
+        entries[i].staged = 0;
     }
-    
-    
-    size_t buffer_size = BUFFER_SIZE * 4; 
-    char *list = malloc(buffer_size);
-    if (!list) {
-        closedir(dir);
+}
+
+// Journal and apply the records of a set of batch entries under the user's
+// mutex (held by the caller): one journal write and sync covers all of
+// them and the quota file is written once, at the end. An entry whose
+// files could not be applied is marked failed; its record is durable, so
+// the next startup's replay redoes it. Returns -1 if nothing was journaled.
+static int commit_entries_locked(const char *username, batch_entry_t **batch, int count, size_t quota_used) {
+    if (count == 0) return 0;
+    journal_record_t **recs = malloc((size_t)count * sizeof(journal_record_t *));
+    if (!recs) return -1;
+    for (int i = 0; i < count; i++) recs[i] = &batch[i]->rec;
+    if (journal_append_batch(recs, count) != 0) {
+        free(recs);
         return -1;
     }
-    
-    size_t current_pos = 0;
-    struct dirent *entry;
-    
-    // Simple header without quota information
-    current_pos += snprintf(list + current_pos, buffer_size - current_pos,
-                          "=== File Listing for %s ===\n\n"
-                          "%-30s %-10s %-20s\n"
-                          "%-30s %-10s %-20s\n",
-                          username,
-                          "Filename", "Size", "Modified",
-                          "--------", "----", "--------");    while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_name[0] == '.') continue; 
-        
-        
-        if (strstr(entry->d_name, METADATA_FILE_SUFFIX)) {
-            continue;
+    for (int i = 0; i < count; i++) {
+        if (apply_record_files(recs[i]) != 0) {
+            fprintf(stderr, "Batch: failed to apply %c record for %s/%s\n",
+                    recs[i]->op, username, recs[i]->metadata.filename);
+            batch[i]->status = BATCH_FAILED;
+        }
+    }
+    apply_record_quota(username, quota_used);
+    for (int i = 0; i < count; i++) journal_applied();
+    free(recs);
+    return 0;
+}
+
+// Second half of a batch upload, with the entries' file locks held: flush
+// every staged blob at once, then charge the quota in order and commit the
+// files that fit as one journal batch. Staged entries that are not
+// BATCH_OK (e.g. busy) are skipped and their temp blobs removed. Entries end up BATCH_OK, BATCH_QUOTA or BATCH_FAILED; returns
+// the number stored, or -1 if nothing could be committed.
+int storage_commit_uploads(const char *username, batch_entry_t *entries, int count) {
+    if (!username || !entries || count <= 0) return -1;
+    batch_entry_t **batch = malloc((size_t)count * sizeof(batch_entry_t *));
+    pthread_mutex_t *m = get_user_mutex(username);
+    int rc = -1, accepted = 0;
+    if (batch && m && durability_sync_batch() == 0) {
+        pthread_mutex_lock(m);
+        user_quota_t quota; load_user_quota(username, &quota);
+        size_t used = quota.used_bytes;
+        for (int i = 0; i < count; i++) {
+            batch_entry_t *entry = &entries[i];
+            if (!entry->staged || entry->status != BATCH_OK) continue;
+            size_t old_size = 0;
+            file_metadata_t *old = load_file_metadata(username, entry->filename);
+            if (old) {
+                old_size = old->file_size;
+                entry->rec.metadata.created_time = old->created_time;
+                destroy_file_metadata(old);
+            }
+            size_t rest = used >= old_size ? used - old_size : 0;
+            if (rest + entry->size > quota.quota_limit) {
+                entry->status = BATCH_QUOTA;
+                continue;
+            }
+            used = rest + entry->size;
+            entry->rec.quota_used = used;
+            batch[accepted++] = entry;
+        }
+        rc = commit_entries_locked(username, batch, accepted, used);
+        pthread_mutex_unlock(m);
+    }
+
+    // Committed blobs have been renamed; the other temp files go
+    int stored = 0;
+    for (int i = 0; i < accepted; i++) {
+        if (rc != 0) {
+            batch[i]->status = BATCH_FAILED;
+        } else if (batch[i]->status == BATCH_OK) {
+            merkle_release(&batch[i]->rec.metadata);
+            batch[i]->staged = 0;
+            stored++;
         }
-        
-        
+    }
+    for (int i = 0; i < count && rc != 0; i++) {
+        if (entries[i].staged && entries[i].status == BATCH_OK) entries[i].status = BATCH_FAILED;
+    }
+    free(batch);
+    storage_discard_uploads(username, entries, count);
+    return rc == 0 ? stored : -1;
+}
+
+// Delete every locked entry as one journal batch. Entries end up BATCH_OK
+// (size = bytes released), BATCH_NOT_FOUND or BATCH_FAILED; returns the
+// number deleted, or -1 if the batch could not be committed.
+int storage_delete_files(const char *username, batch_entry_t *entries, int count) {
+    if (!username || !entries || count <= 0) return -1;
+    batch_entry_t **batch = malloc((size_t)count * sizeof(batch_entry_t *));
+    pthread_mutex_t *m = get_user_mutex(username);
+    if (!batch || !m) {
+        free(batch);
+        for (int i = 0; i < count; i++) {
+            if (entries[i].locked && entries[i].status == BATCH_OK) entries[i].status = BATCH_FAILED;
+        }
+        return -1;
+    }
+
+    pthread_mutex_lock(m);
+    user_quota_t quota; load_user_quota(username, &quota);
+    size_t used = quota.used_bytes;
+    int accepted = 0;
+    for (int i = 0; i < count; i++) {
+        batch_entry_t *entry = &entries[i];
+        if (!entry->locked || entry->status != BATCH_OK) continue;
         char file_path[768];
-        snprintf(file_path, sizeof(file_path), "%s/%s", user_dir, entry->d_name);
-        
-        struct stat file_stat;
-        if (stat(file_path, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+        struct stat st;
+        storage_file_path(file_path, sizeof(file_path), username, entry->filename);
+        if (stat(file_path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            entry->status = BATCH_NOT_FOUND;
             continue;
         }
-        
-      
-        file_metadata_t *metadata = load_file_metadata(username, entry->d_name);
-        
-        
-        char time_str[32];
+        // Release the original size if metadata exists, else the stored size
+        entry->size = (size_t)st.st_size;
+        file_metadata_t *meta = load_file_metadata(username, entry->filename);
+        if (meta) { entry->size = meta->file_size; destroy_file_metadata(meta); }
+
+        journal_record_t *rec = &entry->rec;
+        memset(rec, 0, sizeof(*rec));
+        rec->op = JOURNAL_DELETE;
+        rec->seq = journal_next_seq();
+        strncpy(rec->username, username, MAX_USERNAME - 1);
+        strncpy(rec->metadata.filename, entry->filename, MAX_FILENAME - 1);
+        used = used >= entry->size ? used - entry->size : 0;
+        rec->quota_used = used;
+        batch[accepted++] = entry;
+    }
+    int rc = commit_entries_locked(username, batch, accepted, used);
+    pthread_mutex_unlock(m);
+
+    int deleted = 0;
+    for (int i = 0; i < accepted; i++) {
+        if (rc != 0) {
+            batch[i]->status = BATCH_FAILED;
+        } else if (batch[i]->status == BATCH_OK) {
+            deleted++;
+        }
+    }
+    free(batch);
+    return rc == 0 ? deleted : -1;
+}
+
+// One verification pass; see verify_stored_file
+static int verify_once(const char *username, const char *filename, size_t *bytes_read) {
+    file_metadata_t *metadata = load_file_metadata(username, filename);
+    if (!metadata) return -1;
+    if (strcmp(metadata->checksum, "-") == 0) {
+        destroy_file_metadata(metadata);
+        return -1;
+    }
+
+    char *data = NULL;
+    size_t size = 0;
+    if (load_file_from_storage(username, filename, &data, &size) != 0) {
+        destroy_file_metadata(metadata);
+        // Present but undecodable counts as corrupt; gone does not
+        char file_path[768];
+        struct stat st;
+        storage_file_path(file_path, sizeof(file_path), username, filename);
+        return stat(file_path, &st) == 0 ? 1 : -1;
+    }
+    *bytes_read += size;
+
+    int result = 1;
+    if (size == metadata->file_size && metadata->chunk_size > 0) {
+        // Chunked files are checked chunk by chunk, in parallel
+        result = merkle_verify_range(metadata, data, 0, size) == 0 ? 0 : 1;
+    } else if (size == metadata->file_size) {
+        char *checksum = calculate_sha256(data, size);
+        if (checksum && strcmp(checksum, metadata->checksum) == 0) result = 0;
+        free(checksum);
+    }
+    free(data);
+    destroy_file_metadata(metadata);
+    return result;
+}
+
+// Move a corrupt file and its metadata to storage/.quarantine/<user>/ and
+// drop it from the user's view with a journaled delete (releasing quota).
+// Caller holds the file lock and the user's mutex.
+static int quarantine_locked(const char *username, const char *filename) {
+    char quarantine_dir[512];
+    snprintf(quarantine_dir, sizeof(quarantine_dir), "storage/%s", QUARANTINE_DIR);
+    struct stat st;
+    if (stat(quarantine_dir, &st) == -1 && mkdir(quarantine_dir, 0700) != 0) return -1;
+    snprintf(quarantine_dir, sizeof(quarantine_dir), "storage/%s/%s", QUARANTINE_DIR, username);
+    if (stat(quarantine_dir, &st) == -1 && mkdir(quarantine_dir, 0700) != 0) return -1;
+
+    char file_path[768], meta_path[1024], target[1024], target_meta[1100];
+    storage_file_path(file_path, sizeof(file_path), username, filename);
+    snprintf(meta_path, sizeof(meta_path), "%s%s", file_path, METADATA_FILE_SUFFIX);
+    snprintf(target, sizeof(target), "%s/%s.%ld", quarantine_dir, filename, (long)time(NULL));
+    snprintf(target_meta, sizeof(target_meta), "%s%s", target, METADATA_FILE_SUFFIX);
+
+    size_t file_size = 0;
+    file_metadata_t *metadata = load_file_metadata(username, filename);
+    if (metadata) { file_size = metadata->file_size; destroy_file_metadata(metadata); }
+
+    journal_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.op = JOURNAL_DELETE;
+    rec.seq = journal_next_seq();
+    strncpy(rec.username, username, MAX_USERNAME - 1);
+    strncpy(rec.metadata.filename, filename, MAX_FILENAME - 1);
+    user_quota_t quota; load_user_quota(username, &quota);
+    rec.quota_used = quota.used_bytes >= file_size ? quota.used_bytes - file_size : 0;
+
+    // The delete is committed before anything moves, so a failed append
+    // leaves the file where the index, quota and change log expect it.
+    // Once committed it is applied even if the move fails; the corrupt
+    // blob is then deleted rather than kept for inspection.
+    if (journal_append(&rec) != 0) return -1;
+    int moved = rename(file_path, target) == 0;
+    if (!moved) perror("Failed to move corrupt file to quarantine");
+    if (moved) rename(meta_path, target_meta);
+    int res = storage_apply_journal_record(&rec);
+    journal_applied();
+    return moved ? res : -1;
+}
+
+// Recompute a stored file's SHA-256 and compare it with its metadata.
+// Returns 0 if intact, 1 if corrupt, -1 if it vanished, has no checksum
+// or is being written. With quarantine set, a corrupt file is moved away
+// in the same critical section that confirmed it, and *quarantined says
+// whether that worked.
+int verify_stored_file(const char *username, const char *filename, int quarantine,
+                       size_t *bytes_read, int *quarantined) {
+    if (!username || !filename || !bytes_read || !quarantined) return -1;
+    *quarantined = 0;
+    int result = verify_once(username, filename, bytes_read);
+    if (result != 1) return result;
+
+    // A concurrent overwrite can pair the old .meta with the new blob, so
+    // confirm with the file and the user locked. Holding both until the
+    // move keeps a good upload from landing in between and being
+    // quarantined in place of the corrupt file.
+    if (acquire_file_lock(username, filename) != 0) return -1;
+    pthread_mutex_t *m = get_user_mutex(username);
+    if (!m) {
+        release_file_lock(username, filename);
+        return -1;
+    }
+    pthread_mutex_lock(m);
+    result = verify_once(username, filename, bytes_read);
+    if (result == 1 && quarantine) *quarantined = quarantine_locked(username, filename) == 0;
+    pthread_mutex_unlock(m);
+    release_file_lock(username, filename);
+    return result;
+}
+
+// Listings are formatted into one fixed buffer that is handed to the sink
+// whenever the next row might not fit, so memory stays at
+// LIST_STREAM_BUFFER however many rows are listed
+typedef struct {
+    list_sink_fn sink;
+    void *arg;
+    char *buf;
+    size_t len;
+    int failed;
+} list_writer_t;
+
+#define LIST_ROW_MAX (MAX_FILENAME + 64)
+
+static void list_flush(list_writer_t *w) {
+    if (w->len > 0 && !w->failed && w->sink(w->buf, w->len, w->arg) != 0) w->failed = 1;
+    w->len = 0;
+}
+
+// Make room for one row or header line
+static char* list_reserve(list_writer_t *w) {
+    if (LIST_STREAM_BUFFER - w->len < LIST_ROW_MAX) list_flush(w);
+    return w->buf + w->len;
+}
+
+static void list_header(list_writer_t *w, const char *username) {
+    char *p = list_reserve(w);
+    w->len += snprintf(p, LIST_STREAM_BUFFER - w->len,
+                       "=== File Listing for %s ===\n\n"
+                       "%-30s %-10s %-20s\n"
+                       "%-30s %-10s %-20s\n",
+                       username,
+                       "Filename", "Size", "Modified",
+                       "--------", "----", "--------");
+}
+
+static void list_row(list_writer_t *w, const char *name, size_t size, time_t modified) {
+    char time_str[LOCAL_TIME_LEN + 1];
+    format_local_time(modified, time_str);
+    char *p = list_reserve(w);
+    w->len += snprintf(p, LIST_STREAM_BUFFER - w->len, "%-30s %-10zu %-20s\n", name, size, time_str);
+}
+
+static void list_text(list_writer_t *w, const char *text) {
+    char *p = list_reserve(w);
+    w->len += snprintf(p, LIST_STREAM_BUFFER - w->len, "%s", text);
+}
+
+typedef struct {
+    const char *username;
+    const char *prefix;
+    list_writer_t *writer;
+} listing_t;
+
+// Write the blobs of one shard directory to a listing
+static int list_shard_dir(const char *dir_path, DIR *dir, void *arg) {
+    listing_t *listing = (listing_t *)arg;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && !listing->writer->failed) {
+        if (entry->d_name[0] == '.') continue;
+        if (strstr(entry->d_name, METADATA_FILE_SUFFIX)) continue;
+        if (strncmp(entry->d_name, listing->prefix, strlen(listing->prefix)) != 0) continue;
+
+        char file_path[1024];
+        snprintf(file_path, sizeof(file_path), "%s/%s", dir_path, entry->d_name);
+        struct stat file_stat;
+        if (stat(file_path, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) continue;
+
+        file_metadata_t *metadata = load_file_metadata(listing->username, entry->d_name);
         time_t mod_time = metadata ? metadata->modified_time : file_stat.st_mtime;
-        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&mod_time));
-        
-       
-        size_t needed = strlen(entry->d_name) + 100; 
-        if (current_pos + needed >= buffer_size) {
-            buffer_size *= 2;
-            char *new_list = realloc(list, buffer_size);
-            if (!new_list) {
-                free(list);
-                closedir(dir);
-                if (metadata) destroy_file_metadata(metadata);
-                return -1;
+        size_t display_size = metadata ? metadata->file_size : (size_t)file_stat.st_size;
+        destroy_file_metadata(metadata);
+        list_row(listing->writer, entry->d_name, display_size, mod_time);
+    }
+    return listing->writer->failed ? -1 : 0;
+}
+
+// Stream one page of the index listing: rows are copied out LIST_BATCH_ROWS
+// at a time, each batch resuming after the last row of the one before
+static int list_from_index(const char *username, const list_query_t *query, list_writer_t *w) {
+    list_row_t *rows = malloc(LIST_BATCH_ROWS * sizeof(list_row_t));
+    if (!rows) return -1;
+    char cursor[sizeof(query->cursor)];
+    strcpy(cursor, query->cursor);
+    size_t remaining = query->limit > 0 ? query->limit : LIST_DEFAULT_LIMIT;
+    int more = 0, first = 1, rc = 0;
+
+    while (remaining > 0 && !w->failed) {
+        size_t batch = remaining < LIST_BATCH_ROWS ? remaining : LIST_BATCH_ROWS;
+        int n = storage_index_rows(username, query, cursor, rows, batch, &more);
+        if (n < 0) {
+            rc = first ? n : -1;
+            break;
+        }
+        if (first) {
+            if (n == 0) {
+                list_text(w, "No files found.\n");
+                break;
             }
-            list = new_list;
+            list_header(w, username);
+            first = 0;
         }
-        
-        // Remove previous unconditional print; compute size to display (prefer metadata)
-        size_t display_size = file_stat.st_size;
-        if (metadata) display_size = metadata->file_size;
-        current_pos += snprintf(list + current_pos, buffer_size - current_pos,
-                              "%-30s %-10zu %-20s\n",
-                              entry->d_name,
-                              display_size,
-                              time_str);
-        if (metadata) { destroy_file_metadata(metadata); metadata = NULL; }
-        // Continue loop
-        continue;
+        for (int i = 0; i < n; i++) list_row(w, rows[i].name, rows[i].size, rows[i].modified);
+        remaining -= (size_t)n;
+        if (!more) break;
+        storage_index_cursor(cursor, sizeof(cursor), query->sort, &rows[n - 1]);
     }
-    
-    closedir(dir);
-    
-    if (current_pos == 0) {
-        strcpy(list, "No files found.\n");
-        current_pos = strlen(list);
+    if (rc == 0 && more) {
+        char line[sizeof(cursor) + 32];
+        snprintf(line, sizeof(line), "Next cursor: %s\n", cursor);
+        list_text(w, line);
     }
-    
-    *file_list = list;
-    *list_size = current_pos;
-    
-    return 0;
+    free(rows);
+    return rc;
+}
+
+// List a user's files, handing the formatted text to sink in pieces of at
+// most LIST_STREAM_BUFFER bytes; query NULL means the first page in name
+// order. Returns -2 for a cursor that does not fit the query and -1 on
+// any other failure, including the sink giving up.
+int list_user_files(const char *username, const list_query_t *query, list_sink_fn sink, void *arg) {
+    if (!username || !sink) return -1;
+    list_query_t defaults;
+    if (!query) {
+        memset(&defaults, 0, sizeof(defaults));
+        defaults.limit = LIST_DEFAULT_LIMIT;
+        query = &defaults;
+    }
+    list_writer_t writer = { sink, arg, malloc(LIST_STREAM_BUFFER), 0, 0 };
+    if (!writer.buf) return -1;
+
+    // Served from the in-memory index once the startup scan has built it
+    int rc = list_from_index(username, query, &writer);
+    if (rc == -1 && writer.len == 0 && !writer.failed) {
+        // Standalone tools: walk the user's shard directories. Only the
+        // prefix applies; the listing is complete and in directory order.
+        char user_dir[512];
+        struct stat st;
+        snprintf(user_dir, sizeof(user_dir), "storage/%s", username);
+        rc = 0;
+        if (stat(user_dir, &st) != 0) {
+            list_text(&writer, "No files found.\n");
+        } else {
+            listing_t listing = { username, query->prefix, &writer };
+            list_header(&writer, username);
+            rc = storage_walk_user(username, list_shard_dir, &listing);
+        }
+    }
+    list_flush(&writer);
+    free(writer.buf);
+    if (writer.failed) return -1;
+    return rc;
 }
 
 
 int save_file_metadata(const char *username, const file_metadata_t *metadata) {
     if (!username || !metadata) return -1;
     
-    char meta_path[768];
-    snprintf(meta_path, sizeof(meta_path), "storage/%s/%s%s", 
-             username, metadata->filename, METADATA_FILE_SUFFIX);
+    char file_path[768], meta_path[1024];
+    storage_file_path(file_path, sizeof(file_path), username, metadata->filename);
+    snprintf(meta_path, sizeof(meta_path), "%s%s", file_path, METADATA_FILE_SUFFIX);
 
-    char buf[1024];
-    int len = snprintf(buf, sizeof(buf), "%s\n%zu\n%ld\n%ld\n%s\n",
-            metadata->filename,
-            metadata->file_size,
-            metadata->created_time,
-            metadata->modified_time,
-            metadata->checksum);
-    if (len < 0 || (size_t)len >= sizeof(buf)) return -1;
+    size_t len = 0;
+    char *buf = format_metadata(metadata, &len);
+    if (!buf) return -1;
 
     // protect per-user metadata writes
     pthread_mutex_t *m = get_user_mutex(username);
     if (m) pthread_mutex_lock(m);
-    int res = atomic_write_file(meta_path, buf, (size_t)len);
+    int res = atomic_write_file(meta_path, buf, len);
     if (m) pthread_mutex_unlock(m);
+    free(buf);
     return res;
 }
 
+static int hex_to_digest(const char *hex, unsigned char *digest) {
+    for (int i = 0; i < SHA256_DIGEST_BYTES; i++) {
+        unsigned int byte;
+        if (sscanf(hex + i * 2, "%2x", &byte) != 1) return -1;
+        digest[i] = (unsigned char)byte;
+    }
+    return 0;
+}
+
+// Read the optional chunk tree after the fixed .meta lines. A tree that is
+// incomplete or no longer matches its root is dropped, leaving the file to
+// be checked against the flat checksum alone.
+static void load_chunk_tree(FILE *file, file_metadata_t *metadata) {
+    size_t chunk_size = 0;
+    if (fscanf(file, "%zu %64s\n", &chunk_size, metadata->merkle_root) != 2 || chunk_size == 0) return;
+    size_t count = (metadata->file_size + chunk_size - 1) / chunk_size;
+    if (count < 2 || count > (size_t)INT32_MAX / SHA256_DIGEST_BYTES) return;
+
+    unsigned char *leaves = malloc(count * SHA256_DIGEST_BYTES);
+    if (!leaves) return;
+    char hex[SHA256_DIGEST_BYTES * 2 + 1];
+    for (size_t i = 0; i < count; i++) {
+        if (fscanf(file, "%64s\n", hex) != 1 || strlen(hex) != SHA256_DIGEST_BYTES * 2 ||
+            hex_to_digest(hex, leaves + i * SHA256_DIGEST_BYTES) != 0) {
+            free(leaves);
+            return;
+        }
+    }
+    metadata->chunk_size = chunk_size;
+    metadata->chunk_count = (int)count;
+    metadata->chunk_hashes = leaves;
+    if (merkle_check_root(metadata) != 0) {
+        merkle_release(metadata);
+        metadata->chunk_size = 0;
+        metadata->chunk_count = 0;
+    }
+}
+
 file_metadata_t* load_file_metadata(const char *username, const char *filename) {
     if (!username || !filename) return NULL;
     
-    char meta_path[768];
-    snprintf(meta_path, sizeof(meta_path), "storage/%s/%s%s", 
-             username, filename, METADATA_FILE_SUFFIX);
+    char file_path[768], meta_path[1024];
+    storage_file_path(file_path, sizeof(file_path), username, filename);
+    snprintf(meta_path, sizeof(meta_path), "%s%s", file_path, METADATA_FILE_SUFFIX);
     
     FILE *file = fopen(meta_path, "r");
     if (!file) return NULL;
@@ -420,6 +1037,7 @@ file_metadata_t* load_file_metadata(const char *username, const char *filename)
         return NULL;
     }
     
+    memset(metadata, 0, sizeof(*metadata));
     if (fscanf(file, "%255s\n%zu\n%ld\n%ld\n%64s\n",
                metadata->filename,
                &metadata->file_size,
@@ -430,6 +1048,14 @@ file_metadata_t* load_file_metadata(const char *username, const char *filename)
         fclose(file);
         return NULL;
     }
+    // Optional lines: the blob codec, then the chunk tree
+    char codec[16];
+    long pos = ftell(file);
+    if (fscanf(file, "codec %15s\n", codec) != 1 || parse_storage_codec(codec, &metadata->codec) != 0) {
+        metadata->codec = CODEC_BASE64;
+        fseek(file, pos, SEEK_SET);
+    }
+    load_chunk_tree(file, metadata);
     
     fclose(file);
     return metadata;
@@ -437,6 +1063,7 @@ file_metadata_t* load_file_metadata(const char *username, const char *filename)
 
 void destroy_file_metadata(file_metadata_t *metadata) {
     if (metadata) {
+        merkle_release(metadata);
         free(metadata);
     }
 }
@@ -0,0 +1,357 @@
+#include "dropbox_server.h"
+
+// Write-ahead journal for uploads and deletes.
+//
+// Each operation is one logical transaction covering the blob, its .meta
+// sidecar and the user's quota file, recorded as a single line appended to
+// storage/.journal:
+//
+//   U <seq> <user> <file> <size> <created> <modified> <sha256> <quota_used> <chunk_size> <root> <codec> <crc>
+//   D <seq> <user> <file> 0 0 0 - <quota_used> 0 - - <crc>
+//   C <next_seq> <crc>                      (checkpoint marker)
+//
+// The blob is written to a temp file named after the transaction's seq and
+// synced first; the record is then appended and made durable (sharing a
+// group commit with concurrent writers). Only after that are the blob
+// renamed into place and the .meta/quota files rewritten, without any
+// fsync of their own. A batch (MUPLOAD, MDELETE) flushes all its temp blobs
+// at once and appends its records in one write with one sync; each record
+// still replays on its own. On startup the last record of every file after
+// the last checkpoint is replayed, which redoes any of those steps a crash
+// interrupted; earlier records for the same file are superseded. Once the
+// journal grows past JOURNAL_CHECKPOINT_BYTES and no transaction is in
+// flight, the storage filesystem is synced and the journal truncated.
+
+#define JOURNAL_PATH "storage/.journal"
+#define JOURNAL_CHECKPOINT_BYTES (1024 * 1024)
+#define JOURNAL_LINE_MAX 1024
+
+static struct {
+    int fd;
+    unsigned long long next_seq;
+    off_t size;
+    int in_flight;               // records appended but not yet applied
+    unsigned long appended;
+    unsigned long checkpoints;
+    pthread_mutex_t mutex;
+} journal = {
+    .fd = -1,
+    .next_seq = 1,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// FNV-1a over the record text, to detect a torn final line
+static unsigned int journal_crc(const char *text, size_t len) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Append a line plus its checksum; caller holds journal.mutex
+static int journal_write_line_locked(const char *body) {
+    char line[JOURNAL_LINE_MAX];
+    size_t body_len = strlen(body);
+    int len = snprintf(line, sizeof(line), "%s %08x\n", body, journal_crc(body, body_len));
+    if (len < 0 || (size_t)len >= sizeof(line)) return -1;
+    ssize_t written = write(journal.fd, line, (size_t)len);
+    if (written != len) return -1;
+    journal.size += len;
+    return 0;
+}
+
+// Sync everything the applied records touched, then start a fresh journal
+static int journal_checkpoint_locked(void) {
+    if (durability_sync_all() != 0) return -1;
+    if (ftruncate(journal.fd, 0) != 0) {
+        perror("Failed to truncate journal");
+        return -1;
+    }
+    journal.size = 0;
+    char body[64];
+    snprintf(body, sizeof(body), "C %llu", journal.next_seq);
+    if (journal_write_line_locked(body) != 0) return -1;
+    journal.checkpoints++;
+    return durability_sync_fd(journal.fd);
+}
+
+static int parse_journal_line(char *line, journal_record_t *rec, unsigned long long *checkpoint_seq) {
+    char *crc_field = strrchr(line, ' ');
+    if (!crc_field) return -1;
+    unsigned int crc;
+    if (sscanf(crc_field + 1, "%8x", &crc) != 1) return -1;
+    if (crc != journal_crc(line, (size_t)(crc_field - line))) return -1;
+    *crc_field = '\0';
+
+    if (line[0] == 'C') {
+        return sscanf(line, "C %llu", checkpoint_seq) == 1 ? 1 : -1;
+    }
+
+    memset(rec, 0, sizeof(*rec));
+    char op;
+    // Older records stop after quota_used or after the chunk root
+    char codec[16] = "-";
+    int fields = sscanf(line, "%c %llu %49s %255s %zu %ld %ld %64s %zu %zu %64s %15s", &op, &rec->seq,
+                        rec->username, rec->metadata.filename, &rec->metadata.file_size,
+                        &rec->metadata.created_time, &rec->metadata.modified_time,
+                        rec->metadata.checksum, &rec->quota_used, &rec->metadata.chunk_size,
+                        rec->metadata.merkle_root, codec);
+    if (fields != 9 && fields != 11 && fields != 12) return -1;
+    if (strcmp(codec, "-") != 0 && parse_storage_codec(codec, &rec->metadata.codec) != 0) return -1;
+    if (op != JOURNAL_UPLOAD && op != JOURNAL_DELETE) return -1;
+    if (strcmp(rec->metadata.merkle_root, "-") == 0) {
+        rec->metadata.chunk_size = 0;
+        rec->metadata.merkle_root[0] = '\0';
+    }
+    rec->op = op;
+    return 0;
+}
+
+static int same_file(const journal_record_t *a, const journal_record_t *b) {
+    return strcmp(a->username, b->username) == 0 && strcmp(a->metadata.filename, b->metadata.filename) == 0;
+}
+
+// Replay runs single-threaded before any worker starts, so the sort can
+// reach the records through a static
+static const journal_record_t *replay_records;
+
+// Group records by user and file, in journal order within a file
+static int compare_replay_order(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    int cmp = strcmp(replay_records[x].username, replay_records[y].username);
+    if (cmp == 0) cmp = strcmp(replay_records[x].metadata.filename, replay_records[y].metadata.filename);
+    return cmp != 0 ? cmp : (x > y) - (x < y);
+}
+
+// Redo the last record of every file after the last checkpoint; stops at
+// a torn tail
+static int journal_replay(int *replayed) {
+    *replayed = 0;
+    struct stat st;
+    if (fstat(journal.fd, &st) != 0) return -1;
+    if (st.st_size == 0) return 0;
+
+    char *contents = malloc((size_t)st.st_size + 1);
+    if (!contents) return -1;
+    size_t got = 0;
+    if (lseek(journal.fd, 0, SEEK_SET) != 0) {
+        free(contents);
+        return -1;
+    }
+    while (got < (size_t)st.st_size) {
+        ssize_t n = read(journal.fd, contents + got, (size_t)st.st_size - got);
+        if (n <= 0) {
+            free(contents);
+            return -1;
+        }
+        got += (size_t)n;
+    }
+    contents[got] = '\0';
+
+    journal_record_t *recs = NULL;
+    int count = 0, cap = 0, rc = 0;
+    char *line = contents;
+    while (line && *line) {
+        char *newline = strchr(line, '\n');
+        if (!newline) break;             // incomplete last record
+        *newline = '\0';
+
+        journal_record_t rec;
+        unsigned long long checkpoint_seq = 0;
+        int kind = parse_journal_line(line, &rec, &checkpoint_seq);
+        if (kind < 0) {
+            fprintf(stderr, "Journal: ignoring damaged record and everything after it\n");
+            break;
+        }
+        if (kind == 1) {
+            if (checkpoint_seq > journal.next_seq) journal.next_seq = checkpoint_seq;
+        } else {
+            if (rec.seq >= journal.next_seq) journal.next_seq = rec.seq + 1;
+            if (count == cap) {
+                int grown_cap = cap ? cap * 2 : 64;
+                journal_record_t *grown = realloc(recs, (size_t)grown_cap * sizeof(*recs));
+                if (!grown) {
+                    rc = -1;
+                    break;
+                }
+                recs = grown;
+                cap = grown_cap;
+            }
+            recs[count++] = rec;
+        }
+        line = newline + 1;
+    }
+    free(contents);
+
+    // Only a file's last record is applied. Earlier ones would act on the
+    // blob a later record put in place: an old D unlinks the live blob and
+    // prunes its versions, an old U finds its temp blob already renamed.
+    // The last record of a user also carries the user's final quota.
+    char *superseded = rc == 0 && count > 0 ? calloc((size_t)count, 1) : NULL;
+    int *order = superseded ? malloc((size_t)count * sizeof(int)) : NULL;
+    if (count > 0 && !order) rc = -1;
+    if (rc == 0 && count > 0) {
+        for (int i = 0; i < count; i++) order[i] = i;
+        replay_records = recs;
+        qsort(order, (size_t)count, sizeof(int), compare_replay_order);
+        for (int i = 0; i + 1 < count; i++) {
+            superseded[order[i]] = same_file(&recs[order[i]], &recs[order[i + 1]]);
+        }
+        for (int i = 0; i < count; i++) {
+            if (superseded[i]) continue;
+            if (storage_apply_journal_record(&recs[i]) != 0) {
+                fprintf(stderr, "Journal: failed to replay %c record for %s/%s\n",
+                        recs[i].op, recs[i].username, recs[i].metadata.filename);
+            }
+            (*replayed)++;
+        }
+    }
+    free(order);
+    free(superseded);
+    free(recs);
+    return rc;
+}
+
+// Open the journal, replay it and checkpoint. Must run before any worker
+// touches storage.
+int journal_open(void) {
+    struct stat st;
+    if (stat("storage", &st) == -1 && mkdir("storage", 0700) != 0) {
+        perror("Failed to create storage directory");
+        return -1;
+    }
+    journal.fd = open(JOURNAL_PATH, O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (journal.fd < 0) {
+        perror("Failed to open journal");
+        return -1;
+    }
+
+    int replayed = 0;
+    if (journal_replay(&replayed) != 0) {
+        fprintf(stderr, "Failed to read journal\n");
+        close(journal.fd);
+        journal.fd = -1;
+        return -1;
+    }
+
+    pthread_mutex_lock(&journal.mutex);
+    int rc = journal_checkpoint_locked();
+    pthread_mutex_unlock(&journal.mutex);
+    if (rc != 0) {
+        fprintf(stderr, "Failed to checkpoint journal\n");
+        close(journal.fd);
+        journal.fd = -1;
+        return -1;
+    }
+    printf("Journal opened: replayed %d record(s), next seq %llu\n", replayed, journal.next_seq);
+    return 0;
+}
+
+void journal_close(void) {
+    if (journal.fd < 0) return;
+    pthread_mutex_lock(&journal.mutex);
+    if (journal.in_flight == 0) journal_checkpoint_locked();
+    close(journal.fd);
+    journal.fd = -1;
+    pthread_mutex_unlock(&journal.mutex);
+}
+
+int journal_is_open(void) {
+    return journal.fd >= 0;
+}
+
+unsigned long long journal_next_seq(void) {
+    pthread_mutex_lock(&journal.mutex);
+    unsigned long long seq = journal.next_seq++;
+    pthread_mutex_unlock(&journal.mutex);
+    return seq;
+}
+
+// Render a record's line, checksum included
+static int format_record_line(const journal_record_t *rec, char *line, size_t size) {
+    char body[JOURNAL_LINE_MAX - 16];
+    int chunked = rec->metadata.chunk_size > 0 && rec->metadata.merkle_root[0];
+    int len = snprintf(body, sizeof(body), "%c %llu %s %s %zu %ld %ld %s %zu %zu %s %s",
+                       rec->op, rec->seq, rec->username, rec->metadata.filename,
+                       rec->metadata.file_size, (long)rec->metadata.created_time,
+                       (long)rec->metadata.modified_time,
+                       rec->metadata.checksum[0] ? rec->metadata.checksum : "-", rec->quota_used,
+                       chunked ? rec->metadata.chunk_size : 0, chunked ? rec->metadata.merkle_root : "-",
+                       rec->op == JOURNAL_UPLOAD ? storage_codec_name(rec->metadata.codec) : "-");
+    if (len < 0 || (size_t)len >= sizeof(body)) return -1;
+    len = snprintf(line, size, "%s %08x\n", body, journal_crc(body, (size_t)len));
+    return len < 0 || (size_t)len >= size ? -1 : len;
+}
+
+// Append a record and wait until it is durable. On success the caller
+// must apply the record and then call journal_applied().
+int journal_append(const journal_record_t *rec) {
+    if (!rec) return -1;
+    journal_record_t *const recs[1] = { (journal_record_t *)rec };
+    return journal_append_batch(recs, 1);
+}
+
+// Append several records with one write and one sync. On success the
+// caller must apply them all and call journal_applied() once per record.
+int journal_append_batch(journal_record_t *const *recs, int count) {
+    if (!recs || count <= 0) return -1;
+    if (journal.fd < 0) return 0;        // not journaling (e.g. standalone tools)
+
+    char *lines = malloc((size_t)count * JOURNAL_LINE_MAX);
+    if (!lines) return -1;
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        int len = format_record_line(recs[i], lines + total, JOURNAL_LINE_MAX);
+        if (len < 0) {
+            free(lines);
+            return -1;
+        }
+        total += (size_t)len;
+    }
+
+    pthread_mutex_lock(&journal.mutex);
+    int fd = journal.fd;
+    int rc = write(journal.fd, lines, total) == (ssize_t)total ? 0 : -1;
+    if (rc == 0) {
+        journal.size += (off_t)total;
+        journal.in_flight += count;
+        journal.appended += (unsigned long)count;
+    }
+    pthread_mutex_unlock(&journal.mutex);
+    free(lines);
+    if (rc != 0) {
+        perror("Failed to append journal record");
+        return -1;
+    }
+
+    // Outside the lock so concurrent appenders share one group commit
+    if (durability_sync_fd(fd) != 0) {
+        perror("Failed to sync journal");
+        for (int i = 0; i < count; i++) journal_applied();
+        return -1;
+    }
+    return 0;
+}
+
+// Transaction finished; checkpoint when the journal is large and idle
+void journal_applied(void) {
+    if (journal.fd < 0) return;
+    pthread_mutex_lock(&journal.mutex);
+    if (journal.in_flight > 0) journal.in_flight--;
+    if (journal.in_flight == 0 && journal.size > JOURNAL_CHECKPOINT_BYTES) {
+        if (journal_checkpoint_locked() != 0) {
+            fprintf(stderr, "Journal checkpoint failed; will retry\n");
+        }
+    }
+    pthread_mutex_unlock(&journal.mutex);
+}
+
+void format_journal_stats(char *buffer, size_t buffer_size) {
+    if (!buffer || buffer_size == 0) return;
+    pthread_mutex_lock(&journal.mutex);
+    snprintf(buffer, buffer_size, "[journal] records=%lu checkpoints=%lu size=%lld in_flight=%d\n",
+             journal.appended, journal.checkpoints, (long long)journal.size, journal.in_flight);
+    pthread_mutex_unlock(&journal.mutex);
+}
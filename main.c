@@ -2,8 +2,6 @@
 
 // Global server context for signal handling
 server_context_t *g_server_context = NULL;
-// runtime-overridable port
-int g_server_port = PORT;
 
 // Signal handler for graceful shutdown
 void signal_handler(int signum) {
@@ -25,27 +23,24 @@ void cleanup_server(server_context_t *server) {
     // Wait for client threads to finish
     if (server->client_threads) {
         printf("Waiting for client threads to finish...\n");
-        for (int i = 0; i < CLIENT_THREADPOOL_SIZE; i++) {
+        for (int i = 0; i < g_config.client_threads; i++) {
             pthread_join(server->client_threads[i], NULL);
         }
         free(server->client_threads);
     }
     
-    // Send shutdown tasks to worker threads and wait for them to finish
-    if (server->worker_threads && server->task_queue) {
-        printf("Sending shutdown signals to worker threads...\n");
-        for (int i = 0; i < WORKER_THREADPOOL_SIZE; i++) {
-            task_t *shutdown_task = create_task(TASK_SHUTDOWN, -1, "system", "SHUTDOWN");
-            if (shutdown_task) {
-                enqueue_task(server->task_queue, shutdown_task);
-            }
-        }
-        
-        printf("Waiting for worker threads to finish...\n");
-        for (int i = 0; i < WORKER_THREADPOOL_SIZE; i++) {
-            pthread_join(server->worker_threads[i], NULL);
+    // Stop feeding scrub tasks before the pools go away
+    scrubber_stop();
+    
+    // Close parked WATCH connections; the client threads are gone
+    watch_stop();
+    
+    // Stop each lane's pool controller and wait for its workers to finish
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        if (server->worker_pools[lane]) {
+            destroy_worker_pool(server->worker_pools[lane]);
+            server->worker_pools[lane] = NULL;
         }
-        free(server->worker_threads);
     }
     
     // Close server socket
@@ -57,10 +52,20 @@ void cleanup_server(server_context_t *server) {
     if (server->client_queue) {
         destroy_client_queue(server->client_queue);
     }
-    if (server->task_queue) {
-        destroy_task_queue(server->task_queue);
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        if (server->task_queues[lane]) {
+            destroy_task_queue(server->task_queues[lane]);
+        }
     }
     
+    // Checkpoint the journal, then flush any writes still waiting on a group commit
+    journal_close();
+    credentials_close();
+    session_tokens_clear();
+    changes_clear();
+    durability_shutdown();
+    storage_index_destroy();
+
     // Cleanup per-user mutexes and other global resources
     cleanup_user_mutexes();
 
@@ -71,8 +76,13 @@ void cleanup_server(server_context_t *server) {
     printf("Server cleanup completed\n");
 }
 
-// Initialize server
-server_context_t* init_server() {
+// Initialize server: parse runtime configuration, then size queues and pools from it
+server_context_t* init_server(int argc, char **argv) {
+    if (load_server_config(&g_config, argc, argv) != 0) {
+        fprintf(stderr, "Invalid server configuration\n");
+        return NULL;
+    }
+
     server_context_t *server = malloc(sizeof(server_context_t));
     if (!server) {
         perror("Failed to allocate server context");
@@ -81,9 +91,11 @@ server_context_t* init_server() {
     
     // Initialize fields
     server->client_queue = NULL;
-    server->task_queue = NULL;
     server->client_threads = NULL;
-    server->worker_threads = NULL;
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        server->task_queues[lane] = NULL;
+        server->worker_pools[lane] = NULL;
+    }
     server->server_socket = -1;
     server->shutdown_flag = 0;
     
@@ -94,55 +106,107 @@ server_context_t* init_server() {
         return NULL;
     }
     
-    // Create client queue
-    server->client_queue = create_client_queue(QUEUE_SIZE);
-    if (!server->client_queue) {
+    // Start the durability layer before anything can write to storage
+    if (durability_init() != 0) {
         cleanup_server(server);
         return NULL;
     }
     
-    // Create task queue
-    server->task_queue = create_task_queue(QUEUE_SIZE);
-    if (!server->task_queue) {
+    // Load every account so logins never touch the filesystem
+    if (credentials_load() != 0) {
         cleanup_server(server);
         return NULL;
     }
     
-    // Allocate thread arrays
-    server->client_threads = malloc(CLIENT_THREADPOOL_SIZE * sizeof(pthread_t));
-    if (!server->client_threads) {
-        perror("Failed to allocate client threads array");
+    // Move files of a pre-sharding tree into place before replay looks for them
+    if (storage_migrate_all() != 0) {
+        fprintf(stderr, "Warning: some files could not be moved to the sharded layout\n");
+    }
+    
+    // Replay any transactions a crash left half-applied
+    if (journal_open() != 0) {
         cleanup_server(server);
         return NULL;
     }
     
-    server->worker_threads = malloc(WORKER_THREADPOOL_SIZE * sizeof(pthread_t));
-    if (!server->worker_threads) {
-        perror("Failed to allocate worker threads array");
+    // Log changes from here on; users touched by replay start a new change log
+    changes_init();
+    
+    // Rebuild the file index, reconcile quotas and drop stale temp files
+    // before the listener exists, so no request sees a half-built index
+    if (storage_index_build(g_config.startup_scan_threads) != 0) {
+        fprintf(stderr, "Warning: startup scan could not reconcile every user\n");
+    }
+    
+    // Create client queue
+    server->client_queue = create_client_queue(g_config.queue_size);
+    if (!server->client_queue) {
         cleanup_server(server);
         return NULL;
     }
     
-    // Create client thread pool
-    printf("Creating client thread pool (%d threads)...\n", CLIENT_THREADPOOL_SIZE);
-    for (int i = 0; i < CLIENT_THREADPOOL_SIZE; i++) {
-        if (pthread_create(&server->client_threads[i], NULL, client_thread_function, server) != 0) {
-            perror("Failed to create client thread");
+    // Create one task queue per worker lane
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        server->task_queues[lane] = create_task_queue(g_config.queue_size);
+        if (!server->task_queues[lane]) {
             cleanup_server(server);
             return NULL;
         }
     }
     
-    // Create worker thread pool
-    printf("Creating worker thread pool (%d threads)...\n", WORKER_THREADPOOL_SIZE);
-    for (int i = 0; i < WORKER_THREADPOOL_SIZE; i++) {
-        if (pthread_create(&server->worker_threads[i], NULL, worker_thread_function, server) != 0) {
-            perror("Failed to create worker thread");
+    // Allocate thread arrays
+    server->client_threads = malloc(g_config.client_threads * sizeof(pthread_t));
+    if (!server->client_threads) {
+        perror("Failed to allocate client threads array");
+        cleanup_server(server);
+        return NULL;
+    }
+    
+    // Create client thread pool
+    printf("Creating client thread pool (%d threads)...\n", g_config.client_threads);
+    for (int i = 0; i < g_config.client_threads; i++) {
+        if (pthread_create(&server->client_threads[i], NULL, client_thread_function, server) != 0) {
+            perror("Failed to create client thread");
             cleanup_server(server);
             return NULL;
         }
     }
     
+    // Create an adaptive worker pool per lane, sized independently
+    printf("Creating metadata worker pool (%d-%d threads)...\n",
+           g_config.metadata_threads, g_config.metadata_threads_max);
+    server->worker_pools[LANE_METADATA] = create_worker_pool(server, server->task_queues[LANE_METADATA],
+                                                             task_lane_name(LANE_METADATA),
+                                                             g_config.metadata_threads,
+                                                             g_config.metadata_threads_max);
+    if (!server->worker_pools[LANE_METADATA]) {
+        cleanup_server(server);
+        return NULL;
+    }
+
+    printf("Creating bulk worker pool (%d-%d threads)...\n",
+           g_config.worker_threads, g_config.worker_threads_max);
+    server->worker_pools[LANE_BULK] = create_worker_pool(server, server->task_queues[LANE_BULK],
+                                                         task_lane_name(LANE_BULK),
+                                                         g_config.worker_threads,
+                                                         g_config.worker_threads_max);
+    if (!server->worker_pools[LANE_BULK]) {
+        cleanup_server(server);
+        return NULL;
+    }
+    
+    // Park idle WATCH connections off the client threads
+    if (watch_start(server) != 0) {
+        cleanup_server(server);
+        return NULL;
+    }
+    
+    // Background integrity checks on spare bulk-lane capacity
+    if (scrubber_start(server) != 0) {
+        cleanup_server(server);
+        return NULL;
+    }
+    
     printf("Server initialized successfully\n");
     return server;
 }
@@ -168,7 +232,7 @@ int create_server_socket() {
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(g_server_port);
+    server_addr.sin_port = htons(g_config.port);
 
     // Bind socket to address
     if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
@@ -184,7 +248,7 @@ int create_server_socket() {
         return -1;
     }
 
-    printf("Server listening on port %d\n", g_server_port);
+    printf("Server listening on port %d\n", g_config.port);
     return server_socket;
 }
 
@@ -237,19 +301,16 @@ void run_accept_loop(server_context_t *server) {
     printf("Accept loop terminated\n");
 }
 
-int main() {
+int main(int argc, char **argv) {
     printf("Starting DropBox Server...\n");
 
     // Set up signal handlers for graceful shutdown
     signal(SIGINT, signal_handler);   // Ctrl+C
     signal(SIGTERM, signal_handler);  // Termination request
+    signal(SIGPIPE, SIG_IGN);         // A vanished client must not kill the server
 
-    // Server port is fixed to PORT (defined in dropbox_server.h as 8080)
-    // We intentionally ignore any DROPBOX_PORT env to always run on the known port.
-    (void)0;
-
-    // Initialize server
-    server_context_t *server = init_server();
+    // Initialize server (reads dropbox.conf, DROPBOX_* env and CLI overrides)
+    server_context_t *server = init_server(argc, argv);
     if (!server) {
         fprintf(stderr, "Failed to initialize server\n");
         return EXIT_FAILURE;
@@ -266,12 +327,7 @@ int main() {
     }
 
     printf("DropBox Server started successfully!\n");
-    printf("Server configuration:\n");
-    printf("  Port: %d\n", g_server_port);
-    printf("  Max clients: %d\n", MAX_CLIENTS);
-    printf("  Client thread pool size: %d\n", CLIENT_THREADPOOL_SIZE);
-    printf("  Worker thread pool size: %d\n", WORKER_THREADPOOL_SIZE);
-    printf("  Queue capacity: %d\n", QUEUE_SIZE);
+    print_server_config(&g_config);
 
     // Run main accept loop
     run_accept_loop(server);
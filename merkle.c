@@ -0,0 +1,164 @@
+#include "dropbox_server.h"
+
+// Chunk trees for large files. A file larger than MERKLE_CHUNK_SIZE is cut
+// into fixed-size chunks whose SHA-256 digests are the leaves; each level
+// above hashes adjacent pairs of digests (an odd one out moves up as is)
+// until one root remains. Leaves and root live in the file's .meta next to
+// the flat checksum, so:
+//   - the chunks of one file are hashed on up to hash_threads cores
+//   - a chunk-aligned byte range is verified against just the chunks it
+//     covers, without rehashing the rest of the file
+
+typedef struct {
+    const char *data;            // first byte of the first chunk
+    size_t length;               // bytes from data to the end of the range
+    size_t chunk_size;
+    int first;                   // chunk indexes [first, last) of this job
+    int last;
+    unsigned char *out;          // one digest per chunk, indexed from 0
+    int failed;
+} chunk_job_t;
+
+static void* hash_chunk_job(void *arg) {
+    chunk_job_t *job = (chunk_job_t *)arg;
+    for (int i = job->first; i < job->last && !job->failed; i++) {
+        size_t offset = (size_t)i * job->chunk_size;
+        size_t len = job->length - offset < job->chunk_size ? job->length - offset : job->chunk_size;
+        if (sha256_raw(job->data + offset, len, job->out + (size_t)i * SHA256_DIGEST_BYTES) != 0) {
+            job->failed = 1;
+        }
+    }
+    return NULL;
+}
+
+// Hash count consecutive chunks starting at data, splitting them into
+// contiguous runs across threads; the caller's thread takes the first run
+static int hash_chunks(const char *data, size_t length, size_t chunk_size, int count, unsigned char *out) {
+    int threads = g_config.hash_threads > 0 ? g_config.hash_threads : 1;
+    if (threads > count) threads = count;
+    if (threads > 64) threads = 64;
+
+    chunk_job_t jobs[64];
+    pthread_t tids[64];
+    int started[64] = {0};
+    for (int t = 0; t < threads; t++) {
+        jobs[t].data = data;
+        jobs[t].length = length;
+        jobs[t].chunk_size = chunk_size;
+        jobs[t].first = (int)((long long)count * t / threads);
+        jobs[t].last = (int)((long long)count * (t + 1) / threads);
+        jobs[t].out = out;
+        jobs[t].failed = 0;
+    }
+    for (int t = 1; t < threads; t++) {
+        started[t] = pthread_create(&tids[t], NULL, hash_chunk_job, &jobs[t]) == 0;
+    }
+    hash_chunk_job(&jobs[0]);
+
+    int failed = jobs[0].failed;
+    for (int t = 1; t < threads; t++) {
+        if (started[t]) {
+            pthread_join(tids[t], NULL);
+        } else {
+            hash_chunk_job(&jobs[t]);    // could not spawn; do it here
+        }
+        failed |= jobs[t].failed;
+    }
+    return failed ? -1 : 0;
+}
+
+static int merkle_root(const unsigned char *leaves, int count, unsigned char *root) {
+    if (count <= 0) return -1;
+    unsigned char *level = malloc((size_t)count * SHA256_DIGEST_BYTES);
+    if (!level) return -1;
+    memcpy(level, leaves, (size_t)count * SHA256_DIGEST_BYTES);
+
+    int n = count;
+    while (n > 1) {
+        int next = 0;
+        for (int i = 0; i < n; i += 2, next++) {
+            unsigned char *dst = level + (size_t)next * SHA256_DIGEST_BYTES;
+            const unsigned char *left = level + (size_t)i * SHA256_DIGEST_BYTES;
+            if (i + 1 < n) {
+                // Children are consecutive, so one 64-byte hash covers the pair
+                if (sha256_raw(left, 2 * SHA256_DIGEST_BYTES, dst) != 0) {
+                    free(level);
+                    return -1;
+                }
+            } else {
+                memmove(dst, left, SHA256_DIGEST_BYTES);
+            }
+        }
+        n = next;
+    }
+    memcpy(root, level, SHA256_DIGEST_BYTES);
+    free(level);
+    return 0;
+}
+
+// Fill in the chunk tree of metadata for data; files of at most one chunk
+// get none. The caller frees it with merkle_release.
+int merkle_build(const char *data, size_t size, file_metadata_t *metadata) {
+    if (!metadata || (!data && size > 0)) return -1;
+    metadata->chunk_size = 0;
+    metadata->chunk_count = 0;
+    metadata->merkle_root[0] = '\0';
+    metadata->chunk_hashes = NULL;
+    if (size <= MERKLE_CHUNK_SIZE) return 0;
+
+    int count = (int)((size + MERKLE_CHUNK_SIZE - 1) / MERKLE_CHUNK_SIZE);
+    unsigned char *leaves = malloc((size_t)count * SHA256_DIGEST_BYTES);
+    if (!leaves) return -1;
+    unsigned char root[SHA256_DIGEST_BYTES];
+    if (hash_chunks(data, size, MERKLE_CHUNK_SIZE, count, leaves) != 0 ||
+        merkle_root(leaves, count, root) != 0) {
+        free(leaves);
+        return -1;
+    }
+    metadata->chunk_size = MERKLE_CHUNK_SIZE;
+    metadata->chunk_count = count;
+    metadata->chunk_hashes = leaves;
+    sha256_to_hex(root, metadata->merkle_root);
+    return 0;
+}
+
+// Check that the stored leaves still hash to the stored root
+int merkle_check_root(const file_metadata_t *metadata) {
+    if (!metadata || metadata->chunk_size == 0 || !metadata->chunk_hashes) return -1;
+    unsigned char root[SHA256_DIGEST_BYTES];
+    char hex[SHA256_DIGEST_BYTES * 2 + 1];
+    if (merkle_root(metadata->chunk_hashes, metadata->chunk_count, root) != 0) return -1;
+    sha256_to_hex(root, hex);
+    return strcmp(hex, metadata->merkle_root) == 0 ? 0 : 1;
+}
+
+// Verify bytes [offset, offset + length) of a file held in data against the
+// chunks they cover. offset must be chunk-aligned and the range must end on
+// a chunk boundary or at the end of the file. Returns 0 if every chunk
+// matches, 1 on a mismatch, -1 if the range cannot be checked this way.
+int merkle_verify_range(const file_metadata_t *metadata, const char *data, size_t offset, size_t length) {
+    if (!metadata || !data || metadata->chunk_size == 0 || !metadata->chunk_hashes) return -1;
+    size_t chunk = metadata->chunk_size;
+    if (offset % chunk != 0 || offset + length > metadata->file_size || length == 0) return -1;
+    if ((offset + length) % chunk != 0 && offset + length != metadata->file_size) return -1;
+
+    int first = (int)(offset / chunk);
+    int count = (int)((length + chunk - 1) / chunk);
+    if (first + count > metadata->chunk_count) return -1;
+
+    unsigned char *digests = malloc((size_t)count * SHA256_DIGEST_BYTES);
+    if (!digests) return -1;
+    int result = -1;
+    if (hash_chunks(data, length, chunk, count, digests) == 0) {
+        result = memcmp(digests, metadata->chunk_hashes + (size_t)first * SHA256_DIGEST_BYTES,
+                        (size_t)count * SHA256_DIGEST_BYTES) == 0 ? 0 : 1;
+    }
+    free(digests);
+    return result;
+}
+
+void merkle_release(file_metadata_t *metadata) {
+    if (!metadata) return;
+    free(metadata->chunk_hashes);
+    metadata->chunk_hashes = NULL;
+}
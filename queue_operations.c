@@ -19,6 +19,8 @@ client_queue_t* create_client_queue(int capacity) {
     queue->rear = 0;
     queue->count = 0;
     queue->capacity = capacity;
+    queue->resumed_head = NULL;
+    queue->resumed_tail = NULL;
     
     // Initialize synchronization primitives
     if (pthread_mutex_init(&queue->mutex, NULL) != 0) {
@@ -62,6 +64,13 @@ void destroy_client_queue(client_queue_t *queue) {
         queue->front = (queue->front + 1) % queue->capacity;
         queue->count--;
     }
+    while (queue->resumed_head) {
+        watch_t *watch = queue->resumed_head;
+        queue->resumed_head = watch->next;
+        close(watch->socket);
+        free(watch);
+    }
+    queue->resumed_tail = NULL;
     pthread_mutex_unlock(&queue->mutex);
     
     // Destroy synchronization primitives
@@ -109,13 +118,17 @@ int enqueue_client(client_queue_t *queue, int socket_fd) {
     return 0;
 }
 
-int dequeue_client(client_queue_t *queue) {
-    if (!queue) return -1;
+// Take the next connection. A session the watcher hands back comes through
+// *resumed (its socket is also returned) and goes ahead of new connections,
+// which have not been admitted yet; otherwise *resumed is NULL.
+int dequeue_client(client_queue_t *queue, watch_t **resumed) {
+    if (!queue || !resumed) return -1;
+    *resumed = NULL;
 
     pthread_mutex_lock(&queue->mutex);
 
     // Wait while queue is empty
-    while (queue->count == 0) {
+    while (queue->count == 0 && !queue->resumed_head) {
         // If shutdown was signaled, return immediately
         if (g_server_context) {
             pthread_mutex_lock(&g_server_context->shutdown_mutex);
@@ -129,6 +142,16 @@ int dequeue_client(client_queue_t *queue) {
         pthread_cond_wait(&queue->not_empty, &queue->mutex);
     }
 
+    if (queue->resumed_head) {
+        watch_t *watch = queue->resumed_head;
+        queue->resumed_head = watch->next;
+        if (!queue->resumed_head) queue->resumed_tail = NULL;
+        watch->next = NULL;
+        pthread_mutex_unlock(&queue->mutex);
+        *resumed = watch;
+        return watch->socket;
+    }
+
     // Remove socket from queue
     int socket_fd = queue->sockets[queue->front];
     queue->front = (queue->front + 1) % queue->capacity;
@@ -143,7 +166,196 @@ int dequeue_client(client_queue_t *queue) {
     return socket_fd;
 }
 
+// Hand a parked session back to the client threads. Never blocks: resumed
+// sessions are bounded by WATCH_MAX_PARKED, not by the queue capacity.
+void requeue_watch(client_queue_t *queue, watch_t *watch) {
+    if (!queue || !watch) return;
+    pthread_mutex_lock(&queue->mutex);
+    watch->next = NULL;
+    if (queue->resumed_tail) {
+        queue->resumed_tail->next = watch;
+    } else {
+        queue->resumed_head = watch;
+    }
+    queue->resumed_tail = watch;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
 // Task Queue Implementation
+//
+// Tasks are grouped into priority bands (HIGH, MEDIUM, LOW). Inside a band
+// each user has a FIFO flow, and flows are served by deficit round-robin:
+// on its turn a flow may dequeue fair_quantum * weight tasks before the next
+// user's flow is served. One user flooding the queue therefore only delays
+// their own requests. Tasks that wait longer than priority_aging_ms are
+// promoted one band at a time, so LOW priority work cannot starve.
+
+// Look up a user's weight in "alice:4,bob:2" (default 1)
+static int user_weight(const char *username) {
+    const char *p = g_config.user_weights;
+    size_t name_len = strlen(username);
+    while (p && *p) {
+        while (*p == ' ' || *p == ',') p++;
+        if (strncmp(p, username, name_len) == 0 && p[name_len] == ':') {
+            int weight = atoi(p + name_len + 1);
+            return weight > 0 ? weight : 1;
+        }
+        p = strchr(p, ',');
+    }
+    return 1;
+}
+
+// Find the user's flow in a band, appending a new one if needed
+static user_flow_t* find_or_add_flow(priority_band_t *band, const char *username) {
+    for (user_flow_t *flow = band->head; flow; flow = flow->next) {
+        if (strcmp(flow->username, username) == 0) return flow;
+    }
+    user_flow_t *flow = malloc(sizeof(user_flow_t));
+    if (!flow) return NULL;
+    memset(flow, 0, sizeof(*flow));
+    strncpy(flow->username, username, MAX_USERNAME - 1);
+    if (band->tail) {
+        band->tail->next = flow;
+    } else {
+        band->head = flow;
+    }
+    band->tail = flow;
+    return flow;
+}
+
+static void unlink_flow(priority_band_t *band, user_flow_t *flow, user_flow_t *prev) {
+    if (prev) {
+        prev->next = flow->next;
+    } else {
+        band->head = flow->next;
+    }
+    if (band->tail == flow) band->tail = prev;
+    flow->next = NULL;
+}
+
+// Insert keeping the flow ordered by enqueue time (promoted tasks are older)
+static void flow_insert_task(user_flow_t *flow, task_t *task) {
+    task->next = NULL;
+    if (!flow->tail || flow->tail->enqueue_ms <= task->enqueue_ms) {
+        if (flow->tail) {
+            flow->tail->next = task;
+        } else {
+            flow->head = task;
+        }
+        flow->tail = task;
+        return;
+    }
+    task_t *prev = NULL;
+    task_t *cur = flow->head;
+    while (cur && cur->enqueue_ms <= task->enqueue_ms) {
+        prev = cur;
+        cur = cur->next;
+    }
+    task->next = cur;
+    if (prev) {
+        prev->next = task;
+    } else {
+        flow->head = task;
+    }
+}
+
+static task_t* flow_pop_task(user_flow_t *flow) {
+    task_t *task = flow->head;
+    if (!task) return NULL;
+    flow->head = task->next;
+    if (!flow->head) flow->tail = NULL;
+    task->next = NULL;
+    return task;
+}
+
+// Promote tasks that have waited too long into the next band up.
+// A task moves up one band for every priority_aging_ms it has waited.
+static void age_queued_tasks(task_queue_t *queue, long long now) {
+    int aging_ms = g_config.priority_aging_ms;
+    if (aging_ms <= 0) return;
+
+    for (int b = 1; b < MAX_PRIORITY; b++) {
+        priority_band_t *band = &queue->bands[b];
+        user_flow_t *prev = NULL;
+        user_flow_t *flow = band->head;
+        while (flow) {
+            user_flow_t *next = flow->next;
+            // Flows are FIFO, so only the head can be the oldest
+            while (flow->head) {
+                task_t *task = flow->head;
+                int original_band = task->priority - 1;
+                long long threshold = (long long)aging_ms * (original_band - b + 1);
+                if (now - task->enqueue_ms < threshold) break;
+
+                user_flow_t *upper = find_or_add_flow(&queue->bands[b - 1], task->username);
+                if (!upper) break;
+                flow_pop_task(flow);
+                task->band = b - 1;
+                flow_insert_task(upper, task);
+                queue->promoted++;
+            }
+            if (!flow->head) {
+                unlink_flow(band, flow, prev);
+                free(flow);
+            } else {
+                prev = flow;
+            }
+            flow = next;
+        }
+    }
+}
+
+// Deficit round-robin across the user flows of the highest non-empty band
+static task_t* drr_pop_task(task_queue_t *queue) {
+    for (int b = 0; b < MAX_PRIORITY; b++) {
+        priority_band_t *band = &queue->bands[b];
+        user_flow_t *flow = band->head;
+        if (!flow) continue;
+
+        if (!flow->in_turn) {
+            flow->deficit += g_config.fair_quantum * user_weight(flow->username);
+            flow->in_turn = 1;
+        }
+        task_t *task = flow_pop_task(flow);
+        flow->deficit--;
+
+        if (!flow->head) {
+            // An emptied flow gives up any remaining deficit
+            unlink_flow(band, flow, NULL);
+            free(flow);
+        } else if (flow->deficit <= 0) {
+            flow->in_turn = 0;
+            if (flow->next) {
+                unlink_flow(band, flow, NULL);
+                band->tail->next = flow;
+                band->tail = flow;
+            }
+        }
+        return task;
+    }
+    return NULL;
+}
+
+static void record_user_wait(task_queue_t *queue, const char *username, long long wait_ms) {
+    user_wait_stats_t *stats = NULL;
+    for (int i = 0; i < queue->user_stats_count; i++) {
+        if (strcmp(queue->user_stats[i].username, username) == 0) {
+            stats = &queue->user_stats[i];
+            break;
+        }
+    }
+    if (!stats) {
+        if (queue->user_stats_count >= MAX_QUEUE_USER_STATS) return;
+        stats = &queue->user_stats[queue->user_stats_count++];
+        memset(stats, 0, sizeof(*stats));
+        strncpy(stats->username, username, MAX_USERNAME - 1);
+    }
+    stats->dequeued++;
+    stats->total_wait_ms += wait_ms;
+    if (wait_ms > stats->max_wait_ms) stats->max_wait_ms = wait_ms;
+}
+
 task_queue_t* create_task_queue(int capacity) {
     task_queue_t *queue = malloc(sizeof(task_queue_t));
     if (!queue) {
@@ -151,10 +363,13 @@ task_queue_t* create_task_queue(int capacity) {
         return NULL;
     }
     
-    queue->head = NULL;
-    queue->tail = NULL;
+    memset(queue->bands, 0, sizeof(queue->bands));
     queue->count = 0;
     queue->capacity = capacity;
+    queue->dequeued = 0;
+    queue->total_wait_ms = 0;
+    queue->promoted = 0;
+    queue->user_stats_count = 0;
     
     // Initialize synchronization primitives
     if (pthread_mutex_init(&queue->mutex, NULL) != 0) {
@@ -187,12 +402,21 @@ void destroy_task_queue(task_queue_t *queue) {
     
     pthread_mutex_lock(&queue->mutex);
     
-    // Free all remaining tasks
-    task_t *current = queue->head;
-    while (current) {
-        task_t *next = current->next;
-        destroy_task(current);
-        current = next;
+    // Free all remaining tasks and their flows
+    for (int b = 0; b < MAX_PRIORITY; b++) {
+        user_flow_t *flow = queue->bands[b].head;
+        while (flow) {
+            user_flow_t *next_flow = flow->next;
+            task_t *current = flow->head;
+            while (current) {
+                task_t *next = current->next;
+                destroy_task(current);
+                current = next;
+            }
+            free(flow);
+            flow = next_flow;
+        }
+        queue->bands[b].head = queue->bands[b].tail = NULL;
     }
     
     pthread_mutex_unlock(&queue->mutex);
@@ -206,6 +430,7 @@ void destroy_task_queue(task_queue_t *queue) {
     printf("Task queue destroyed\n");
 }
 
+// Enqueue into the user's flow in the band matching task->priority
 int enqueue_task(task_queue_t *queue, task_t *task) {
     if (!queue || !task) return -1;
 
@@ -227,17 +452,20 @@ int enqueue_task(task_queue_t *queue, task_t *task) {
         pthread_cond_wait(&queue->not_full, &queue->mutex);
     }
 
-    // Add task to queue (FIFO)
-    task->next = NULL;
-    if (queue->tail) {
-        queue->tail->next = task;
-    } else {
-        queue->head = task;
+    int band = (task->priority >= 1 && task->priority <= MAX_PRIORITY) ? task->priority - 1 : PRIORITY_MEDIUM - 1;
+    user_flow_t *flow = find_or_add_flow(&queue->bands[band], task->username);
+    if (!flow) {
+        pthread_mutex_unlock(&queue->mutex);
+        return -1;
     }
-    queue->tail = task;
+
+    task->enqueue_ms = monotonic_ms();
+    task->band = band;
+    flow_insert_task(flow, task);
     queue->count++;
 
-    printf("Task enqueued (type: %d), queue size: %d\n", task->type, queue->count);
+    printf("Task enqueued (type: %d, user: %s, priority: %d), queue size: %d\n",
+           task->type, task->username, task->priority, queue->count);
 
     // Signal that queue is not empty
     pthread_cond_signal(&queue->not_empty);
@@ -247,8 +475,25 @@ int enqueue_task(task_queue_t *queue, task_t *task) {
 }
 
 task_t* dequeue_task(task_queue_t *queue) {
+    return dequeue_task_timed(queue, 0);
+}
+
+// Dequeue with an optional timeout (timeout_ms <= 0 waits forever).
+// Returns NULL on shutdown or when the timeout expires with the queue empty.
+task_t* dequeue_task_timed(task_queue_t *queue, int timeout_ms) {
     if (!queue) return NULL;
 
+    struct timespec deadline;
+    if (timeout_ms > 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
     pthread_mutex_lock(&queue->mutex);
 
     // Wait while queue is empty
@@ -263,19 +508,27 @@ task_t* dequeue_task(task_queue_t *queue) {
                 return NULL;
             }
         }
-        pthread_cond_wait(&queue->not_empty, &queue->mutex);
+        if (timeout_ms > 0) {
+            if (pthread_cond_timedwait(&queue->not_empty, &queue->mutex, &deadline) == ETIMEDOUT &&
+                queue->count == 0) {
+                pthread_mutex_unlock(&queue->mutex);
+                return NULL;
+            }
+        } else {
+            pthread_cond_wait(&queue->not_empty, &queue->mutex);
+        }
     }
 
-    // Remove task from queue (FIFO)
-    task_t *task = queue->head;
-    queue->head = task->next;
-    if (!queue->head) {
-        queue->tail = NULL;
-    }
-    task->next = NULL;
+    long long now = monotonic_ms();
+    age_queued_tasks(queue, now);
+    task_t *task = drr_pop_task(queue);
     queue->count--;
+    queue->dequeued++;
+    queue->total_wait_ms += now - task->enqueue_ms;
+    record_user_wait(queue, task->username, now - task->enqueue_ms);
 
-    printf("Task dequeued (type: %d), queue size: %d\n", task->type, queue->count);
+    printf("Task dequeued (type: %d, user: %s, band: %d), queue size: %d\n",
+           task->type, task->username, task->band + 1, queue->count);
 
     // Signal that queue is not full
     pthread_cond_signal(&queue->not_full);
@@ -284,6 +537,107 @@ task_t* dequeue_task(task_queue_t *queue) {
     return task;
 }
 
+// Pull a still-queued task back out (e.g. its client went away).
+// Returns 0 if removed, -1 if a worker already took it.
+int remove_task(task_queue_t *queue, task_t *task) {
+    if (!queue || !task) return -1;
+
+    pthread_mutex_lock(&queue->mutex);
+    for (int b = 0; b < MAX_PRIORITY; b++) {
+        priority_band_t *band = &queue->bands[b];
+        user_flow_t *prev_flow = NULL;
+        for (user_flow_t *flow = band->head; flow; prev_flow = flow, flow = flow->next) {
+            if (strcmp(flow->username, task->username) != 0) continue;
+            task_t *prev = NULL;
+            for (task_t *cur = flow->head; cur; prev = cur, cur = cur->next) {
+                if (cur != task) continue;
+                if (prev) {
+                    prev->next = cur->next;
+                } else {
+                    flow->head = cur->next;
+                }
+                if (flow->tail == cur) flow->tail = prev;
+                cur->next = NULL;
+                if (!flow->head) {
+                    unlink_flow(band, flow, prev_flow);
+                    free(flow);
+                }
+                queue->count--;
+                printf("Task removed from queue (type: %d, user: %s), queue size: %d\n",
+                       task->type, task->username, queue->count);
+                pthread_cond_signal(&queue->not_full);
+                pthread_mutex_unlock(&queue->mutex);
+                return 0;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return -1;
+}
+
+int task_queue_depth(task_queue_t *queue) {
+    if (!queue) return 0;
+    pthread_mutex_lock(&queue->mutex);
+    int depth = queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+    return depth;
+}
+
+// How long the longest-waiting queued task has been waiting (0 if empty).
+// Each flow is FIFO, so only flow heads need to be checked.
+long long task_queue_oldest_wait_ms(task_queue_t *queue) {
+    if (!queue) return 0;
+    long long now = monotonic_ms();
+    long long oldest = 0;
+    pthread_mutex_lock(&queue->mutex);
+    for (int b = 0; b < MAX_PRIORITY; b++) {
+        for (user_flow_t *flow = queue->bands[b].head; flow; flow = flow->next) {
+            if (flow->head && now - flow->head->enqueue_ms > oldest) {
+                oldest = now - flow->head->enqueue_ms;
+            }
+        }
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return oldest;
+}
+
+// Per-user queue-wait report plus Jain's fairness index over the users'
+// average waits (1.0 = every user waits equally long).
+void format_task_queue_user_stats(task_queue_t *queue, const char *name, char *buffer, size_t buffer_size) {
+    if (!buffer || buffer_size == 0) return;
+    buffer[0] = '\0';
+    if (!queue) return;
+
+    size_t pos = 0;
+    double sum = 0, sum_sq = 0;
+    int users = 0;
+
+    pthread_mutex_lock(&queue->mutex);
+    for (int i = 0; i < queue->user_stats_count; i++) {
+        user_wait_stats_t *stats = &queue->user_stats[i];
+        double avg = stats->dequeued ? (double)stats->total_wait_ms / stats->dequeued : 0.0;
+        sum += avg;
+        sum_sq += avg * avg;
+        users++;
+        if (pos < buffer_size) {
+            int n = snprintf(buffer + pos, buffer_size - pos,
+                             "[%s] user=%s tasks=%lu avg_wait_ms=%.1f max_wait_ms=%lld\n",
+                             name, stats->username, stats->dequeued, avg, stats->max_wait_ms);
+            if (n > 0) pos += (size_t)n;
+        }
+    }
+    unsigned long promoted = queue->promoted;
+    pthread_mutex_unlock(&queue->mutex);
+
+    double fairness = (users > 0 && sum_sq > 0) ? (sum * sum) / (users * sum_sq) : 1.0;
+    if (pos < buffer_size) {
+        snprintf(buffer + pos, buffer_size - pos,
+                 "[%s] fairness: users=%d jain_index=%.3f aged_promotions=%lu\n",
+                 name, users, fairness, promoted);
+    }
+}
+
 // Task Operations
 task_t* create_task(task_type_t type, int client_socket, const char *username, const char *command) {
     task_t *task = malloc(sizeof(task_t));
@@ -302,6 +656,16 @@ task_t* create_task(task_type_t type, int client_socket, const char *username, c
     
     task->data = NULL;
     task->data_size = 0;
+    task->priority = PRIORITY_MEDIUM;
+    task->creation_time = time(NULL);
+    task->enqueue_ms = 0;
+    task->band = PRIORITY_MEDIUM - 1;
+    task->lane = LANE_BULK;
+    task->deadline_ms = 0;
+    task->session = NULL;
+    task->detached = 0;
+    task->response_sent = 0;
+    task->stalled = 0;
     task->status = TASK_PENDING;
     task->result_data = NULL;
     task->result_size = 0;
@@ -334,10 +698,34 @@ task_t* create_priority_task(task_type_t type, int client_socket, const char *us
     // Set priority and creation time
     task->priority = (priority >= 1 && priority <= MAX_PRIORITY) ? priority : PRIORITY_MEDIUM;
     task->creation_time = time(NULL);
+    if (g_config.task_timeout_ms > 0) {
+        task->deadline_ms = monotonic_ms() + g_config.task_timeout_ms;
+    }
     
     return task;
 }
 
+// Why a queued task should not start: its client went away or its
+// deadline passed. Returns NULL while someone is still waiting for it.
+const char* task_abort_reason(task_t *task) {
+    const char *reason = task_cancel_reason(task);
+    if (reason) return reason;
+    if (task->deadline_ms > 0 && monotonic_ms() > task->deadline_ms) {
+        return "Request timed out";
+    }
+    return NULL;
+}
+
+// Why a running task should stop: only its client going away. The
+// deadline bounds queueing, not how long a transfer may take.
+const char* task_cancel_reason(task_t *task) {
+    if (!task || !task->session) return NULL;
+    pthread_mutex_lock(&task->session->mutex);
+    int cancelled = task->session->cancelled;
+    pthread_mutex_unlock(&task->session->mutex);
+    return cancelled ? "Request cancelled: client disconnected" : NULL;
+}
+
 void destroy_task(task_t *task) {
     if (!task) return;
     
@@ -356,6 +744,34 @@ void destroy_task(task_t *task) {
     free(task);
 }
 
+// Session Operations
+int init_user_session(user_session_t *session, int socket_fd, const char *username) {
+    if (!session) return -1;
+    memset(session, 0, sizeof(*session));
+    strncpy(session->username, username ? username : "", MAX_USERNAME - 1);
+    session->socket_fd = socket_fd;
+    session->authenticated = 1;
+    session->client_thread_id = pthread_self();
+    if (pthread_mutex_init(&session->mutex, NULL) != 0) {
+        perror("Failed to initialize session mutex");
+        return -1;
+    }
+    return 0;
+}
+
+void destroy_user_session(user_session_t *session) {
+    if (!session) return;
+    pthread_mutex_destroy(&session->mutex);
+}
+
+// Mark the session's outstanding work as unwanted
+void cancel_user_session(user_session_t *session) {
+    if (!session) return;
+    pthread_mutex_lock(&session->mutex);
+    session->cancelled = 1;
+    pthread_mutex_unlock(&session->mutex);
+}
+
 // Utility Functions
 void send_response(int socket_fd, const char *response) {
     if (socket_fd < 0 || !response) return;
@@ -401,73 +817,18 @@ void signal_shutdown(server_context_t *server) {
         pthread_cond_broadcast(&server->client_queue->not_empty);
         pthread_cond_broadcast(&server->client_queue->not_full);
     }
-    if (server->task_queue) {
-        pthread_cond_broadcast(&server->task_queue->not_empty);
-        pthread_cond_broadcast(&server->task_queue->not_full);
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        if (server->task_queues[lane]) {
+            pthread_cond_broadcast(&server->task_queues[lane]->not_empty);
+            pthread_cond_broadcast(&server->task_queues[lane]->not_full);
+        }
     }
 
     printf("Shutdown signal sent to all threads\n");
 }
 
-// Priority queue implementation for task queue
+// Priority-aware enqueue: the band comes from task->priority and the
+// fair scheduler orders users within it (see enqueue_task)
 int enqueue_priority_task(task_queue_t *queue, task_t *task) {
-    if (!queue || !task) return -1;
-    
-    pthread_mutex_lock(&queue->mutex);
-    
-    // Wait if queue is full
-    while (queue->count >= queue->capacity) {
-        pthread_cond_wait(&queue->not_full, &queue->mutex);
-    }
-    
-    // Insert task in priority order (1 = highest priority, 3 = lowest)
-    // For tasks with same priority, maintain FIFO order based on creation time
-    
-    if (queue->head == NULL) {
-        // Empty queue
-        queue->head = task;
-        queue->tail = task;
-        task->next = NULL;
-    } else {
-        task_t *current = queue->head;
-        task_t *previous = NULL;
-        
-        // Find insertion point
-        while (current != NULL) {
-            // Higher priority (lower number) goes first
-            // For same priority, earlier creation time goes first
-            if (task->priority < current->priority || 
-                (task->priority == current->priority && task->creation_time < current->creation_time)) {
-                break;
-            }
-            previous = current;
-            current = current->next;
-        }
-        
-        // Insert task
-        task->next = current;
-        
-        if (previous == NULL) {
-            // Insert at head
-            queue->head = task;
-        } else {
-            previous->next = task;
-        }
-        
-        if (current == NULL) {
-            // Insert at tail
-            queue->tail = task;
-        }
-    }
-    
-    queue->count++;
-    
-    printf("Priority task enqueued: type=%d, priority=%d, count=%d\n", 
-           task->type, task->priority, queue->count);
-    
-    // Signal that queue is not empty
-    pthread_cond_signal(&queue->not_empty);
-    
-    pthread_mutex_unlock(&queue->mutex);
-    return 0;
-}
\ No newline at end of file
+    return enqueue_task(queue, task);
+}
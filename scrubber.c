@@ -0,0 +1,214 @@
+#include "dropbox_server.h"
+#include <dirent.h>
+
+// Background integrity scrubber. A scheduler thread walks storage/ and
+// submits one TASK_SCRUB per file to the bulk lane at PRIORITY_LOW; the
+// worker recomputes the SHA-256 and compares it with the .meta checksum.
+//
+// Scrubbing only uses spare capacity: a file is submitted only while the
+// bulk queue is empty and there are more idle bulk workers than scrub tasks
+// in flight, and reads are paced to scrub_rate_kb per second. A pass runs
+// at startup and then every scrub_interval_s (0 disables the scrubber).
+
+#define SCRUB_BACKOFF_MS 100
+
+static struct {
+    server_context_t *server;
+    pthread_t thread;
+    int running;
+    int stopping;
+    int in_flight;               // scrub tasks queued or running
+    unsigned long passes;
+    unsigned long files;
+    unsigned long corrupt;
+    unsigned long quarantined;
+    unsigned long long bytes;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;         // signalled on stop
+} scrubber = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+// Sleep for ms unless stopped; returns nonzero if the scrubber is stopping.
+// Caller holds scrubber.mutex.
+static int scrubber_sleep_locked(long long ms) {
+    long long deadline = monotonic_ms() + ms;
+    while (!scrubber.stopping) {
+        long long remaining = deadline - monotonic_ms();
+        if (remaining <= 0) break;
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_sec += remaining / 1000;
+        wake.tv_nsec += (long)(remaining % 1000) * 1000000L;
+        if (wake.tv_nsec >= 1000000000L) {
+            wake.tv_sec++;
+            wake.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&scrubber.wake, &scrubber.mutex, &wake);
+    }
+    return scrubber.stopping;
+}
+
+// Block until the bulk lane has a worker nobody else needs
+static int wait_for_spare_capacity(void) {
+    task_queue_t *queue = scrubber.server->task_queues[LANE_BULK];
+    worker_pool_t *pool = scrubber.server->worker_pools[LANE_BULK];
+    pthread_mutex_lock(&scrubber.mutex);
+    while (!scrubber.stopping) {
+        int in_flight = scrubber.in_flight;
+        pthread_mutex_unlock(&scrubber.mutex);
+        int spare = task_queue_depth(queue) == 0 && worker_pool_idle(pool) > in_flight;
+        pthread_mutex_lock(&scrubber.mutex);
+        if (spare) break;
+        scrubber_sleep_locked(SCRUB_BACKOFF_MS);
+    }
+    int stopping = scrubber.stopping;
+    pthread_mutex_unlock(&scrubber.mutex);
+    return stopping;
+}
+
+static int submit_scrub(const char *username, const char *filename) {
+    task_t *task = create_task(TASK_SCRUB, -1, username, "SCRUB");
+    if (!task) return -1;
+    strncpy(task->filename, filename, MAX_FILENAME - 1);
+    task->priority = PRIORITY_LOW;
+    task->detached = 1;
+
+    pthread_mutex_lock(&scrubber.mutex);
+    scrubber.in_flight++;
+    pthread_mutex_unlock(&scrubber.mutex);
+    if (dispatch_task(scrubber.server, task) != 0) {
+        pthread_mutex_lock(&scrubber.mutex);
+        scrubber.in_flight--;
+        pthread_mutex_unlock(&scrubber.mutex);
+        destroy_task(task);
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    const char *username;
+    long long *next_slot_ms;
+} scrub_walk_t;
+
+// Scrub one shard directory; returns nonzero if the scrubber is stopping
+static int scrub_shard_dir(const char *path, DIR *dir, void *arg) {
+    scrub_walk_t *walk = (scrub_walk_t *)arg;
+    int stopping = 0;
+    long long rate = (long long)g_config.scrub_rate_kb * 1024;
+    struct dirent *entry;
+    while (!stopping && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        size_t len = strlen(name);
+        if (name[0] == '.') continue;
+        if (len > 5 && strcmp(name + len - 5, ".meta") == 0) continue;
+        if (len > 9 && strcmp(name + len - 9, ".meta.tmp") == 0) continue;
+
+        char file_path[1024];
+        struct stat st;
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, name);
+        if (stat(file_path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+        if (wait_for_spare_capacity()) {
+            stopping = 1;
+            break;
+        }
+
+        // Pace reads: each file books st_size bytes of the per-second budget
+        pthread_mutex_lock(&scrubber.mutex);
+        long long now = monotonic_ms();
+        if (*walk->next_slot_ms > now) stopping = scrubber_sleep_locked(*walk->next_slot_ms - now);
+        pthread_mutex_unlock(&scrubber.mutex);
+        if (stopping) break;
+        now = monotonic_ms();
+        if (*walk->next_slot_ms < now) *walk->next_slot_ms = now;
+        if (rate > 0) *walk->next_slot_ms += (long long)st.st_size * 1000 / rate;
+
+        submit_scrub(walk->username, name);
+    }
+    return stopping;
+}
+
+// Scrub one user's shard tree; returns nonzero if the scrubber is stopping
+static int scrub_user(const char *username, long long *next_slot_ms) {
+    scrub_walk_t walk = { username, next_slot_ms };
+    return storage_walk_user(username, scrub_shard_dir, &walk);
+}
+
+static void* scrubber_thread(void *arg) {
+    (void)arg;
+    long long next_slot_ms = monotonic_ms();
+    while (1) {
+        long long start = monotonic_ms();
+        DIR *dir = opendir("storage");
+        int stopping = 0;
+        if (dir) {
+            struct dirent *entry;
+            while (!stopping && (entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] == '.') continue;   // journal, quarantine
+                stopping = scrub_user(entry->d_name, &next_slot_ms);
+            }
+            closedir(dir);
+        }
+
+        pthread_mutex_lock(&scrubber.mutex);
+        if (!stopping) {
+            scrubber.passes++;
+            printf("Scrub pass %lu queued in %lldms (%lu files verified, %lu corrupt so far)\n",
+                   scrubber.passes, monotonic_ms() - start, scrubber.files, scrubber.corrupt);
+        }
+        stopping = scrubber_sleep_locked((long long)g_config.scrub_interval_s * 1000);
+        pthread_mutex_unlock(&scrubber.mutex);
+        if (stopping) break;
+    }
+    return NULL;
+}
+
+int scrubber_start(server_context_t *server) {
+    if (!server || g_config.scrub_interval_s <= 0) return 0;
+    scrubber.server = server;
+    scrubber.stopping = 0;
+    if (pthread_create(&scrubber.thread, NULL, scrubber_thread, NULL) != 0) {
+        perror("Failed to create scrubber thread");
+        return -1;
+    }
+    scrubber.running = 1;
+    printf("Integrity scrubber started (every %ds, %d KB/s, %s corrupt files)\n",
+           g_config.scrub_interval_s, g_config.scrub_rate_kb,
+           g_config.scrub_quarantine ? "quarantining" : "reporting");
+    return 0;
+}
+
+// Stop submitting; tasks already queued are freed with the queue
+void scrubber_stop(void) {
+    if (!scrubber.running) return;
+    pthread_mutex_lock(&scrubber.mutex);
+    scrubber.stopping = 1;
+    pthread_cond_broadcast(&scrubber.wake);
+    pthread_mutex_unlock(&scrubber.mutex);
+    pthread_join(scrubber.thread, NULL);
+    scrubber.running = 0;
+}
+
+// Called by the worker that verified a file
+void scrubber_file_done(size_t bytes, int corrupt, int quarantined) {
+    pthread_mutex_lock(&scrubber.mutex);
+    if (scrubber.in_flight > 0) scrubber.in_flight--;
+    scrubber.files++;
+    scrubber.bytes += bytes;
+    if (corrupt) scrubber.corrupt++;
+    if (quarantined) scrubber.quarantined++;
+    pthread_mutex_unlock(&scrubber.mutex);
+}
+
+void format_scrubber_stats(char *buffer, size_t buffer_size) {
+    if (!buffer || buffer_size == 0) return;
+    pthread_mutex_lock(&scrubber.mutex);
+    snprintf(buffer, buffer_size,
+             "[scrub] %s passes=%lu files=%lu bytes=%llu corrupt=%lu quarantined=%lu in_flight=%d\n",
+             scrubber.running ? "running" : "off", scrubber.passes, scrubber.files, scrubber.bytes,
+             scrubber.corrupt, scrubber.quarantined, scrubber.in_flight);
+    pthread_mutex_unlock(&scrubber.mutex);
+}
@@ -0,0 +1,122 @@
+#include "dropbox_server.h"
+#include <openssl/rand.h>
+
+// Session resumption tokens. A successful LOGIN or SIGNUP is answered with
+// a random token that stays valid for session_token_ttl_s seconds; a client
+// that reconnects sends "RESUME <token>" as its first line, without waiting
+// for the banner, and is signed in by a single table lookup.
+//
+// Tokens live only in memory: a restart invalidates them all and clients
+// fall back to LOGIN. Expired tokens are dropped when a lookup walks past
+// them, and in one sweep when the table reaches SESSION_TOKEN_MAX.
+
+#define SESSION_TOKEN_BUCKETS 16384
+
+typedef struct session_token {
+    char token[SESSION_TOKEN_LEN + 1];
+    char username[MAX_USERNAME];
+    long long expires_ms;                // monotonic
+    struct session_token *next;
+} session_token_t;
+
+static struct {
+    session_token_t *buckets[SESSION_TOKEN_BUCKETS];
+    size_t count;
+    pthread_mutex_t mutex;
+} session_tokens = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static size_t token_slot(const char *token) {
+    size_t hash = 5381;
+    while (*token) hash = hash * 33 + (unsigned char)*token++;
+    return hash % SESSION_TOKEN_BUCKETS;
+}
+
+// Unlink and free expired entries of one chain; caller holds the mutex
+static void purge_chain_locked(session_token_t **link, long long now) {
+    while (*link) {
+        session_token_t *entry = *link;
+        if (entry->expires_ms <= now) {
+            *link = entry->next;
+            free(entry);
+            session_tokens.count--;
+        } else {
+            link = &entry->next;
+        }
+    }
+}
+
+// Create a token for username; fails if tokens are disabled or the table is
+// full of live tokens, in which case the client simply gets none
+int session_token_issue(const char *username, char *token) {
+    if (!username || !token || g_config.session_token_ttl_s <= 0) return -1;
+    unsigned char raw[SESSION_TOKEN_LEN / 2];
+    if (RAND_bytes(raw, sizeof(raw)) != 1) return -1;
+    static const char hex[] = "0123456789abcdef";
+    for (size_t i = 0; i < sizeof(raw); i++) {
+        token[2 * i] = hex[raw[i] >> 4];
+        token[2 * i + 1] = hex[raw[i] & 0x0f];
+    }
+    token[SESSION_TOKEN_LEN] = '\0';
+
+    session_token_t *entry = malloc(sizeof(session_token_t));
+    if (!entry) return -1;
+    memcpy(entry->token, token, SESSION_TOKEN_LEN + 1);
+    strncpy(entry->username, username, MAX_USERNAME - 1);
+    entry->username[MAX_USERNAME - 1] = '\0';
+    long long now = monotonic_ms();
+    entry->expires_ms = now + (long long)g_config.session_token_ttl_s * 1000;
+
+    pthread_mutex_lock(&session_tokens.mutex);
+    if (session_tokens.count >= SESSION_TOKEN_MAX) {
+        for (size_t b = 0; b < SESSION_TOKEN_BUCKETS; b++) purge_chain_locked(&session_tokens.buckets[b], now);
+    }
+    if (session_tokens.count >= SESSION_TOKEN_MAX) {
+        pthread_mutex_unlock(&session_tokens.mutex);
+        free(entry);
+        return -1;
+    }
+    size_t slot = token_slot(token);
+    entry->next = session_tokens.buckets[slot];
+    session_tokens.buckets[slot] = entry;
+    session_tokens.count++;
+    pthread_mutex_unlock(&session_tokens.mutex);
+    return 0;
+}
+
+// Look up an unexpired token; on success copies its user into username
+// (MAX_USERNAME bytes) and returns the seconds it has left, else -1
+int session_token_resume(const char *token, char *username) {
+    if (!token || !username || strlen(token) != SESSION_TOKEN_LEN) return -1;
+    long long now = monotonic_ms();
+    int remaining = -1;
+    size_t slot = token_slot(token);
+
+    pthread_mutex_lock(&session_tokens.mutex);
+    purge_chain_locked(&session_tokens.buckets[slot], now);
+    for (session_token_t *entry = session_tokens.buckets[slot]; entry; entry = entry->next) {
+        if (strcmp(entry->token, token) == 0) {
+            memcpy(username, entry->username, MAX_USERNAME);
+            remaining = (int)((entry->expires_ms - now + 999) / 1000);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&session_tokens.mutex);
+    return remaining;
+}
+
+void session_tokens_clear(void) {
+    pthread_mutex_lock(&session_tokens.mutex);
+    for (size_t b = 0; b < SESSION_TOKEN_BUCKETS; b++) {
+        session_token_t *entry = session_tokens.buckets[b];
+        while (entry) {
+            session_token_t *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+        session_tokens.buckets[b] = NULL;
+    }
+    session_tokens.count = 0;
+    pthread_mutex_unlock(&session_tokens.mutex);
+}
@@ -0,0 +1,648 @@
+#define _GNU_SOURCE
+#include "dropbox_server.h"
+#include <dirent.h>
+
+// In-memory index of stored files, rebuilt at startup by scanning storage/
+// in parallel (one user's shard tree at a time per scanner thread) and kept
+// current by every journaled upload and delete. LIST is answered from here
+// instead of a readdir plus one .meta read per file, a batch of rows at a
+// time so the read lock is never held while a client is being written to.
+//
+// Besides the hash table each user keeps one array of its files per LIST
+// sort key (name, size, mtime; ties broken by name), so a page is a binary
+// search to its cursor plus a walk of the rows it returns. The arrays are
+// built with one sort after the startup scan and kept sorted by inserting
+// in place afterwards.
+//
+// The startup scan also garbage-collects temp files no journal record
+// refers to (replay has already run), removes .meta files whose blob is
+// gone and rewrites quota files that drifted from the actual usage.
+
+#define METADATA_SUFFIX ".meta"
+#define INDEX_USER_BUCKETS 1024
+#define INDEX_MIN_FILE_BUCKETS 16
+
+typedef struct index_file {
+    char *name;
+    size_t size;
+    time_t modified;
+    struct index_file *next;
+} index_file_t;
+
+typedef struct index_user {
+    char username[MAX_USERNAME];
+    index_file_t **buckets;
+    size_t bucket_count;
+    size_t file_count;
+    size_t used_bytes;
+    index_file_t **order[LIST_SORT_COUNT];   // file_count entries each
+    size_t order_cap;
+    int ordered;                             // 0 while the startup scan appends
+    struct index_user *next;
+} index_user_t;
+
+static struct {
+    index_user_t *users[INDEX_USER_BUCKETS];
+    int ready;
+    pthread_rwlock_t lock;
+} storage_index = {
+    .lock = PTHREAD_RWLOCK_INITIALIZER,
+};
+
+static size_t hash_name(const char *name) {
+    size_t hash = 5381;
+    while (*name) hash = hash * 33 + (unsigned char)*name++;
+    return hash;
+}
+
+static int has_suffix(const char *name, const char *suffix) {
+    size_t name_len = strlen(name);
+    size_t suffix_len = strlen(suffix);
+    return name_len >= suffix_len && strcmp(name + name_len - suffix_len, suffix) == 0;
+}
+
+// d_type is DT_UNKNOWN on some filesystems; fall back to fstatat
+static int entry_is_dir(int dir_fd, const struct dirent *entry) {
+    if (entry->d_type != DT_UNKNOWN) return entry->d_type == DT_DIR;
+    struct stat st;
+    return fstatat(dir_fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+}
+
+static index_user_t* create_index_user(const char *username) {
+    index_user_t *user = calloc(1, sizeof(index_user_t));
+    if (!user) return NULL;
+    strncpy(user->username, username, MAX_USERNAME - 1);
+    user->bucket_count = INDEX_MIN_FILE_BUCKETS;
+    user->buckets = calloc(user->bucket_count, sizeof(index_file_t *));
+    if (!user->buckets) {
+        free(user);
+        return NULL;
+    }
+    user->ordered = 1;
+    return user;
+}
+
+static void destroy_index_user(index_user_t *user) {
+    if (!user) return;
+    for (size_t b = 0; b < user->bucket_count; b++) {
+        index_file_t *file = user->buckets[b];
+        while (file) {
+            index_file_t *next = file->next;
+            free(file->name);
+            free(file);
+            file = next;
+        }
+    }
+    free(user->buckets);
+    for (int k = 0; k < LIST_SORT_COUNT; k++) free(user->order[k]);
+    free(user);
+}
+
+static index_file_t* find_file(index_user_t *user, const char *name) {
+    for (index_file_t *file = user->buckets[hash_name(name) % user->bucket_count]; file; file = file->next) {
+        if (strcmp(file->name, name) == 0) return file;
+    }
+    return NULL;
+}
+
+// Double the bucket array once the average chain passes two entries
+static void maybe_grow(index_user_t *user) {
+    if (user->file_count < user->bucket_count * 2) return;
+    size_t new_count = user->bucket_count * 2;
+    index_file_t **buckets = calloc(new_count, sizeof(index_file_t *));
+    if (!buckets) return;
+    for (size_t b = 0; b < user->bucket_count; b++) {
+        index_file_t *file = user->buckets[b];
+        while (file) {
+            index_file_t *next = file->next;
+            size_t slot = hash_name(file->name) % new_count;
+            file->next = buckets[slot];
+            buckets[slot] = file;
+            file = next;
+        }
+    }
+    free(user->buckets);
+    user->buckets = buckets;
+    user->bucket_count = new_count;
+}
+
+// Order of a and b under a LIST sort key; names are unique, so never 0
+// for distinct files
+static int compare_files(list_sort_t sort, const index_file_t *a, const index_file_t *b) {
+    if (sort == LIST_SORT_SIZE && a->size != b->size) return a->size < b->size ? -1 : 1;
+    if (sort == LIST_SORT_MTIME && a->modified != b->modified) return a->modified < b->modified ? -1 : 1;
+    return strcmp(a->name, b->name);
+}
+
+static int compare_by_name(const void *a, const void *b) {
+    return compare_files(LIST_SORT_NAME, *(index_file_t * const *)a, *(index_file_t * const *)b);
+}
+
+static int compare_by_size(const void *a, const void *b) {
+    return compare_files(LIST_SORT_SIZE, *(index_file_t * const *)a, *(index_file_t * const *)b);
+}
+
+static int compare_by_mtime(const void *a, const void *b) {
+    return compare_files(LIST_SORT_MTIME, *(index_file_t * const *)a, *(index_file_t * const *)b);
+}
+
+// First position in order[sort] whose file sorts after key (or at key,
+// if inclusive)
+static size_t order_search(const index_user_t *user, list_sort_t sort, const index_file_t *key, int inclusive) {
+    size_t lo = 0, hi = user->file_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = compare_files(sort, user->order[sort][mid], key);
+        if (cmp < 0 || (cmp == 0 && !inclusive)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int reserve_order(index_user_t *user, size_t count) {
+    if (count <= user->order_cap) return 0;
+    size_t cap = user->order_cap ? user->order_cap * 2 : INDEX_MIN_FILE_BUCKETS;
+    while (cap < count) cap *= 2;
+    for (int k = 0; k < LIST_SORT_COUNT; k++) {
+        index_file_t **grown = realloc(user->order[k], cap * sizeof(index_file_t *));
+        if (!grown) return -1;
+        user->order[k] = grown;
+    }
+    user->order_cap = cap;
+    return 0;
+}
+
+// Add file to the sort arrays; file_count does not include it yet
+static void order_insert(index_user_t *user, index_file_t *file) {
+    for (int k = 0; k < LIST_SORT_COUNT; k++) {
+        size_t pos = user->ordered ? order_search(user, (list_sort_t)k, file, 1) : user->file_count;
+        memmove(&user->order[k][pos + 1], &user->order[k][pos], (user->file_count - pos) * sizeof(index_file_t *));
+        user->order[k][pos] = file;
+    }
+}
+
+// Drop file from the sort arrays; file_count still includes it
+static void order_remove(index_user_t *user, index_file_t *file) {
+    for (int k = 0; k < LIST_SORT_COUNT; k++) {
+        size_t pos = user->ordered ? order_search(user, (list_sort_t)k, file, 1) : 0;
+        while (pos < user->file_count && user->order[k][pos] != file) pos++;
+        if (pos == user->file_count) continue;
+        memmove(&user->order[k][pos], &user->order[k][pos + 1], (user->file_count - pos - 1) * sizeof(index_file_t *));
+    }
+}
+
+// Sort the arrays the startup scan filled in directory order
+static void build_order(index_user_t *user) {
+    if (user->file_count > 0) {
+        qsort(user->order[LIST_SORT_NAME], user->file_count, sizeof(index_file_t *), compare_by_name);
+        qsort(user->order[LIST_SORT_SIZE], user->file_count, sizeof(index_file_t *), compare_by_size);
+        qsort(user->order[LIST_SORT_MTIME], user->file_count, sizeof(index_file_t *), compare_by_mtime);
+    }
+    user->ordered = 1;
+}
+
+static int put_file(index_user_t *user, const char *name, size_t size, time_t modified) {
+    index_file_t *file = find_file(user, name);
+    if (file) {
+        // Its size and mtime are about to change: take it out of the orders
+        user->used_bytes -= file->size;
+        order_remove(user, file);
+        user->file_count--;
+    } else {
+        if (reserve_order(user, user->file_count + 1) != 0) return -1;
+        file = malloc(sizeof(index_file_t));
+        if (!file) return -1;
+        size_t len = strlen(name);
+        file->name = malloc(len + 1);
+        if (!file->name) {
+            free(file);
+            return -1;
+        }
+        memcpy(file->name, name, len + 1);
+        size_t slot = hash_name(name) % user->bucket_count;
+        file->next = user->buckets[slot];
+        user->buckets[slot] = file;
+    }
+    file->size = size;
+    file->modified = modified;
+    order_insert(user, file);
+    user->file_count++;
+    maybe_grow(user);
+    user->used_bytes += size;
+    return 0;
+}
+
+static void remove_file(index_user_t *user, const char *name) {
+    index_file_t **link = &user->buckets[hash_name(name) % user->bucket_count];
+    while (*link) {
+        index_file_t *file = *link;
+        if (strcmp(file->name, name) == 0) {
+            *link = file->next;
+            user->used_bytes -= file->size;
+            order_remove(user, file);
+            user->file_count--;
+            free(file->name);
+            free(file);
+            return;
+        }
+        link = &file->next;
+    }
+}
+
+// Caller holds the index lock
+static index_user_t* find_user_locked(const char *username) {
+    for (index_user_t *user = storage_index.users[hash_name(username) % INDEX_USER_BUCKETS]; user; user = user->next) {
+        if (strcmp(user->username, username) == 0) return user;
+    }
+    return NULL;
+}
+
+static void insert_user_locked(index_user_t *user) {
+    size_t slot = hash_name(user->username) % INDEX_USER_BUCKETS;
+    user->next = storage_index.users[slot];
+    storage_index.users[slot] = user;
+}
+
+// Size and mtime of a blob from its .meta sidecar, falling back to the
+// blob itself (header or base64 length) when the sidecar is missing
+static int read_blob_info(int dir_fd, const char *name, size_t *size, time_t *modified) {
+    char meta_name[MAX_FILENAME + 16];
+    snprintf(meta_name, sizeof(meta_name), "%s.meta", name);
+    int fd = openat(dir_fd, meta_name, O_RDONLY);
+    if (fd >= 0) {
+        char buf[1024];
+        ssize_t n = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (n > 0) {
+            buf[n] = '\0';
+            char stored_name[MAX_FILENAME];
+            long created, mtime;
+            if (sscanf(buf, "%255s\n%zu\n%ld\n%ld", stored_name, size, &created, &mtime) == 4) {
+                *modified = (time_t)mtime;
+                return 0;
+            }
+        }
+    }
+
+    struct stat st;
+    if (fstatat(dir_fd, name, &st, 0) != 0 || !S_ISREG(st.st_mode)) return -1;
+    fd = openat(dir_fd, name, O_RDONLY);
+    if (fd < 0) return -1;
+    int rc = blob_logical_size_fd(fd, size);
+    close(fd);
+    if (rc != 0) *size = 0;
+    *modified = st.st_mtime;
+    return 0;
+}
+
+typedef struct {
+    char **users;                // user directory names to scan
+    int user_count;
+    int next_user;               // next directory to hand out
+    pthread_mutex_t mutex;
+    unsigned long files;
+    unsigned long temps_removed;
+    unsigned long metas_removed;
+    unsigned long quotas_fixed;
+    int errors;
+} index_scan_t;
+
+typedef struct {
+    index_user_t *user;
+    unsigned long temps;
+    unsigned long metas_removed;
+} user_scan_t;
+
+// The storage engine's own temps: hidden ".<f>.<seq>.tmp" staging blobs
+// and "<f>.meta.tmp" from metadata writes. User files may end in .tmp too.
+static int is_internal_temp(const char *name) {
+    if (has_suffix(name, METADATA_SUFFIX ".tmp")) return 1;
+    if (name[0] != '.' || !has_suffix(name, ".tmp")) return 0;
+    size_t end = strlen(name) - 4;
+    size_t digits = 0;
+    while (digits < end && isdigit((unsigned char)name[end - 1 - digits])) digits++;
+    size_t dot = end - 1 - digits;
+    return digits > 0 && digits < end && dot > 1 && name[dot] == '.';
+}
+
+// Index one shard directory of a user. A file and its .meta always share
+// a shard, so orphaned .meta files can be found per directory.
+static int scan_shard_dir(const char *dir_path, DIR *dir, void *arg) {
+    (void)dir_path;
+    user_scan_t *us = (user_scan_t *)arg;
+    int dir_fd = dirfd(dir);
+    char **metas = NULL;
+    size_t meta_count = 0, meta_cap = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        if (entry_is_dir(dir_fd, entry)) continue;
+
+        // Any temp file still here belongs to no committed transaction
+        if (is_internal_temp(name)) {
+            if (unlinkat(dir_fd, name, 0) == 0) us->temps++;
+            continue;
+        }
+        if (name[0] == '.') continue;
+        if (has_suffix(name, METADATA_SUFFIX)) {
+            if (meta_count == meta_cap) {
+                size_t cap = meta_cap ? meta_cap * 2 : 16;
+                char **grown = realloc(metas, cap * sizeof(char *));
+                if (!grown) continue;
+                metas = grown;
+                meta_cap = cap;
+            }
+            size_t len = strlen(name);
+            metas[meta_count] = malloc(len + 1);
+            if (metas[meta_count]) memcpy(metas[meta_count++], name, len + 1);
+            continue;
+        }
+
+        size_t size;
+        time_t modified;
+        if (read_blob_info(dir_fd, name, &size, &modified) == 0) {
+            put_file(us->user, name, size, modified);
+        }
+    }
+
+    // A .meta without its blob is left over from an interrupted delete
+    for (size_t i = 0; i < meta_count; i++) {
+        char blob[MAX_FILENAME + 16];
+        strncpy(blob, metas[i], sizeof(blob) - 1);
+        blob[sizeof(blob) - 1] = '\0';
+        blob[strlen(blob) - strlen(METADATA_SUFFIX)] = '\0';
+        if (!find_file(us->user, blob) && unlinkat(dir_fd, metas[i], 0) == 0) us->metas_removed++;
+        free(metas[i]);
+    }
+    free(metas);
+    return 0;
+}
+
+// Scan one user's shard directories into a fresh index_user_t
+static index_user_t* scan_user(index_scan_t *scan, const char *username) {
+    user_scan_t us = { create_index_user(username), 0, 0 };
+    if (!us.user) return NULL;
+    us.user->ordered = 0;
+    storage_walk_user(username, scan_shard_dir, &us);
+    index_user_t *user = us.user;
+    build_order(user);
+    unsigned long temps = us.temps, metas_removed = us.metas_removed;
+
+    int fixed = reconcile_user_quota(username, user->used_bytes);
+
+    pthread_mutex_lock(&scan->mutex);
+    scan->files += user->file_count;
+    scan->temps_removed += temps;
+    scan->metas_removed += metas_removed;
+    if (fixed > 0) scan->quotas_fixed++;
+    if (fixed < 0) scan->errors++;
+    pthread_mutex_unlock(&scan->mutex);
+    return user;
+}
+
+static void* index_scan_worker(void *arg) {
+    index_scan_t *scan = (index_scan_t *)arg;
+    while (1) {
+        pthread_mutex_lock(&scan->mutex);
+        int slot = scan->next_user < scan->user_count ? scan->next_user++ : -1;
+        pthread_mutex_unlock(&scan->mutex);
+        if (slot < 0) break;
+
+        index_user_t *user = scan_user(scan, scan->users[slot]);
+        if (!user) continue;
+        pthread_rwlock_wrlock(&storage_index.lock);
+        insert_user_locked(user);
+        pthread_rwlock_unlock(&storage_index.lock);
+    }
+    return NULL;
+}
+
+// Scan storage/ and build the index. Must run after journal replay and
+// before the server accepts connections.
+int storage_index_build(int threads) {
+    long long start = monotonic_ms();
+    index_scan_t scan;
+    memset(&scan, 0, sizeof(scan));
+    if (pthread_mutex_init(&scan.mutex, NULL) != 0) return -1;
+
+    DIR *dir = opendir("storage");
+    if (dir) {
+        int cap = 0;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            const char *name = entry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+            // Stale temps of quota files and change logs live at the top
+            // level next to the user directories, whose names may also end
+            // in .tmp
+            if (!entry_is_dir(dirfd(dir), entry)) {
+                if (has_suffix(name, ".quota.meta.tmp") || has_suffix(name, ".changes.tmp")) {
+                    if (unlinkat(dirfd(dir), name, 0) == 0) scan.temps_removed++;
+                }
+                continue;
+            }
+            if (name[0] == '.') continue;
+            if (scan.user_count == cap) {
+                cap = cap ? cap * 2 : 64;
+                char **grown = realloc(scan.users, cap * sizeof(char *));
+                if (!grown) break;
+                scan.users = grown;
+            }
+            size_t len = strlen(name);
+            scan.users[scan.user_count] = malloc(len + 1);
+            if (!scan.users[scan.user_count]) break;
+            memcpy(scan.users[scan.user_count++], name, len + 1);
+        }
+        closedir(dir);
+    }
+
+    if (threads < 1) threads = 1;
+    if (threads > scan.user_count) threads = scan.user_count > 0 ? scan.user_count : 1;
+    pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+    int started = 0;
+    if (tids) {
+        for (int i = 0; i < threads; i++) {
+            if (pthread_create(&tids[i], NULL, index_scan_worker, &scan) != 0) break;
+            started++;
+        }
+    }
+    // Scan on this thread too if no helper could be started
+    if (started == 0) index_scan_worker(&scan);
+    for (int i = 0; i < started; i++) pthread_join(tids[i], NULL);
+    free(tids);
+
+    for (int i = 0; i < scan.user_count; i++) free(scan.users[i]);
+    free(scan.users);
+    pthread_mutex_destroy(&scan.mutex);
+
+    pthread_rwlock_wrlock(&storage_index.lock);
+    storage_index.ready = 1;
+    pthread_rwlock_unlock(&storage_index.lock);
+
+    printf("Startup scan: %d users, %lu files indexed, %lu temp files and %lu orphaned .meta removed, "
+           "%lu quotas reconciled in %lldms (%d threads)\n",
+           scan.user_count, scan.files, scan.temps_removed, scan.metas_removed, scan.quotas_fixed,
+           monotonic_ms() - start, started > 0 ? started : 1);
+    return scan.errors ? -1 : 0;
+}
+
+void storage_index_destroy(void) {
+    pthread_rwlock_wrlock(&storage_index.lock);
+    for (int b = 0; b < INDEX_USER_BUCKETS; b++) {
+        index_user_t *user = storage_index.users[b];
+        while (user) {
+            index_user_t *next = user->next;
+            destroy_index_user(user);
+            user = next;
+        }
+        storage_index.users[b] = NULL;
+    }
+    storage_index.ready = 0;
+    pthread_rwlock_unlock(&storage_index.lock);
+}
+
+int storage_index_ready(void) {
+    pthread_rwlock_rdlock(&storage_index.lock);
+    int ready = storage_index.ready;
+    pthread_rwlock_unlock(&storage_index.lock);
+    return ready;
+}
+
+void storage_index_put(const char *username, const file_metadata_t *metadata) {
+    if (!username || !metadata) return;
+    pthread_rwlock_wrlock(&storage_index.lock);
+    if (storage_index.ready) {
+        index_user_t *user = find_user_locked(username);
+        if (!user) {
+            user = create_index_user(username);
+            if (user) insert_user_locked(user);
+        }
+        if (user) put_file(user, metadata->filename, metadata->file_size, metadata->modified_time);
+    }
+    pthread_rwlock_unlock(&storage_index.lock);
+}
+
+void storage_index_remove(const char *username, const char *filename) {
+    if (!username || !filename) return;
+    pthread_rwlock_wrlock(&storage_index.lock);
+    if (storage_index.ready) {
+        index_user_t *user = find_user_locked(username);
+        if (user) remove_file(user, filename);
+    }
+    pthread_rwlock_unlock(&storage_index.lock);
+}
+
+// Size of an indexed file without touching the disk; -1 if it is not
+// indexed (or the index is not built yet)
+int storage_index_size(const char *username, const char *filename, size_t *size) {
+    if (!username || !filename || !size) return -1;
+    int rc = -1;
+    pthread_rwlock_rdlock(&storage_index.lock);
+    if (storage_index.ready) {
+        index_user_t *user = find_user_locked(username);
+        index_file_t *file = user ? find_file(user, filename) : NULL;
+        if (file) {
+            *size = file->size;
+            rc = 0;
+        }
+    }
+    pthread_rwlock_unlock(&storage_index.lock);
+    return rc;
+}
+
+static const char cursor_tags[LIST_SORT_COUNT] = { 'n', 's', 'm' };
+
+// A cursor names the last row handed out: "n:<name>", "s:<size>:<name>" or
+// "m:<mtime>:<name>" depending on the sort key
+void storage_index_cursor(char *buf, size_t size, list_sort_t sort, const list_row_t *row) {
+    if (sort == LIST_SORT_SIZE) {
+        snprintf(buf, size, "s:%zu:%s", row->size, row->name);
+    } else if (sort == LIST_SORT_MTIME) {
+        snprintf(buf, size, "m:%lld:%s", (long long)row->modified, row->name);
+    } else {
+        snprintf(buf, size, "n:%s", row->name);
+    }
+}
+
+// Parse a cursor into a key for order_search; key->name points into cursor
+static int parse_cursor(const char *cursor, list_sort_t sort, index_file_t *key) {
+    if (cursor[0] != cursor_tags[sort] || cursor[1] != ':') return -1;
+    const char *rest = cursor + 2;
+    key->size = 0;
+    key->modified = 0;
+    if (sort != LIST_SORT_NAME) {
+        char *end;
+        long long value = strtoll(rest, &end, 10);
+        if (end == rest || *end != ':' || value < 0) return -1;
+        if (sort == LIST_SORT_SIZE) key->size = (size_t)value;
+        if (sort == LIST_SORT_MTIME) key->modified = (time_t)value;
+        rest = end + 1;
+    }
+    if (*rest == '\0') return -1;
+    key->name = (char *)rest;
+    return 0;
+}
+
+// Copy up to max_rows rows whose name starts with query->prefix, in
+// query->sort order, starting after the cursor `after` (from the start if
+// NULL or empty). *more says whether further rows may follow; with a prefix
+// under size or mtime order they may turn out not to. Returns the number of
+// rows copied, -1 if the index is not built (callers fall back to scanning
+// the directory) or -2 if the cursor is invalid.
+int storage_index_rows(const char *username, const list_query_t *query, const char *after,
+                       list_row_t *rows, size_t max_rows, int *more) {
+    if (!username || !query || !rows || !more) return -1;
+    *more = 0;
+    pthread_rwlock_rdlock(&storage_index.lock);
+    if (!storage_index.ready) {
+        pthread_rwlock_unlock(&storage_index.lock);
+        return -1;
+    }
+    index_user_t *user = find_user_locked(username);
+    if (!user) {
+        pthread_rwlock_unlock(&storage_index.lock);
+        return 0;
+    }
+
+    list_sort_t sort = query->sort;
+    size_t prefix_len = strlen(query->prefix);
+    size_t start = 0;
+    if (after && after[0]) {
+        index_file_t key;
+        if (parse_cursor(after, sort, &key) != 0) {
+            pthread_rwlock_unlock(&storage_index.lock);
+            return -2;
+        }
+        start = order_search(user, sort, &key, 0);
+    }
+    if (sort == LIST_SORT_NAME && prefix_len > 0) {
+        // Matching names are contiguous in name order
+        index_file_t key = { (char *)query->prefix, 0, 0, NULL };
+        size_t first = order_search(user, sort, &key, 1);
+        if (first > start) start = first;
+    }
+
+    index_file_t **order = user->order[sort];
+    size_t count = 0, i = start;
+    for (; i < user->file_count && count < max_rows; i++) {
+        const index_file_t *file = order[i];
+        if (prefix_len > 0 && strncmp(file->name, query->prefix, prefix_len) != 0) {
+            if (sort == LIST_SORT_NAME) break;
+            continue;
+        }
+        strncpy(rows[count].name, file->name, MAX_FILENAME - 1);
+        rows[count].name[MAX_FILENAME - 1] = '\0';
+        rows[count].size = file->size;
+        rows[count].modified = file->modified;
+        count++;
+    }
+    *more = count == max_rows && i < user->file_count &&
+            !(sort == LIST_SORT_NAME && prefix_len > 0 &&
+              strncmp(order[i]->name, query->prefix, prefix_len) != 0);
+    pthread_rwlock_unlock(&storage_index.lock);
+    return (int)count;
+}
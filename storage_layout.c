@@ -0,0 +1,211 @@
+#include "dropbox_server.h"
+#include <dirent.h>
+
+// Sharded on-disk layout. A user's blobs, .meta sidecars and transaction
+// temp files live two directory levels below the user directory, picked by
+// a hash of the filename:
+//
+//   storage/<user>/<h1>/<h2>/<filename>          e.g. storage/alice/2f/0c/notes.txt
+//
+// h1 and h2 are two hex digits below SHARD_FANOUT, so a user has at most
+// SHARD_FANOUT^2 leaf directories and a lookup is a fixed-depth path
+// resolution however many files there are. A file, its .meta and its
+// temp blobs share one leaf directory, so renames never cross directories.
+//
+// Trees written before sharding keep everything directly in
+// storage/<user>/; storage_migrate_all moves such files into their shards
+// (the server does it at startup, migrate_storage does it offline).
+
+static unsigned int shard_hash(const char *filename) {
+    unsigned int hash = 2166136261u;
+    while (*filename) {
+        hash ^= (unsigned char)*filename++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void storage_shard_dir(char *buf, size_t size, const char *username, const char *filename) {
+    unsigned int hash = shard_hash(filename);
+    snprintf(buf, size, "storage/%s/%02x/%02x", username,
+             (hash >> 16) % SHARD_FANOUT, hash % SHARD_FANOUT);
+}
+
+void storage_file_path(char *buf, size_t size, const char *username, const char *filename) {
+    char dir[512];
+    storage_shard_dir(dir, sizeof(dir), username, filename);
+    snprintf(buf, size, "%s/%s", dir, filename);
+}
+
+// mkdir that tolerates an existing directory; a new one's entry in its
+// parent is made durable straight away
+static int ensure_dir(const char *path) {
+    if (mkdir(path, 0700) == 0) return durability_sync_dir(path);
+    return errno == EEXIST ? 0 : -1;
+}
+
+// Create storage/<user>/<h1>/<h2> for filename if it does not exist yet
+int storage_ensure_shard(const char *username, const char *filename) {
+    char dir[512];
+    storage_shard_dir(dir, sizeof(dir), username, filename);
+    struct stat st;
+    if (stat(dir, &st) == 0) return 0;
+
+    char path[512];
+    snprintf(path, sizeof(path), "storage/%s", username);
+    if (ensure_dir("storage") != 0 || ensure_dir(path) != 0) return -1;
+    // dir is "storage/<user>/h1/h2"; create the first level, then the second
+    size_t len = strlen(dir);
+    memcpy(path, dir, len - 3);
+    path[len - 3] = '\0';
+    if (ensure_dir(path) != 0 || ensure_dir(dir) != 0) return -1;
+    return 0;
+}
+
+static int is_shard_name(const char *name) {
+    unsigned int value;
+    char extra;
+    return strlen(name) == 2 && isxdigit((unsigned char)name[0]) && isxdigit((unsigned char)name[1]) &&
+           sscanf(name, "%2x%c", &value, &extra) == 1 && value < SHARD_FANOUT;
+}
+
+// Call fn on every leaf directory of a user's tree; stops early and returns
+// fn's value if it is nonzero
+int storage_walk_user(const char *username, storage_dir_fn fn, void *arg) {
+    char user_dir[512];
+    snprintf(user_dir, sizeof(user_dir), "storage/%s", username);
+    DIR *top = opendir(user_dir);
+    if (!top) return 0;
+
+    int rc = 0;
+    struct dirent *first;
+    while (rc == 0 && (first = readdir(top)) != NULL) {
+        if (!is_shard_name(first->d_name)) continue;
+        // Shard names are two hex digits, so the paths always fit
+        char level1[sizeof(user_dir) + 3];
+        snprintf(level1, sizeof(level1), "%s/%.2s", user_dir, first->d_name);
+        DIR *mid = opendir(level1);
+        if (!mid) continue;
+        struct dirent *second;
+        while (rc == 0 && (second = readdir(mid)) != NULL) {
+            if (!is_shard_name(second->d_name)) continue;
+            char leaf[sizeof(level1) + 3];
+            snprintf(leaf, sizeof(leaf), "%s/%.2s", level1, second->d_name);
+            DIR *dir = opendir(leaf);
+            if (!dir) continue;
+            rc = fn(leaf, dir, arg);
+            closedir(dir);
+        }
+        closedir(mid);
+    }
+    closedir(top);
+    return rc;
+}
+
+// Filename a flat entry belongs to: the blob itself (a user file may end
+// in .tmp), "<f>.meta" and "<f>.meta.tmp" belong to f, ".<f>.<seq>.tmp"
+// to f. NULL for other hidden temps.
+static int owning_filename(const char *name, char *owner, size_t size) {
+    size_t len = strlen(name);
+    strncpy(owner, name, size - 1);
+    owner[size - 1] = '\0';
+    if (len > 4 && strcmp(name + len - 4, ".tmp") == 0) {
+        if (name[0] != '.') {
+            if (len > 9 && strcmp(name + len - 9, ".meta.tmp") == 0) {
+                owner[len - 4] = '\0';       // <f>.meta.tmp -> <f>.meta
+            }
+        } else {
+            // .<f>.<seq>.tmp: drop the dot, the .tmp and the seq
+            memmove(owner, owner + 1, len);
+            len -= 5;
+            owner[len] = '\0';
+            char *seq = strrchr(owner, '.');
+            if (!seq || seq == owner || strspn(seq + 1, "0123456789") != strlen(seq + 1)) return -1;
+            *seq = '\0';
+            return 0;
+        }
+    }
+    len = strlen(owner);
+    if (len > 5 && strcmp(owner + len - 5, ".meta") == 0) owner[len - 5] = '\0';
+    return owner[0] ? 0 : -1;
+}
+
+// Move one user's flat files into their shards. Temps are moved too, since
+// journal replay may still need them; the startup scan discards the rest.
+// .meta files go first so an interruption can only leave blobs behind.
+static int migrate_user(const char *username, unsigned long *moved, unsigned long *skipped) {
+    char user_dir[512];
+    snprintf(user_dir, sizeof(user_dir), "storage/%s", username);
+    int errors = 0;
+
+    for (int pass = 0; pass < 2; pass++) {
+        DIR *dir = opendir(user_dir);
+        if (!dir) return 0;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            const char *name = entry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || is_shard_name(name)) continue;
+            size_t len = strlen(name);
+            int is_meta = len > 5 && strcmp(name + len - 5, ".meta") == 0;
+            if ((pass == 0) != is_meta) continue;
+
+            char from[1024];
+            struct stat st;
+            snprintf(from, sizeof(from), "%s/%s", user_dir, name);
+            if (stat(from, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+            char owner[MAX_FILENAME];
+            if (owning_filename(name, owner, sizeof(owner)) != 0) {
+                unlink(from);                // stale temp of unknown origin
+                continue;
+            }
+            char shard[512], to[1024];
+            storage_shard_dir(shard, sizeof(shard), username, owner);
+            snprintf(to, sizeof(to), "%s/%s", shard, name);
+            if (stat(to, &st) == 0) {
+                fprintf(stderr, "Migration: %s already exists; leaving %s in place\n", to, from);
+                (*skipped)++;
+                continue;
+            }
+            if (storage_ensure_shard(username, owner) != 0 || rename(from, to) != 0) {
+                perror("Migration: failed to move file into its shard");
+                errors++;
+                continue;
+            }
+            (*moved)++;
+        }
+        closedir(dir);
+    }
+    return errors ? -1 : 0;
+}
+
+// Move every flat file under storage/ into the sharded layout. Must run
+// before journal replay and before anything else touches storage.
+int storage_migrate_all(void) {
+    DIR *dir = opendir("storage");
+    if (!dir) return 0;
+    long long start = monotonic_ms();
+    unsigned long moved = 0, skipped = 0, users = 0;
+    int errors = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;      // journal, quarantine
+        char path[512];
+        struct stat st;
+        snprintf(path, sizeof(path), "storage/%s", entry->d_name);
+        if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) continue;
+        unsigned long before = moved;
+        if (migrate_user(entry->d_name, &moved, &skipped) != 0) errors++;
+        if (moved > before) users++;
+    }
+    closedir(dir);
+
+    if (moved > 0) {
+        if (durability_sync_all() != 0) errors++;
+        printf("Migrated %lu file(s) of %lu user(s) to the sharded layout in %lldms\n",
+               moved, users, monotonic_ms() - start);
+    }
+    if (skipped > 0) printf("Migration left %lu conflicting file(s) in place\n", skipped);
+    return errors ? -1 : 0;
+}
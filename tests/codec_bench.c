@@ -0,0 +1,160 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../dropbox_server.h"
+
+// Base64 codec microbenchmark: checks every available kernel against the
+// scalar one, then reports encode/decode throughput per kernel and size.
+//
+// Usage: tests/codec_bench [--max-size BYTES] [--min-bytes BYTES]
+//
+// Throughput is in GB/s of raw (decoded) data, so encode and decode rows
+// are directly comparable.
+
+static const char *kernels[] = { "scalar", "ssse3", "avx2" };
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned char *make_payload(size_t size) {
+    unsigned char *p = malloc(size ? size : 1);
+    if (!p) return NULL;
+    unsigned int x = 2463534242u;
+    for (size_t i = 0; i < size; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        p[i] = (unsigned char)x;
+    }
+    return p;
+}
+
+// Every kernel must produce the scalar output and accept/reject the same input
+static int check_kernel(const char *name) {
+    const size_t max_len = 1024;
+    unsigned char *payload = make_payload(max_len);
+    if (!payload) return -1;
+    int failures = 0;
+
+    for (size_t len = 0; len <= max_len && !failures; len++) {
+        char *ref = NULL, *enc = NULL;
+        size_t ref_len = 0, enc_len = 0;
+        base64_select_impl("scalar");
+        base64_encode(payload, len, &ref, &ref_len);
+        base64_select_impl(name);
+        base64_encode(payload, len, &enc, &enc_len);
+        if (!ref || !enc || ref_len != enc_len || memcmp(ref, enc, ref_len) != 0) {
+            fprintf(stderr, "%s: encode mismatch at length %zu\n", name, len);
+            failures++;
+        }
+
+        unsigned char *dec = NULL;
+        size_t dec_len = 0;
+        if (!failures && (base64_decode(enc, enc_len, &dec, &dec_len) != 0 ||
+                          dec_len != len || memcmp(dec, payload, len) != 0)) {
+            fprintf(stderr, "%s: decode mismatch at length %zu\n", name, len);
+            failures++;
+        }
+        free(dec);
+
+        // Corrupt one character (every byte value at one position per length)
+        if (!failures && enc_len >= 4) {
+            size_t pos = (len * 7) % enc_len;
+            char saved = enc[pos];
+            for (int c = 0; c < 256 && !failures; c++) {
+                enc[pos] = (char)c;
+                unsigned char *a = NULL, *b = NULL;
+                size_t a_len = 0, b_len = 0;
+                base64_select_impl("scalar");
+                int ra = base64_decode(enc, enc_len, &a, &a_len);
+                base64_select_impl(name);
+                int rb = base64_decode(enc, enc_len, &b, &b_len);
+                if (ra != rb || (ra == 0 && (a_len != b_len || memcmp(a, b, a_len) != 0))) {
+                    fprintf(stderr, "%s: decode disagrees with scalar (length %zu, byte 0x%02x at %zu)\n",
+                            name, len, c, pos);
+                    failures++;
+                }
+                free(a);
+                free(b);
+            }
+            enc[pos] = saved;
+        }
+        free(ref);
+        free(enc);
+    }
+    free(payload);
+    return failures ? -1 : 0;
+}
+
+static void bench_kernel(const char *name, size_t size, size_t min_bytes) {
+    unsigned char *payload = make_payload(size);
+    if (!payload) return;
+    base64_select_impl(name);
+
+    int reps = (int)(min_bytes / size);
+    if (reps < 3) reps = 3;
+    char *enc = NULL;
+    size_t enc_len = 0;
+
+    double start = now_s();
+    for (int r = 0; r < reps; r++) {
+        free(enc);
+        base64_encode(payload, size, &enc, &enc_len);
+    }
+    double enc_s = now_s() - start;
+
+    unsigned char *dec = NULL;
+    size_t dec_len = 0;
+    start = now_s();
+    for (int r = 0; r < reps; r++) {
+        free(dec);
+        dec = NULL;
+        base64_decode(enc, enc_len, &dec, &dec_len);
+    }
+    double dec_s = now_s() - start;
+
+    double total = (double)size * reps;
+    printf("%-8s %10zu %8d %10.2f %10.2f\n", name, size, reps,
+           enc_s > 0 ? total / enc_s / 1e9 : 0.0, dec_s > 0 ? total / dec_s / 1e9 : 0.0);
+    free(enc);
+    free(dec);
+    free(payload);
+}
+
+int main(int argc, char **argv) {
+    size_t max_size = 16 * 1024 * 1024;
+    size_t min_bytes = 256 * 1024 * 1024;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+            max_size = (size_t)atol(argv[++i]);
+        } else if (strcmp(argv[i], "--min-bytes") == 0 && i + 1 < argc) {
+            min_bytes = (size_t)atol(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--max-size BYTES] [--min-bytes BYTES]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("Default kernel: %s\n", base64_impl_name());
+    int available[KERNEL_COUNT];
+    for (size_t k = 0; k < KERNEL_COUNT; k++) {
+        available[k] = base64_select_impl(kernels[k]) == 0;
+        if (!available[k]) {
+            printf("%-8s not supported on this CPU\n", kernels[k]);
+            continue;
+        }
+        if (check_kernel(kernels[k]) != 0) return EXIT_FAILURE;
+        printf("%-8s matches scalar\n", kernels[k]);
+    }
+
+    printf("\n%-8s %10s %8s %10s %10s\n", "kernel", "size", "reps", "enc_GB/s", "dec_GB/s");
+    for (size_t size = 1024; size <= max_size; size *= 16) {
+        for (size_t k = 0; k < KERNEL_COUNT; k++) {
+            if (available[k]) bench_kernel(kernels[k], size, min_bytes);
+        }
+    }
+    return EXIT_SUCCESS;
+}
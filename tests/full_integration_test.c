@@ -257,11 +257,92 @@ int concurrency_test(int clients, int rounds) {
     return 0;
 }
 
+// A batch manifest with an unsafe name is rejected: the server drops the
+// connection without touching any file or sending per-file results
+static int batch_name_rejected(const char *command, const char *name) {
+    char buf[BUFFER_SIZE];
+    int s = connect_server();
+    if (s < 0) { perror("connect"); return -1; }
+    sock_recv(s, buf, sizeof(buf));
+
+    send_line(s, "SIGNUP batchname pass\n");
+    sock_recv(s, buf, sizeof(buf));
+    if (strstr(buf, "SIGNUP_SUCCESS") == NULL) {
+        send_line(s, "LOGIN batchname pass\n");
+        if (!wait_for_substring(s, "LOGIN_SUCCESS", 3000, buf, sizeof(buf))) { close(s); return -1; }
+    }
+
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "%s 1\n", command);
+    send_line(s, cmd);
+    if (!wait_for_substring(s, "SEND_BATCH", 3000, buf, sizeof(buf))) { close(s); return -1; }
+    size_t len = strlen(name);
+    send(s, &len, sizeof(len), 0);
+    send(s, name, len, 0);
+
+    // Anything but a closed connection means the name was accepted
+    struct timeval tv = { 3, 0 };
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ssize_t r;
+    while ((r = recv(s, buf, sizeof(buf), 0)) > 0) {}
+    close(s);
+    return r == 0 ? 0 : -1;
+}
+
+static int batch_name_validation(void) {
+    const char *commands[] = { "MDOWNLOAD", "MDELETE", "MUPLOAD" };
+    const char *names[] = { "../../x", "dir/x.txt", "a..b", ".hidden", "a b", "a\tb", "a\nb", "a\001b", "a\177b" };
+    for (size_t c = 0; c < sizeof(commands) / sizeof(commands[0]); c++) {
+        for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+            if (batch_name_rejected(commands[c], names[n]) != 0) {
+                fprintf(stderr, "%s accepted batch name #%zu\n", commands[c], n);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// UPLOAD, DOWNLOAD and DELETE refuse the same names as batches; dot-names
+// would collide with the versions and temp blobs stored beside a file
+static int single_name_validation(void) {
+    char buf[BUFFER_SIZE];
+    int s = connect_server();
+    if (s < 0) { perror("connect"); return -1; }
+    sock_recv(s, buf, sizeof(buf));
+    send_line(s, "SIGNUP batchname pass\n");
+    sock_recv(s, buf, sizeof(buf));
+    if (strstr(buf, "SIGNUP_SUCCESS") == NULL) {
+        send_line(s, "LOGIN batchname pass\n");
+        if (!wait_for_substring(s, "LOGIN_SUCCESS", 3000, buf, sizeof(buf))) { close(s); return -1; }
+    }
+
+    const char *commands[] = { "UPLOAD .notes", "UPLOAD .x.5.tmp", "DOWNLOAD .notes", "DOWNLOAD ../other/x",
+                               "DELETE .x.v3", "DELETE a..b" };
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        char cmd[64];
+        snprintf(cmd, sizeof(cmd), "%s\n", commands[i]);
+        send_line(s, cmd);
+        if (!wait_for_substring(s, "Invalid filename", 3000, buf, sizeof(buf))) {
+            fprintf(stderr, "%s was not rejected: %s\n", commands[i], buf);
+            close(s);
+            return -1;
+        }
+    }
+    send_line(s, "QUIT\n");
+    close(s);
+    return 0;
+}
+
 int main(int argc, char **argv) {
     printf("Starting full integration tests\n");
     srand(time(NULL));
     if (single_client_flow("itest") != 0) { fprintf(stderr, "Single-client flow failed\n"); return EXIT_FAILURE; }
     printf("Single-client flow passed\n");
+    if (batch_name_validation() != 0) { fprintf(stderr, "Batch name validation failed\n"); return EXIT_FAILURE; }
+    printf("Batch name validation passed\n");
+    if (single_name_validation() != 0) { fprintf(stderr, "Filename validation failed\n"); return EXIT_FAILURE; }
+    printf("Filename validation passed\n");
 
     printf("Running concurrency test (10 clients x 30 rounds)...\n");
     concurrency_test(10, 30);
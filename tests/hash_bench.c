@@ -0,0 +1,140 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../dropbox_server.h"
+
+// SHA-256 microbenchmark over the file sizes the storage benchmark uses.
+//
+// Usage: tests/hash_bench [--min-bytes BYTES] [--max-threads N]
+//
+// "oneshot" is calculate_sha256 over the whole buffer (downloads, scrub);
+// "stream" feeds 256 KB chunks the way uploads are hashed on receipt;
+// "threads" hashes independent buffers concurrently, as parallel uploads
+// do. The last rows compare hex formatting via sprintf with the table.
+
+static const size_t sizes[] = { 1024, 64 * 1024, 1024 * 1024, 10 * 1024 * 1024 };
+#define SIZE_COUNT (sizeof(sizes) / sizeof(sizes[0]))
+#define STREAM_CHUNK (256 * 1024)
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *make_payload(size_t size) {
+    char *p = malloc(size);
+    if (!p) return NULL;
+    for (size_t i = 0; i < size; i++) p[i] = (char)(i * 31 + 7);
+    return p;
+}
+
+static int reps_for(size_t size, size_t min_bytes) {
+    int reps = (int)(min_bytes / size);
+    return reps < 3 ? 3 : reps;
+}
+
+static double bench_oneshot(const char *data, size_t size, int reps) {
+    double start = now_s();
+    for (int r = 0; r < reps; r++) free(calculate_sha256(data, size));
+    return now_s() - start;
+}
+
+static double bench_stream(const char *data, size_t size, int reps) {
+    char hex[SHA256_DIGEST_BYTES * 2 + 1];
+    double start = now_s();
+    for (int r = 0; r < reps; r++) {
+        sha256_stream_t stream;
+        if (sha256_stream_init(&stream) != 0) return 0;
+        for (size_t off = 0; off < size; off += STREAM_CHUNK) {
+            size_t chunk = size - off < STREAM_CHUNK ? size - off : STREAM_CHUNK;
+            sha256_stream_update(&stream, data + off, chunk);
+        }
+        sha256_stream_final(&stream, hex);
+    }
+    return now_s() - start;
+}
+
+typedef struct {
+    const char *data;
+    size_t size;
+    int reps;
+} thread_arg_t;
+
+static void *hash_thread(void *arg) {
+    thread_arg_t *ta = (thread_arg_t *)arg;
+    bench_oneshot(ta->data, ta->size, ta->reps);
+    return NULL;
+}
+
+static double bench_threads(const char *data, size_t size, int reps, int threads) {
+    pthread_t tids[64];
+    thread_arg_t arg = { data, size, reps };
+    double start = now_s();
+    for (int t = 0; t < threads; t++) pthread_create(&tids[t], NULL, hash_thread, &arg);
+    for (int t = 0; t < threads; t++) pthread_join(tids[t], NULL);
+    return now_s() - start;
+}
+
+static void report(const char *mode, size_t size, int threads, int reps, double seconds) {
+    double bytes = (double)size * reps * threads;
+    printf("%-8s %10zu %7d %8d %10.3f %10.2f\n", mode, size, threads, reps,
+           seconds > 0 ? bytes / seconds / 1e9 : 0.0,
+           seconds > 0 ? seconds * 1e6 / ((double)reps * threads) : 0.0);
+}
+
+static void bench_hex(void) {
+    unsigned char digest[SHA256_DIGEST_BYTES];
+    char hex[SHA256_DIGEST_BYTES * 2 + 1];
+    const int reps = 1000000;
+    for (int i = 0; i < SHA256_DIGEST_BYTES; i++) digest[i] = (unsigned char)(i * 37);
+
+    double start = now_s();
+    for (int r = 0; r < reps; r++) {
+        digest[0] = (unsigned char)r;
+        for (int i = 0; i < SHA256_DIGEST_BYTES; i++) sprintf(hex + i * 2, "%02x", digest[i]);
+    }
+    double sprintf_s = now_s() - start;
+
+    start = now_s();
+    for (int r = 0; r < reps; r++) {
+        digest[0] = (unsigned char)r;
+        sha256_to_hex(digest, hex);
+    }
+    double table_s = now_s() - start;
+    printf("\nhex formatting: sprintf %.1f ns/digest, table %.1f ns/digest\n",
+           sprintf_s * 1e9 / reps, table_s * 1e9 / reps);
+}
+
+int main(int argc, char **argv) {
+    size_t min_bytes = 512 * 1024 * 1024;
+    int max_threads = 4;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--min-bytes") == 0 && i + 1 < argc) {
+            min_bytes = (size_t)atol(argv[++i]);
+        } else if (strcmp(argv[i], "--max-threads") == 0 && i + 1 < argc) {
+            max_threads = atoi(argv[++i]);
+            if (max_threads < 1) max_threads = 1;
+            if (max_threads > 64) max_threads = 64;
+        } else {
+            fprintf(stderr, "Usage: %s [--min-bytes BYTES] [--max-threads N]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%-8s %10s %7s %8s %10s %10s\n", "mode", "size", "threads", "reps", "GB/s", "us/hash");
+    for (size_t s = 0; s < SIZE_COUNT; s++) {
+        size_t size = sizes[s];
+        char *data = make_payload(size);
+        if (!data) return EXIT_FAILURE;
+        int reps = reps_for(size, min_bytes);
+        report("oneshot", size, 1, reps, bench_oneshot(data, size, reps));
+        report("stream", size, 1, reps, bench_stream(data, size, reps));
+        for (int threads = 2; threads <= max_threads; threads *= 2) {
+            int per_thread = reps_for(size, min_bytes / threads);
+            report("threads", size, threads, per_thread, bench_threads(data, size, per_thread, threads));
+        }
+        free(data);
+    }
+    bench_hex();
+    return EXIT_SUCCESS;
+}
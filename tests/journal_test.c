@@ -0,0 +1,130 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../dropbox_server.h"
+#include <dirent.h>
+#include <sys/wait.h>
+
+// Journal replay check: a child process saves and deletes files through
+// the storage layer and exits without a checkpoint, as a crash would; the
+// parent then reopens the journal and checks that replay left every file
+// as the child last committed it.
+//
+// Usage: tests/journal_test [--dir DIR]
+
+#define USER "alice"
+
+static void remove_tree(const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        unlink(path);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char child[1024];
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        struct stat st;
+        if (lstat(child, &st) == 0 && S_ISDIR(st.st_mode)) remove_tree(child);
+        else unlink(child);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+static int save(const char *name, const char *text) {
+    return save_file_to_storage(USER, name, text, strlen(text));
+}
+
+// The committed history, replayed in one journal
+static int write_history(void) {
+    if (journal_open() != 0) return -1;
+    // Re-uploaded after a delete: the old D must not remove the new blob
+    if (save("a.txt", "a one") != 0 || delete_file_from_storage(USER, "a.txt") != 0 ||
+        save("a.txt", "a two") != 0) return -1;
+    // Versions kept after a delete must survive the delete's replay
+    if (save("b.txt", "b one") != 0 || delete_file_from_storage(USER, "b.txt") != 0 ||
+        save("b.txt", "b two") != 0 || save("b.txt", "b three") != 0) return -1;
+    // Deleted last: stays deleted
+    if (save("c.txt", "c one") != 0 || delete_file_from_storage(USER, "c.txt") != 0) return -1;
+    return 0;
+}
+
+static int expect_file(const char *name, const char *want) {
+    char *data = NULL;
+    size_t size = 0;
+    int rc = load_file_from_storage(USER, name, &data, &size);
+    int ok = want ? rc == 0 && size == strlen(want) && memcmp(data, want, size) == 0 : rc != 0;
+    if (!ok) fprintf(stderr, "%s: expected %s after replay\n", name, want ? want : "no file");
+    free(data);
+    return ok ? 0 : -1;
+}
+
+static int expect_version(const char *name, int version, const char *want) {
+    char buf[64];
+    size_t size = 0;
+    blob_reader_t *reader = open_file_version(USER, name, version, &size);
+    ssize_t got = reader ? blob_reader_read(reader, buf, sizeof(buf)) : -1;
+    if (reader) blob_reader_close(reader);
+    if (got != (ssize_t)strlen(want) || memcmp(buf, want, (size_t)got) != 0) {
+        fprintf(stderr, "%s: expected version %d to be %s after replay\n", name, version, want);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *dir = "/tmp/dropbox_journal_test";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--dir DIR]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    mkdir(dir, 0700);
+    if (chdir(dir) != 0) {
+        perror("Failed to enter test directory");
+        return EXIT_FAILURE;
+    }
+    remove_tree("storage");
+    strcpy(g_config.durability, "none");
+    g_config.versions_keep = 5;
+    g_config.versions_max_age_s = 0;
+    durability_init();
+
+    // The storage layer logs to stdout; keep it quiet
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    if (!freopen("/dev/null", "w", stdout)) perror("Failed to silence storage logging");
+
+    pid_t pid = fork();
+    if (pid == 0) _exit(write_history() == 0 ? 0 : 1);
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Failed to write the history to replay\n");
+        return EXIT_FAILURE;
+    }
+    if (journal_open() != 0) {
+        fprintf(stderr, "Failed to replay the journal\n");
+        return EXIT_FAILURE;
+    }
+
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    int failed = 0;
+    failed |= expect_file("a.txt", "a two");
+    failed |= expect_file("b.txt", "b three");
+    failed |= expect_version("b.txt", 1, "b two");
+    failed |= expect_file("c.txt", NULL);
+
+    journal_close();
+    durability_shutdown();
+    remove_tree("storage");
+    if (failed) return EXIT_FAILURE;
+    printf("journal replay keeps each file's last committed state\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,271 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../dropbox_server.h"
+
+// LIST benchmark: one account with many files, listed in full by several
+// threads at once, plus the timestamp formatting each row needs.
+//
+// Usage: tests/list_bench [--dir DIR] [--files N] [--threads N] [--reps N]
+//
+// First checks format_local_time against localtime_r + strftime over a
+// span of timestamps (run with e.g. TZ=America/New_York to cross DST),
+// and that the index build's startup scan keeps user files and users
+// named *.tmp.
+// The "format" rows compare both ways of formatting with every thread
+// formatting at once; the "list" rows time whole-account LISTs through
+// the index into a sink that discards the text. Thread counts run in
+// powers of two up to --threads.
+
+typedef struct {
+    int reps;
+    int files;
+    int use_libc;
+    size_t bytes;
+} bench_arg_t;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void remove_tree(const char *path) {
+    DIR *dir = opendir(path);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            char child[1024];
+            snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+            struct stat st;
+            if (lstat(child, &st) == 0 && S_ISDIR(st.st_mode)) {
+                remove_tree(child);
+            } else {
+                unlink(child);
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(path);
+}
+
+static int check_format(void) {
+    // Ten years in steps that hit every minute offset and both DST sides
+    time_t start = 1577836800;     // 2020-01-01 00:00:00 UTC
+    for (long long step = 0; step < 10LL * 365 * 86400; step += 86400 / 7 + 3607) {
+        time_t t = start + (time_t)step;
+        char want[32], got[LOCAL_TIME_LEN + 1];
+        struct tm tm_buf;
+        strftime(want, sizeof(want), "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm_buf));
+        format_local_time(t, got);
+        if (strcmp(want, got) != 0) {
+            fprintf(stderr, "format_local_time(%lld) = %s, strftime gives %s\n", (long long)t, got, want);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Spread mtimes over a year, clustered the way bulk uploads are
+static time_t file_mtime(int i) {
+    return 1700000000 + (time_t)(i / 50) * 86400 * 3 + (time_t)(i % 50) * 61;
+}
+
+static int create_file(const char *user, const char *name, time_t mtime) {
+    char path[1024];
+    if (storage_ensure_shard(user, name) != 0) return -1;
+    storage_file_path(path, sizeof(path), user, name);
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    fputs("x", f);
+    fclose(f);
+
+    file_metadata_t metadata;
+    memset(&metadata, 0, sizeof(metadata));
+    strcpy(metadata.filename, name);
+    metadata.file_size = 1;
+    metadata.created_time = metadata.modified_time = mtime;
+    strcpy(metadata.checksum, "-");
+    metadata.codec = CODEC_RAW;
+    return save_file_metadata(user, &metadata);
+}
+
+static int create_account(const char *user, int files) {
+    for (int i = 0; i < files; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "file_%06d.txt", i);
+        if (create_file(user, name, file_mtime(i)) != 0) return -1;
+    }
+    return 0;
+}
+
+// Leftover temps of the storage engine next to a user file that is itself
+// named *.tmp, and a quota temp next to a user named *.tmp; the startup
+// scan must remove only the temps
+static const char *scan_temps[] = { ".x.tmp.7.tmp", "x.tmp.meta.tmp" };
+#define SCAN_QUOTA_TEMP "storage/scan.quota.meta.tmp"
+
+static int create_scan_account(void) {
+    if (create_file("scan", "x.tmp", file_mtime(0)) != 0) return -1;
+    if (create_file("scan.tmp", "y.txt", file_mtime(0)) != 0) return -1;
+    FILE *quota_temp = fopen(SCAN_QUOTA_TEMP, "wb");
+    if (!quota_temp) return -1;
+    fclose(quota_temp);
+    char dir[1024], path[1280];
+    storage_shard_dir(dir, sizeof(dir), "scan", "x.tmp");
+    for (size_t i = 0; i < sizeof(scan_temps) / sizeof(scan_temps[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, scan_temps[i]);
+        FILE *f = fopen(path, "wb");
+        if (!f) return -1;
+        fclose(f);
+    }
+    return 0;
+}
+
+static int check_scan_account(void) {
+    list_query_t query;
+    memset(&query, 0, sizeof(query));
+    query.limit = LIST_MAX_LIMIT;
+    list_row_t rows[2];
+    int more = 0;
+    int n = storage_index_rows("scan", &query, "", rows, 2, &more);
+    char dir[1024], path[1280];
+    storage_file_path(path, sizeof(path), "scan", "x.tmp");
+    if (n != 1 || strcmp(rows[0].name, "x.tmp") != 0 || access(path, F_OK) != 0) {
+        fprintf(stderr, "startup scan lost the user file x.tmp\n");
+        return -1;
+    }
+    storage_shard_dir(dir, sizeof(dir), "scan", "x.tmp");
+    for (size_t i = 0; i < sizeof(scan_temps) / sizeof(scan_temps[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, scan_temps[i]);
+        if (access(path, F_OK) == 0) {
+            fprintf(stderr, "startup scan kept the temp %s\n", scan_temps[i]);
+            return -1;
+        }
+    }
+    if (storage_index_rows("scan.tmp", &query, "", rows, 2, &more) != 1) {
+        fprintf(stderr, "startup scan skipped the user scan.tmp\n");
+        return -1;
+    }
+    if (access(SCAN_QUOTA_TEMP, F_OK) == 0) {
+        fprintf(stderr, "startup scan kept the temp %s\n", SCAN_QUOTA_TEMP);
+        return -1;
+    }
+    return 0;
+}
+
+static void *format_thread(void *arg) {
+    bench_arg_t *ba = (bench_arg_t *)arg;
+    char buf[32];
+    size_t sink = 0;
+    for (int r = 0; r < ba->reps; r++) {
+        for (int i = 0; i < ba->files; i++) {
+            time_t t = file_mtime(i);
+            if (ba->use_libc) {
+                struct tm tm_buf;
+                strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm_buf));
+            } else {
+                format_local_time(t, buf);
+            }
+            sink += (unsigned char)buf[18];
+        }
+    }
+    ba->bytes = sink;
+    return NULL;
+}
+
+static int count_listing(const char *data, size_t len, void *arg) {
+    (void)data;
+    *(size_t *)arg += len;
+    return 0;
+}
+
+static void *list_thread(void *arg) {
+    bench_arg_t *ba = (bench_arg_t *)arg;
+    list_query_t query;
+    memset(&query, 0, sizeof(query));
+    query.limit = LIST_MAX_LIMIT;
+    for (int r = 0; r < ba->reps; r++) list_user_files("bench", &query, count_listing, &ba->bytes);
+    return NULL;
+}
+
+// Run fn on threads threads and return the wall time
+static double run_threads(void *(*fn)(void *), bench_arg_t *args, int threads) {
+    pthread_t tids[64];
+    double start = now_s();
+    for (int t = 0; t < threads; t++) pthread_create(&tids[t], NULL, fn, &args[t]);
+    for (int t = 0; t < threads; t++) pthread_join(tids[t], NULL);
+    return now_s() - start;
+}
+
+int main(int argc, char **argv) {
+    const char *dir = "/tmp/dropbox_list_bench";
+    int files = 10000, max_threads = 8, reps = 20;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (strcmp(argv[i], "--files") == 0 && i + 1 < argc) {
+            files = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            max_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--dir DIR] [--files N] [--threads N] [--reps N]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (files < 1 || files > LIST_MAX_LIMIT) files = files < 1 ? 1 : LIST_MAX_LIMIT;
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > 64) max_threads = 64;
+    if (reps < 1) reps = 1;
+
+    if (check_format() != 0) return EXIT_FAILURE;
+    printf("format_local_time matches strftime (TZ=%s)\n", getenv("TZ") ? getenv("TZ") : "system");
+
+    mkdir(dir, 0700);
+    if (chdir(dir) != 0) {
+        perror("Failed to enter benchmark directory");
+        return EXIT_FAILURE;
+    }
+    remove_tree("storage");
+    strcpy(g_config.durability, "none");
+    durability_init();
+    if (create_account("bench", files) != 0 || create_scan_account() != 0) {
+        perror("Failed to create benchmark files");
+        return EXIT_FAILURE;
+    }
+
+    // The storage layer logs to stdout; keep it quiet while indexing
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    if (!freopen("/dev/null", "w", stdout)) perror("Failed to silence storage logging");
+    storage_index_build(1);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    if (check_scan_account() != 0) return EXIT_FAILURE;
+    printf("startup scan keeps *.tmp users and files and removes engine temps\n");
+
+    printf("\n%-8s %-7s %7s %10s %12s\n", "bench", "impl", "threads", "ms/op", "Mrows/s");
+    bench_arg_t args[64];
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        for (int libc = 1; libc >= 0; libc--) {
+            for (int t = 0; t < threads; t++) args[t] = (bench_arg_t){ reps, files, libc, 0 };
+            double s = run_threads(format_thread, args, threads);
+            double rows = (double)files * reps * threads;
+            printf("%-8s %-7s %7d %10.3f %12.2f\n", "format", libc ? "libc" : "cached", threads,
+                   s * 1000 / ((double)reps * threads), rows / s / 1e6);
+        }
+        for (int t = 0; t < threads; t++) args[t] = (bench_arg_t){ reps, files, 0, 0 };
+        double s = run_threads(list_thread, args, threads);
+        double rows = (double)files * reps * threads;
+        printf("%-8s %-7s %7d %10.3f %12.2f\n", "list", "index", threads,
+               s * 1000 / ((double)reps * threads), rows / s / 1e6);
+    }
+
+    storage_index_destroy();
+    durability_shutdown();
+    remove_tree("storage");
+    return EXIT_SUCCESS;
+}
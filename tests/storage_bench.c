@@ -0,0 +1,338 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../dropbox_server.h"
+#include <dirent.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// Storage-layer microbenchmark: links the storage objects directly so
+// save/load/list/delete can be measured without the network in the way.
+//
+// Usage: tests/storage_bench [--dir DIR] [--max-files N] [--max-threads N] [--iterations N]
+//
+// Each row reports wall time plus user/sys CPU from getrusage. A high sys%
+// means the operation is syscall-bound, a high user% means CPU-bound, and
+// whatever is left (wait%) was spent blocked on the disk (fsync, metadata).
+
+static FILE *out = NULL;
+
+typedef struct {
+    struct timespec wall;
+    struct rusage usage;
+} sample_t;
+
+typedef struct {
+    double wall_ms;
+    double user_ms;
+    double sys_ms;
+    long ops;
+} phase_t;
+
+static void take_sample(sample_t *s) {
+    clock_gettime(CLOCK_MONOTONIC, &s->wall);
+    getrusage(RUSAGE_SELF, &s->usage);
+}
+
+static double tv_ms(struct timeval tv) {
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+// Add the time elapsed since start to a phase accumulator
+static void phase_add(phase_t *phase, const sample_t *start, long ops) {
+    sample_t end;
+    take_sample(&end);
+    phase->wall_ms += (end.wall.tv_sec - start->wall.tv_sec) * 1000.0 +
+                      (end.wall.tv_nsec - start->wall.tv_nsec) / 1e6;
+    phase->user_ms += tv_ms(end.usage.ru_utime) - tv_ms(start->usage.ru_utime);
+    phase->sys_ms += tv_ms(end.usage.ru_stime) - tv_ms(start->usage.ru_stime);
+    phase->ops += ops;
+}
+
+static void print_header(void) {
+    fprintf(out, "%-8s %10s %8s %7s %8s %10s %10s %10s %6s %6s %6s\n",
+            "op", "size", "files", "threads", "ops", "wall_ms", "us/op", "ops/s",
+            "user%", "sys%", "wait%");
+}
+
+static void report(const char *op, size_t size, int files, int threads, const phase_t *p) {
+    // CPU time can exceed wall time with several threads; normalise per thread
+    double budget = p->wall_ms * threads;
+    double user_pct = budget > 0 ? 100.0 * p->user_ms / budget : 0;
+    double sys_pct = budget > 0 ? 100.0 * p->sys_ms / budget : 0;
+    double wait_pct = 100.0 - user_pct - sys_pct;
+    if (wait_pct < 0) wait_pct = 0;
+    double us_per_op = p->ops > 0 ? p->wall_ms * 1000.0 / p->ops : 0;
+    double ops_per_s = p->wall_ms > 0 ? p->ops * 1000.0 / p->wall_ms : 0;
+    fprintf(out, "%-8s %10zu %8d %7d %8ld %10.2f %10.2f %10.1f %6.1f %6.1f %6.1f\n",
+            op, size, files, threads, p->ops, p->wall_ms, us_per_op, ops_per_s,
+            user_pct, sys_pct, wait_pct);
+    fflush(out);
+}
+
+static char *make_payload(size_t size) {
+    char *data = malloc(size ? size : 1);
+    if (!data) return NULL;
+    for (size_t i = 0; i < size; i++) data[i] = (char)('a' + (i * 7) % 26);
+    return data;
+}
+
+// Remove a directory tree left over from a previous run
+static void remove_tree(const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        unlink(path);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char child[1024];
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        struct stat st;
+        if (lstat(child, &st) == 0 && S_ISDIR(st.st_mode)) remove_tree(child);
+        else unlink(child);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+// Listing sink that only counts the bytes produced
+static int count_listing(const char *data, size_t len, void *arg) {
+    (void)data;
+    *(size_t *)arg += len;
+    return 0;
+}
+
+// Start from an empty store with a fresh journal, as the server would
+static void reset_storage(void) {
+    journal_close();
+    remove_tree("storage");
+    mkdir("storage", 0700);
+    journal_open();
+}
+
+// Save, load and delete a single file repeatedly for each payload size.
+// The phases are interleaved so quota usage stays bounded.
+static void bench_file_sizes(int iterations) {
+    static const size_t sizes[] = { 1024, 64 * 1024, 1024 * 1024, 10 * 1024 * 1024 };
+    const char *user = "bench_sizes";
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t size = sizes[s];
+        char *payload = make_payload(size);
+        if (!payload) continue;
+        int iters = size >= 1024 * 1024 ? (iterations / 10 > 0 ? iterations / 10 : 1) : iterations;
+
+        phase_t save = {0}, load = {0}, del = {0};
+        sample_t start;
+        for (int i = 0; i < iters; i++) {
+            take_sample(&start);
+            int rc = save_file_to_storage(user, "sized.bin", payload, size);
+            phase_add(&save, &start, 1);
+            if (rc != 0) {
+                fprintf(out, "save failed (size %zu, rc %d)\n", size, rc);
+                break;
+            }
+
+            char *data = NULL;
+            size_t data_size = 0;
+            take_sample(&start);
+            if (load_file_from_storage(user, "sized.bin", &data, &data_size) == 0) {
+                phase_add(&load, &start, 1);
+                free(data);
+            }
+
+            take_sample(&start);
+            delete_file_from_storage(user, "sized.bin");
+            phase_add(&del, &start, 1);
+        }
+        report("save", size, 1, 1, &save);
+        report("load", size, 1, 1, &load);
+        report("delete", size, 1, 1, &del);
+        free(payload);
+    }
+}
+
+// Populate one user with N small files, then list, look up and delete them
+static void bench_file_counts(int max_files) {
+    static const int counts[] = { 1, 10, 100, 1000, 10000, 100000 };
+    const char *user = "bench_counts";
+    const size_t size = 64;
+    char *payload = make_payload(size);
+    if (!payload) return;
+
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        int count = counts[c];
+        if (count > max_files) break;
+        reset_storage();
+
+        phase_t save = {0}, meta = {0}, list = {0}, load = {0}, del = {0};
+        sample_t start;
+        char filename[MAX_FILENAME];
+
+        for (int i = 0; i < count; i++) {
+            snprintf(filename, sizeof(filename), "file_%06d.txt", i);
+            take_sample(&start);
+            save_file_to_storage(user, filename, payload, size);
+            phase_add(&save, &start, 1);
+
+            file_metadata_t metadata;
+            memset(&metadata, 0, sizeof(metadata));
+            strncpy(metadata.filename, filename, MAX_FILENAME - 1);
+            metadata.file_size = size;
+            metadata.created_time = metadata.modified_time = time(NULL);
+            strcpy(metadata.checksum, "0");
+            take_sample(&start);
+            save_file_metadata(user, &metadata);
+            phase_add(&meta, &start, 1);
+        }
+
+        // Keep total listed rows roughly constant across counts
+        int reps = count >= 10000 ? 3 : 10000 / count;
+        for (int r = 0; r < reps; r++) {
+            size_t listing_size = 0;
+            take_sample(&start);
+            if (list_user_files(user, NULL, count_listing, &listing_size) == 0) {
+                phase_add(&list, &start, 1);
+            }
+        }
+
+        int lookups = count < 1000 ? count : 1000;
+        for (int i = 0; i < lookups; i++) {
+            snprintf(filename, sizeof(filename), "file_%06d.txt", (i * 7919) % count);
+            char *data = NULL;
+            size_t data_size = 0;
+            take_sample(&start);
+            if (load_file_from_storage(user, filename, &data, &data_size) == 0) {
+                phase_add(&load, &start, 1);
+                free(data);
+            }
+        }
+
+        for (int i = 0; i < count; i++) {
+            snprintf(filename, sizeof(filename), "file_%06d.txt", i);
+            take_sample(&start);
+            delete_file_from_storage(user, filename);
+            phase_add(&del, &start, 1);
+        }
+
+        report("save", size, count, 1, &save);
+        report("meta", size, count, 1, &meta);
+        report("list", size, count, 1, &list);
+        report("load", size, count, 1, &load);
+        report("delete", size, count, 1, &del);
+    }
+    free(payload);
+}
+
+typedef struct {
+    int id;
+    int iterations;
+    const char *payload;
+    size_t size;
+} worker_arg_t;
+
+static void *thread_worker(void *arg) {
+    worker_arg_t *wa = (worker_arg_t *)arg;
+    char user[MAX_USERNAME];
+    char filename[MAX_FILENAME];
+    snprintf(user, sizeof(user), "bench_thread_%d", wa->id);
+    for (int i = 0; i < wa->iterations; i++) {
+        snprintf(filename, sizeof(filename), "t%d_%d.bin", wa->id, i);
+        if (save_file_to_storage(user, filename, wa->payload, wa->size) != 0) continue;
+        char *data = NULL;
+        size_t data_size = 0;
+        if (load_file_from_storage(user, filename, &data, &data_size) == 0) free(data);
+        delete_file_from_storage(user, filename);
+    }
+    return NULL;
+}
+
+// Concurrent save/load/delete cycles, one user per thread
+static void bench_threads(int max_threads, int iterations) {
+    const size_t size = 4096;
+    char *payload = make_payload(size);
+    if (!payload) return;
+
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        reset_storage();
+        pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+        worker_arg_t *args = malloc(sizeof(worker_arg_t) * threads);
+        if (!tids || !args) {
+            free(tids);
+            free(args);
+            break;
+        }
+
+        phase_t cycle = {0};
+        sample_t start;
+        take_sample(&start);
+        for (int t = 0; t < threads; t++) {
+            args[t].id = t;
+            args[t].iterations = iterations;
+            args[t].payload = payload;
+            args[t].size = size;
+            pthread_create(&tids[t], NULL, thread_worker, &args[t]);
+        }
+        for (int t = 0; t < threads; t++) pthread_join(tids[t], NULL);
+        phase_add(&cycle, &start, (long)threads * iterations);
+
+        report("cycle", size, 1, threads, &cycle);
+        free(tids);
+        free(args);
+    }
+    free(payload);
+}
+
+int main(int argc, char **argv) {
+    const char *dir = "/tmp/dropbox_storage_bench";
+    int max_files = 10000;
+    int max_threads = 8;
+    int iterations = 200;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (strcmp(argv[i], "--max-files") == 0 && i + 1 < argc) {
+            max_files = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-threads") == 0 && i + 1 < argc) {
+            max_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--dir DIR] [--max-files N] [--max-threads N] [--iterations N]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The storage layer logs to stdout; keep results on a private stream
+    int results_fd = dup(STDOUT_FILENO);
+    out = fdopen(results_fd, "w");
+    if (!out) {
+        perror("Failed to open results stream");
+        return EXIT_FAILURE;
+    }
+    if (!freopen("/dev/null", "w", stdout)) {
+        perror("Failed to silence storage logging");
+    }
+
+    mkdir(dir, 0700);
+    if (chdir(dir) != 0) {
+        perror("Failed to enter benchmark directory");
+        return EXIT_FAILURE;
+    }
+
+    fprintf(out, "Storage benchmark in %s (max files %d, max threads %d, iterations %d)\n\n",
+            dir, max_files, max_threads, iterations);
+    print_header();
+
+    reset_storage();
+    bench_file_sizes(iterations);
+    bench_file_counts(max_files);
+    bench_threads(max_threads, iterations);
+
+    journal_close();
+    remove_tree("storage");
+    cleanup_user_mutexes();
+    fclose(out);
+    return EXIT_SUCCESS;
+}
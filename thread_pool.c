@@ -1,6 +1,18 @@
 #include "dropbox_server.h"
 #include <unistd.h>
 
+// How often a client thread waiting on a queued task checks its socket
+#define CLIENT_WAIT_POLL_MS 200
+
+// True once the peer has closed its end; pending input does not count
+static int client_disconnected(int socket_fd) {
+    char probe;
+    ssize_t n = recv(socket_fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n == 0) return 1;
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return 1;
+    return 0;
+}
+
 // Client thread function - handles authentication and command parsing
 void* client_thread_function(void *arg) {
     server_context_t *server = (server_context_t *)arg;
@@ -22,26 +34,46 @@ void* client_thread_function(void *arg) {
         }
         
         // Get a client socket from the queue
-        int client_socket = dequeue_client(server->client_queue);
+        watch_t *resumed = NULL;
+        int client_socket = dequeue_client(server->client_queue, &resumed);
         if (client_socket < 0) {
             continue; // This might happen during shutdown
         }
         
         printf("Client thread %lu handling socket %d\n", pthread_self(), client_socket);
         
-        // Perform authentication
-        if (authenticate_user(client_socket, username) != 0) {
+        // A session the watcher hands back (a WATCH that is due, or an idle
+        // session with a command waiting) carries on without signing in
+        // again; anything else starts with authentication
+        if (resumed) {
+            strncpy(username, resumed->username, MAX_USERNAME - 1);
+            username[MAX_USERNAME - 1] = '\0';
+        } else if (authenticate_user(client_socket, username) != 0) {
             printf("Authentication failed for socket %d\n", client_socket);
             close(client_socket);
             continue;
         }
         
-        // Send command prompt
-        send_response(client_socket, "Authenticated successfully. Available commands: UPLOAD <filename>, DOWNLOAD <filename>, DELETE <filename>, LIST, QUIT\n");
-        send_response(client_socket, "> ");
+        // Session state shared with this client's tasks for cancellation
+        user_session_t session;
+        if (init_user_session(&session, client_socket, username) != 0) {
+            close(client_socket);
+            free(resumed);
+            continue;
+        }
+        
+        // A resumed WATCH gets its answer; a new session the command list
+        int parked = 0;
+        if (resumed) {
+            parked = watch_resume(resumed);
+        } else {
+            // Send command prompt in one write: a RESUME reply is corked
+            // until now, so both leave in one segment
+            send_response(client_socket, "Authenticated successfully. Available commands: UPLOAD <filename>, DOWNLOAD <filename>, DELETE <filename>, LIST, MUPLOAD|MDOWNLOAD|MDELETE <count>, ARCHIVE [prefix], WATCH [cursor], CHANGES [cursor], STATS, QUIT\n> ");
+        }
         
         // Command processing loop
-        while (1) {
+        while (!parked) {
             // Check for shutdown signal
             pthread_mutex_lock(&server->shutdown_mutex);
             shutdown = server->shutdown_flag;
@@ -69,7 +101,7 @@ void* client_thread_function(void *arg) {
             // Parse the command with priority support
             int priority = PRIORITY_MEDIUM;
             if (parse_priority_command(buffer, command, filename, &priority) != 0) {
-                send_response(client_socket, "ERROR: Invalid command. Use UPLOAD <filename> [--priority=high|medium|low], DOWNLOAD <filename> [--priority=high|medium|low], DELETE <filename> [--priority=high|medium|low], LIST [--priority=high|medium|low], or QUIT\n> ");
+                send_response(client_socket, "ERROR: Invalid command. Use UPLOAD <filename> [--priority=high|medium|low], DOWNLOAD <filename> [--version=k] [--priority=high|medium|low], DELETE <filename> [--priority=high|medium|low], LIST [prefix] [--limit N] [--cursor C] [--sort name|size|mtime] [--priority=high|medium|low], MUPLOAD|MDOWNLOAD|MDELETE <count> [--priority=high|medium|low], ARCHIVE [prefix] [--priority=high|medium|low], WATCH [cursor], CHANGES [cursor] [--priority=high|medium|low], or QUIT\n> ");
                 continue;
             }
             
@@ -79,6 +111,40 @@ void* client_thread_function(void *arg) {
                 printf("User %s (socket %d) quit\n", username, client_socket);
                 break;
             }
+
+            // STATS is answered locally from the pool counters
+            if (strcmp(command, "STATS") == 0) {
+                char stats[BUFFER_SIZE];
+                for (int lane = 0; lane < LANE_COUNT; lane++) {
+                    format_worker_pool_stats(server->worker_pools[lane], stats, sizeof(stats));
+                    send_response(client_socket, stats);
+                    format_task_queue_user_stats(server->task_queues[lane], task_lane_name(lane),
+                                                 stats, sizeof(stats));
+                    send_response(client_socket, stats);
+                }
+                format_durability_stats(stats, sizeof(stats));
+                send_response(client_socket, stats);
+                format_journal_stats(stats, sizeof(stats));
+                send_response(client_socket, stats);
+                format_scrubber_stats(stats, sizeof(stats));
+                send_response(client_socket, stats);
+                format_compression_stats(stats, sizeof(stats));
+                send_response(client_socket, stats);
+                format_watch_stats(stats, sizeof(stats));
+                send_response(client_socket, stats);
+                send_response(client_socket, "> ");
+                continue;
+            }
+            
+            // WATCH is answered here, or parked off this thread until
+            // there is something to report
+            if (strcmp(command, "WATCH") == 0) {
+                if (watch_command(client_socket, username, filename)) {
+                    parked = 1;
+                    break;
+                }
+                continue;
+            }
             
             // Create task for worker threads
             task_type_t task_type;
@@ -90,6 +156,16 @@ void* client_thread_function(void *arg) {
                 task_type = TASK_DELETE;
             } else if (strcmp(command, "LIST") == 0) {
                 task_type = TASK_LIST;
+            } else if (strcmp(command, "MUPLOAD") == 0) {
+                task_type = TASK_MUPLOAD;
+            } else if (strcmp(command, "MDOWNLOAD") == 0) {
+                task_type = TASK_MDOWNLOAD;
+            } else if (strcmp(command, "MDELETE") == 0) {
+                task_type = TASK_MDELETE;
+            } else if (strcmp(command, "ARCHIVE") == 0) {
+                task_type = TASK_ARCHIVE;
+            } else if (strcmp(command, "CHANGES") == 0) {
+                task_type = TASK_CHANGES;
             } else {
                 send_response(client_socket, "ERROR: Unknown command\n> ");
                 continue;
@@ -105,9 +181,10 @@ void* client_thread_function(void *arg) {
             // Copy filename to task
             strncpy(task->filename, filename, MAX_FILENAME - 1);
             task->filename[MAX_FILENAME - 1] = '\0';
+            task->session = &session;
             
-            // Enqueue task with priority and wait for completion
-            if (enqueue_priority_task(server->task_queue, task) != 0) {
+            // Route the task to its lane's queue and wait for completion
+            if (dispatch_task(server, task) != 0) {
                 send_response(client_socket, "ERROR: Failed to enqueue task\n> ");
                 destroy_task(task);
                 continue;
@@ -116,17 +193,50 @@ void* client_thread_function(void *arg) {
             printf("Priority task submitted by %s (socket %d, priority %d), waiting for completion...\n", 
                    username, client_socket, priority);
             
-            // Wait for task completion using condition variable
+            // Wait for task completion. While the task is still queued, wake
+            // periodically: if the client has gone or the deadline passed, pull
+            // the task back out so no worker spends time on it.
+            int abandoned = 0;
             pthread_mutex_lock(&task->task_mutex);
             while (task->status == TASK_PENDING || task->status == TASK_IN_PROGRESS) {
-                pthread_cond_wait(&task->task_cond, &task->task_mutex);
+                struct timespec wake;
+                clock_gettime(CLOCK_REALTIME, &wake);
+                wake.tv_nsec += CLIENT_WAIT_POLL_MS * 1000000L;
+                if (wake.tv_nsec >= 1000000000L) {
+                    wake.tv_sec++;
+                    wake.tv_nsec -= 1000000000L;
+                }
+                pthread_cond_timedwait(&task->task_cond, &task->task_mutex, &wake);
+                if (task->status != TASK_PENDING) continue;
+
+                if (!abandoned && client_disconnected(client_socket)) {
+                    printf("Client on socket %d went away with a queued task, cancelling\n", client_socket);
+                    cancel_user_session(&session);
+                    abandoned = 1;
+                }
+                const char *reason = task_abort_reason(task);
+                if (!reason) continue;
+
+                // Never hold the task lock while taking the queue lock;
+                // if a worker got there first it drops the task itself
+                pthread_mutex_unlock(&task->task_mutex);
+                int removed = cancel_queued_task(server, task) == 0;
+                pthread_mutex_lock(&task->task_mutex);
+                if (removed) {
+                    task->status = TASK_COMPLETED;
+                    task->result_code = -1;
+                    strncpy(task->error_message, reason, sizeof(task->error_message) - 1);
+                }
             }
             
             // Process task result
             if (task->status == TASK_COMPLETED) {
                 if (task->result_code == 0) {
-                    // Success - send result data if available
-                    if (task->result_data && task->result_size > 0) {
+                    // Success - send result data if available; a streamed
+                    // reply is already complete
+                    if (task->response_sent) {
+                        // nothing left to send
+                    } else if (task->result_data && task->result_size > 0) {
                         send(client_socket, task->result_data, task->result_size, 0);
                     } else {
                         send_response(client_socket, "SUCCESS: Operation completed successfully\n");
@@ -146,13 +256,18 @@ void* client_thread_function(void *arg) {
             
             // Clean up task
             destroy_task(task);
+            if (abandoned) {
+                printf("Client disconnected (socket %d, user: %s)\n", client_socket, username);
+                break;
+            }
             
             // Send prompt for next command
             send_response(client_socket, "> ");
         }
         
-        // Close client socket
-        close(client_socket);
+        // Close client socket, unless a WATCH parked it
+        destroy_user_session(&session);
+        if (!parked) close(client_socket);
         printf("Client thread %lu finished handling socket %d\n", pthread_self(), client_socket);
     }
     
@@ -160,9 +275,271 @@ void* client_thread_function(void *arg) {
     return NULL;
 }
 
-// Worker thread function - processes tasks from the task queue
+// Task dispatcher: route each operation to a lane by its expected cost.
+// LIST, CHANGES, DELETE and MDELETE only touch metadata; uploads, batch downloads,
+// archives and large downloads move whole files. Each lane has its own queue and independently sized pool,
+// so a burst of 10 MB transfers cannot hold up millisecond-scale LISTs.
+task_lane_t classify_task(const task_t *task) {
+    if (!task) return LANE_BULK;
+    switch (task->type) {
+        case TASK_LIST:
+        case TASK_CHANGES:
+        case TASK_DELETE:
+        case TASK_MDELETE:
+            return LANE_METADATA;
+        case TASK_DOWNLOAD: {
+            // Small downloads cost about as much as a metadata lookup. The
+            // size comes from the in-memory index, so choosing a lane never
+            // reads the disk; the index only knows the current content, so
+            // versioned downloads go to the bulk lane.
+            int version = 0;
+            size_t size = 0;
+            if (parse_download_version(task->command, &version) == 0 && version == 0 &&
+                storage_index_size(task->username, task->filename, &size) == 0 &&
+                size <= g_config.metadata_lane_max_bytes) {
+                return LANE_METADATA;
+            }
+            return LANE_BULK;
+        }
+        default:
+            return LANE_BULK;
+    }
+}
+
+const char* task_lane_name(task_lane_t lane) {
+    switch (lane) {
+        case LANE_METADATA: return "metadata";
+        case LANE_BULK: return "bulk";
+        default: return "unknown";
+    }
+}
+
+int dispatch_task(server_context_t *server, task_t *task) {
+    if (!server || !task) return -1;
+    task_lane_t lane = classify_task(task);
+    printf("Dispatching task type %d for %s to %s lane\n", task->type, task->username, task_lane_name(lane));
+    task->lane = lane;
+    return enqueue_priority_task(server->task_queues[lane], task);
+}
+
+// Take a task back out of its lane's queue before a worker starts it
+int cancel_queued_task(server_context_t *server, task_t *task) {
+    if (!server || !task) return -1;
+    return remove_task(server->task_queues[task->lane], task);
+}
+
+// Adaptive worker pool: a controller thread grows the pool while queued tasks
+// wait longer than the target, and idle workers above the minimum retire.
+#define POOL_CONTROLLER_INTERVAL_MS 100
+
+struct worker_pool {
+    server_context_t *server;
+    task_queue_t *queue;
+    const char *name;
+    int min_workers;
+    int max_workers;
+    int live;                // workers currently running
+    int idle;                // workers blocked waiting for a task
+    int peak;                // largest pool size seen
+    unsigned long spawned;   // workers started over the pool's lifetime
+    unsigned long retired;   // workers that exited after idling
+    unsigned long dropped;   // tasks discarded as cancelled or expired
+    int stopping;
+    pthread_t controller;
+    int controller_started;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;  // signalled when a worker exits or the pool stops
+};
+
+// Start one detached worker; caller holds pool->mutex
+static int spawn_worker_locked(worker_pool_t *pool) {
+    pthread_attr_t attr;
+    pthread_t tid;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pool->live++;
+    int rc = pthread_create(&tid, &attr, worker_thread_function, pool);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        pool->live--;
+        fprintf(stderr, "Failed to create worker thread: %s\n", strerror(rc));
+        return -1;
+    }
+    pool->spawned++;
+    if (pool->live > pool->peak) pool->peak = pool->live;
+    return 0;
+}
+
+static void* worker_pool_controller(void *arg) {
+    worker_pool_t *pool = (worker_pool_t *)arg;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (!pool->stopping) {
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_nsec += POOL_CONTROLLER_INTERVAL_MS * 1000000L;
+        if (wake.tv_nsec >= 1000000000L) {
+            wake.tv_sec++;
+            wake.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&pool->changed, &pool->mutex, &wake);
+        if (pool->stopping) break;
+
+        // Never hold the pool lock while taking the queue lock
+        pthread_mutex_unlock(&pool->mutex);
+        long long oldest_wait = task_queue_oldest_wait_ms(pool->queue);
+        int depth = task_queue_depth(pool->queue);
+        pthread_mutex_lock(&pool->mutex);
+
+        if (pool->stopping || oldest_wait <= g_config.queue_wait_target_ms) continue;
+
+        // Tasks are waiting too long: add enough workers to cover the backlog
+        int wanted = depth - pool->idle;
+        int room = pool->max_workers - pool->live;
+        if (wanted > room) wanted = room;
+        for (int i = 0; i < wanted; i++) {
+            if (spawn_worker_locked(pool) != 0) break;
+        }
+        if (wanted > 0) {
+            printf("Worker pool '%s' grew to %d threads (oldest task waited %lldms, queue depth %d)\n",
+                   pool->name, pool->live, oldest_wait, depth);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+worker_pool_t* create_worker_pool(server_context_t *server, task_queue_t *queue, const char *name, int min_workers, int max_workers) {
+    if (!server || !queue || min_workers < 1) return NULL;
+    if (max_workers < min_workers) max_workers = min_workers;
+
+    worker_pool_t *pool = malloc(sizeof(worker_pool_t));
+    if (!pool) {
+        perror("Failed to allocate worker pool");
+        return NULL;
+    }
+    memset(pool, 0, sizeof(*pool));
+    pool->server = server;
+    pool->queue = queue;
+    pool->name = name ? name : "workers";
+    pool->min_workers = min_workers;
+    pool->max_workers = max_workers;
+
+    if (pthread_mutex_init(&pool->mutex, NULL) != 0) {
+        perror("Failed to initialize worker pool mutex");
+        free(pool);
+        return NULL;
+    }
+    if (pthread_cond_init(&pool->changed, NULL) != 0) {
+        perror("Failed to initialize worker pool condition");
+        pthread_mutex_destroy(&pool->mutex);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    for (int i = 0; i < min_workers; i++) {
+        if (spawn_worker_locked(pool) != 0) {
+            pthread_mutex_unlock(&pool->mutex);
+            destroy_worker_pool(pool);
+            return NULL;
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (pthread_create(&pool->controller, NULL, worker_pool_controller, pool) != 0) {
+        perror("Failed to create worker pool controller");
+        destroy_worker_pool(pool);
+        return NULL;
+    }
+    pool->controller_started = 1;
+
+    printf("Worker pool '%s' created (%d-%d threads, wait target %dms, idle timeout %dms)\n",
+           pool->name, min_workers, max_workers, g_config.queue_wait_target_ms, g_config.worker_idle_timeout_ms);
+    return pool;
+}
+
+// Stop the controller and wait for every worker to exit.
+// Callers signal server shutdown first so blocked workers wake up.
+void destroy_worker_pool(worker_pool_t *pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (pool->controller_started) {
+        pthread_join(pool->controller, NULL);
+    }
+
+    printf("Waiting for '%s' worker threads to finish...\n", pool->name);
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->live > 0) {
+        pthread_mutex_unlock(&pool->mutex);
+        pthread_mutex_lock(&pool->queue->mutex);
+        pthread_cond_broadcast(&pool->queue->not_empty);
+        pthread_mutex_unlock(&pool->queue->mutex);
+        pthread_mutex_lock(&pool->mutex);
+        if (pool->live > 0) {
+            struct timespec wake;
+            clock_gettime(CLOCK_REALTIME, &wake);
+            wake.tv_sec += 1;
+            pthread_cond_timedwait(&pool->changed, &pool->mutex, &wake);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    pthread_cond_destroy(&pool->changed);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+int worker_pool_size(worker_pool_t *pool) {
+    if (!pool) return 0;
+    pthread_mutex_lock(&pool->mutex);
+    int live = pool->live;
+    pthread_mutex_unlock(&pool->mutex);
+    return live;
+}
+
+int worker_pool_idle(worker_pool_t *pool) {
+    if (!pool) return 0;
+    pthread_mutex_lock(&pool->mutex);
+    int idle = pool->idle;
+    pthread_mutex_unlock(&pool->mutex);
+    return idle;
+}
+
+void format_worker_pool_stats(worker_pool_t *pool, char *buffer, size_t buffer_size) {
+    if (!buffer || buffer_size == 0) return;
+    if (!pool) {
+        snprintf(buffer, buffer_size, "Worker pool: not running\n");
+        return;
+    }
+
+    int depth = task_queue_depth(pool->queue);
+    long long oldest_wait = task_queue_oldest_wait_ms(pool->queue);
+    pthread_mutex_lock(&pool->queue->mutex);
+    unsigned long dequeued = pool->queue->dequeued;
+    long long total_wait = pool->queue->total_wait_ms;
+    pthread_mutex_unlock(&pool->queue->mutex);
+
+    pthread_mutex_lock(&pool->mutex);
+    snprintf(buffer, buffer_size,
+             "[%s] pool: size=%d idle=%d min=%d max=%d peak=%d spawned=%lu retired=%lu dropped=%lu\n"
+             "[%s] queue: depth=%d oldest_wait_ms=%lld avg_wait_ms=%.1f dequeued=%lu\n",
+             pool->name, pool->live, pool->idle, pool->min_workers, pool->max_workers, pool->peak,
+             pool->spawned, pool->retired, pool->dropped,
+             pool->name, depth, oldest_wait, dequeued ? (double)total_wait / dequeued : 0.0, dequeued);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Worker thread function - processes tasks from its pool's task queue
 void* worker_thread_function(void *arg) {
-    server_context_t *server = (server_context_t *)arg;
+    worker_pool_t *pool = (worker_pool_t *)arg;
+    server_context_t *server = pool->server;
+    int retired = 0;
     
     printf("Worker thread %lu started\n", pthread_self());
     
@@ -177,11 +554,46 @@ void* worker_thread_function(void *arg) {
             break;
         }
         
-        // Get a task from the queue
-        task_t *task = dequeue_task(server->task_queue);
+        // Get a task from the queue, giving up after the idle timeout
+        pthread_mutex_lock(&pool->mutex);
+        pool->idle++;
+        pthread_mutex_unlock(&pool->mutex);
+
+        task_t *task = dequeue_task_timed(pool->queue, g_config.worker_idle_timeout_ms);
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->idle--;
         if (!task) {
+            // Idle for a whole timeout: retire if the pool is above its minimum
+            if (pool->stopping || pool->live > pool->min_workers) {
+                pool->live--;
+                pool->retired++;
+                retired = 1;
+                pthread_cond_broadcast(&pool->changed);
+                pthread_mutex_unlock(&pool->mutex);
+                break;
+            }
+            pthread_mutex_unlock(&pool->mutex);
             continue; // This might happen during shutdown
         }
+        pthread_mutex_unlock(&pool->mutex);
+
+        // Drop work nobody is waiting for any more
+        const char *abort_reason = task_abort_reason(task);
+        if (abort_reason) {
+            printf("Worker thread %lu dropping task type %d for user %s: %s\n",
+                   pthread_self(), task->type, task->username, abort_reason);
+            pthread_mutex_lock(&pool->mutex);
+            pool->dropped++;
+            pthread_mutex_unlock(&pool->mutex);
+            pthread_mutex_lock(&task->task_mutex);
+            task->status = TASK_COMPLETED;
+            task->result_code = -1;
+            strncpy(task->error_message, abort_reason, sizeof(task->error_message) - 1);
+            pthread_cond_signal(&task->task_cond);
+            pthread_mutex_unlock(&task->task_mutex);
+            continue;
+        }
         
         printf("Worker thread %lu processing task type %d for user %s\n", 
                pthread_self(), task->type, task->username);
@@ -192,6 +604,7 @@ void* worker_thread_function(void *arg) {
         pthread_mutex_unlock(&task->task_mutex);
         
         // Process the task based on type
+        int exit_requested = 0;
         switch (task->type) {
             case TASK_UPLOAD:
                 handle_upload_task(task);
@@ -205,14 +618,28 @@ void* worker_thread_function(void *arg) {
             case TASK_LIST:
                 handle_list_task(task);
                 break;
+            case TASK_MUPLOAD:
+                handle_mupload_task(task);
+                break;
+            case TASK_MDOWNLOAD:
+                handle_mdownload_task(task);
+                break;
+            case TASK_MDELETE:
+                handle_mdelete_task(task);
+                break;
+            case TASK_ARCHIVE:
+                handle_archive_task(task);
+                break;
+            case TASK_CHANGES:
+                handle_changes_task(task);
+                break;
+            case TASK_SCRUB:
+                handle_scrub_task(task);
+                break;
             case TASK_SHUTDOWN:
                 printf("Worker thread %lu received shutdown task\n", pthread_self());
-                pthread_mutex_lock(&task->task_mutex);
-                task->status = TASK_COMPLETED;
-                task->result_code = 0;
-                pthread_cond_signal(&task->task_cond);
-                pthread_mutex_unlock(&task->task_mutex);
-                return NULL;
+                exit_requested = 1;
+                break;
             default:
                 printf("Worker thread %lu: Unknown task type %d\n", pthread_self(), task->type);
                 pthread_mutex_lock(&task->task_mutex);
@@ -224,6 +651,14 @@ void* worker_thread_function(void *arg) {
                 continue;
         }
         
+        printf("Worker thread %lu completed task for user %s\n", pthread_self(), task->username);
+        
+        // Background tasks have nobody waiting; free them here
+        if (task->detached) {
+            destroy_task(task);
+            continue;
+        }
+        
         // Mark task as completed and notify waiting client thread
         pthread_mutex_lock(&task->task_mutex);
         if (task->status == TASK_IN_PROGRESS) {
@@ -232,9 +667,15 @@ void* worker_thread_function(void *arg) {
         pthread_cond_signal(&task->task_cond);
         pthread_mutex_unlock(&task->task_mutex);
         
-        printf("Worker thread %lu completed task for user %s\n", pthread_self(), task->username);
+        if (exit_requested) break;
     }
     
+    if (!retired) {
+        pthread_mutex_lock(&pool->mutex);
+        pool->live--;
+        pthread_cond_broadcast(&pool->changed);
+        pthread_mutex_unlock(&pool->mutex);
+    }
     printf("Worker thread %lu exiting\n", pthread_self());
     return NULL;
 }
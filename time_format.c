@@ -0,0 +1,116 @@
+#include "dropbox_server.h"
+#include <limits.h>
+
+// Local timestamps for listings ("YYYY-MM-DD HH:MM:SS") without a libc
+// call per row. localtime_r takes glibc's global timezone lock on every
+// call, so concurrent LISTs of large accounts serialise on it.
+//
+// The UTC offset only changes at DST transitions, which fall on quarter
+// hours, so it is looked up once per 15-minute slot through localtime_r
+// and remembered in a small per-thread cache; the date is then computed
+// arithmetically and the "YYYY-MM-DD " prefix of the last day formatted is
+// kept too. The timezone is read once, at the first lookup: a TZ change
+// while the server runs is not picked up.
+
+#define OFFSET_SLOT_SECONDS 900
+#define OFFSET_CACHE_SLOTS 256
+
+typedef struct {
+    long long slot;                  // t / OFFSET_SLOT_SECONDS, LLONG_MIN if empty
+    long offset;                     // seconds east of UTC
+} offset_entry_t;
+
+typedef struct {
+    int ready;
+    offset_entry_t offsets[OFFSET_CACHE_SLOTS];
+    long long day;                   // local day number of date[]
+    char date[12];                   // "YYYY-MM-DD "
+} time_cache_t;
+
+static __thread time_cache_t time_cache;
+
+// Days since 1970-01-01 of a proleptic Gregorian date (H. Hinnant's algorithm)
+static long long days_from_civil(long long y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (long long)doe - 719468;
+}
+
+static void civil_from_days(long long z, long long *y, unsigned *m, unsigned *d) {
+    z += 719468;
+    long long era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = (unsigned)(z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (long long)yoe + era * 400 + (*m <= 2);
+}
+
+static long long floor_div(long long a, long long b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+static long utc_offset(time_t t) {
+    long long slot = floor_div((long long)t, OFFSET_SLOT_SECONDS);
+    offset_entry_t *entry = &time_cache.offsets[(unsigned long long)slot % OFFSET_CACHE_SLOTS];
+    if (entry->slot == slot) return entry->offset;
+
+    struct tm tm_buf;
+    long offset = 0;
+    if (localtime_r(&t, &tm_buf)) {
+        long long local = days_from_civil(tm_buf.tm_year + 1900LL, (unsigned)tm_buf.tm_mon + 1,
+                                          (unsigned)tm_buf.tm_mday) * 86400LL +
+                          tm_buf.tm_hour * 3600LL + tm_buf.tm_min * 60LL + tm_buf.tm_sec;
+        offset = (long)(local - (long long)t);
+    }
+    entry->slot = slot;
+    entry->offset = offset;
+    return offset;
+}
+
+static void put2(char *out, unsigned value) {
+    out[0] = (char)('0' + value / 10);
+    out[1] = (char)('0' + value % 10);
+}
+
+// Write t as local "YYYY-MM-DD HH:MM:SS" into buf (at least
+// LOCAL_TIME_LEN + 1 bytes); the same text strftime("%Y-%m-%d %H:%M:%S")
+// gives for years 0-9999
+void format_local_time(time_t t, char *buf) {
+    if (!time_cache.ready) {
+        for (int i = 0; i < OFFSET_CACHE_SLOTS; i++) time_cache.offsets[i].slot = LLONG_MIN;
+        time_cache.day = LLONG_MIN;
+        time_cache.ready = 1;
+    }
+    long long local = (long long)t + utc_offset(t);
+    long long day = floor_div(local, 86400);
+    unsigned secs = (unsigned)(local - day * 86400);
+
+    if (day != time_cache.day) {
+        long long y;
+        unsigned m, d;
+        civil_from_days(day, &y, &m, &d);
+        if (y < 0 || y > 9999) y = y < 0 ? 0 : 9999;
+        unsigned year = (unsigned)y;
+        put2(time_cache.date, year / 100);
+        put2(time_cache.date + 2, year % 100);
+        time_cache.date[4] = '-';
+        put2(time_cache.date + 5, m);
+        time_cache.date[7] = '-';
+        put2(time_cache.date + 8, d);
+        time_cache.date[10] = ' ';
+        time_cache.day = day;
+    }
+    memcpy(buf, time_cache.date, 11);
+    put2(buf + 11, secs / 3600);
+    buf[13] = ':';
+    put2(buf + 14, secs / 60 % 60);
+    buf[16] = ':';
+    put2(buf + 17, secs % 60);
+    buf[LOCAL_TIME_LEN] = '\0';
+}
@@ -1,30 +1,104 @@
 #include "dropbox_server.h"
-#include <openssl/sha.h>
+#include <openssl/evp.h>
 
+// SHA-256 goes through OpenSSL's EVP interface, which dispatches to the
+// fastest block function for the CPU (SHA-NI where available, else AVX2 or
+// SSSE3 code). The digest implementation is fetched once rather than on
+// every call, which matters for small files.
+
+static EVP_MD *sha256_md = NULL;
+static pthread_once_t sha256_once = PTHREAD_ONCE_INIT;
+
+static void sha256_fetch(void) {
+    sha256_md = EVP_MD_fetch(NULL, "SHA256", NULL);
+}
+
+static const EVP_MD *sha256_digest(void) {
+    pthread_once(&sha256_once, sha256_fetch);
+    return sha256_md;
+}
+
+// Lower-case hex of a 32-byte digest into hex (65 bytes with the NUL)
+void sha256_to_hex(const unsigned char *digest, char *hex) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < SHA256_DIGEST_BYTES; i++) {
+        hex[i * 2] = digits[digest[i] >> 4];
+        hex[i * 2 + 1] = digits[digest[i] & 0x0F];
+    }
+    hex[SHA256_DIGEST_BYTES * 2] = '\0';
+}
+
+// Raw 32-byte digest of a buffer
+int sha256_raw(const void *data, size_t len, unsigned char *digest) {
+    const EVP_MD *md = sha256_digest();
+    if (!md || !digest) return -1;
+    return EVP_Digest(data, len, digest, NULL, md, NULL) == 1 ? 0 : -1;
+}
 
 char* calculate_sha256(const char *data, size_t data_size) {
     if (!data || data_size == 0) return NULL;
-    
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-    SHA256_Update(&sha256, data, data_size);
-    SHA256_Final(hash, &sha256);
-    
-    char *hex_string = malloc(SHA256_DIGEST_LENGTH * 2 + 1);
+    unsigned char hash[SHA256_DIGEST_BYTES];
+    if (sha256_raw(data, data_size, hash) != 0) return NULL;
+
+    char *hex_string = malloc(SHA256_DIGEST_BYTES * 2 + 1);
     if (!hex_string) return NULL;
-    
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-        sprintf(hex_string + (i * 2), "%02x", hash[i]);
-    }
-    hex_string[SHA256_DIGEST_LENGTH * 2] = '\0';
-    
+    sha256_to_hex(hash, hex_string);
     return hex_string;
 }
 
+// Incremental hashing, so uploads can hash each chunk as it arrives
+int sha256_stream_init(sha256_stream_t *stream) {
+    if (!stream) return -1;
+    const EVP_MD *md = sha256_digest();
+    stream->ctx = EVP_MD_CTX_new();
+    stream->length = 0;
+    if (!md || !stream->ctx || EVP_DigestInit_ex(stream->ctx, md, NULL) != 1) {
+        EVP_MD_CTX_free(stream->ctx);
+        stream->ctx = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int sha256_stream_update(sha256_stream_t *stream, const void *data, size_t len) {
+    if (!stream || !stream->ctx) return -1;
+    if (len == 0) return 0;
+    if (EVP_DigestUpdate(stream->ctx, data, len) != 1) return -1;
+    stream->length += len;
+    return 0;
+}
+
+// Write the hex digest ("-" for empty input, like the stored metadata) and
+// release the context
+int sha256_stream_final(sha256_stream_t *stream, char *hex) {
+    if (!stream || !stream->ctx || !hex) return -1;
+    unsigned char hash[SHA256_DIGEST_BYTES];
+    int rc = EVP_DigestFinal_ex(stream->ctx, hash, NULL) == 1 ? 0 : -1;
+    if (rc == 0 && stream->length > 0) {
+        sha256_to_hex(hash, hex);
+    } else if (rc == 0) {
+        strcpy(hex, "-");
+    }
+    sha256_stream_abort(stream);
+    return rc;
+}
+
+void sha256_stream_abort(sha256_stream_t *stream) {
+    if (!stream) return;
+    EVP_MD_CTX_free(stream->ctx);
+    stream->ctx = NULL;
+}
+
+// Milliseconds from a monotonic clock, for measuring waits and timeouts
+long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
 static pthread_mutex_t file_locks_mutex = PTHREAD_MUTEX_INITIALIZER;
 // store locked file paths as "username/filename"
-#define MAX_LOCKED_FILES 1024
+#define MAX_LOCKED_FILES 4096
 static char locked_files[MAX_LOCKED_FILES][512];
 static int locked_files_count = 0;
 
@@ -77,4 +151,54 @@ int release_file_lock(const char *username, const char *filename) {
 
     pthread_mutex_unlock(&file_locks_mutex);
     return -1; 
-}
\ No newline at end of file
+}
+
+// Take the file locks of a whole batch in one pass over the lock table.
+// Entries already locked by another operation are marked BATCH_BUSY, as
+// are any that would not fit in the table; returns the number taken.
+int acquire_file_locks(const char *username, batch_entry_t *entries, int count) {
+    if (!username || !entries) return -1;
+    int taken = 0;
+    pthread_mutex_lock(&file_locks_mutex);
+    for (int e = 0; e < count; e++) {
+        batch_entry_t *entry = &entries[e];
+        if (entry->status != BATCH_OK) continue;
+        char file_path[512];
+        snprintf(file_path, sizeof(file_path), "%s/%s", username, entry->filename);
+        int busy = locked_files_count >= MAX_LOCKED_FILES;
+        for (int i = 0; i < locked_files_count && !busy; i++) {
+            if (strcmp(locked_files[i], file_path) == 0) busy = 1;
+        }
+        if (busy) {
+            entry->status = BATCH_BUSY;
+            continue;
+        }
+        strncpy(locked_files[locked_files_count], file_path, sizeof(locked_files[0]) - 1);
+        locked_files[locked_files_count][sizeof(locked_files[0]) - 1] = '\0';
+        locked_files_count++;
+        entry->locked = 1;
+        taken++;
+    }
+    pthread_mutex_unlock(&file_locks_mutex);
+    return taken;
+}
+
+void release_file_locks(const char *username, batch_entry_t *entries, int count) {
+    if (!username || !entries) return;
+    pthread_mutex_lock(&file_locks_mutex);
+    for (int e = 0; e < count; e++) {
+        if (!entries[e].locked) continue;
+        char file_path[512];
+        snprintf(file_path, sizeof(file_path), "%s/%s", username, entries[e].filename);
+        // Compact in place rather than shifting the table once per file
+        for (int i = 0; i < locked_files_count; i++) {
+            if (strcmp(locked_files[i], file_path) == 0) {
+                locked_files_count--;
+                if (i != locked_files_count) strcpy(locked_files[i], locked_files[locked_files_count]);
+                break;
+            }
+        }
+        entries[e].locked = 0;
+    }
+    pthread_mutex_unlock(&file_locks_mutex);
+}
@@ -0,0 +1,247 @@
+#include "dropbox_server.h"
+#include <poll.h>
+
+// WATCH [cursor]: long-poll for changes to the caller's files (see
+// changes.c for cursors and replies). A WATCH with something to report is
+// answered at once. Otherwise the connection is parked here and its client
+// thread goes back to serving other connections: one watcher thread polls
+// every parked socket together with a wake pipe that changes_record writes
+// to. A parked watch is due once its user's log moves past the cursor,
+// watch_timeout_s passes or the client sends anything; it then goes back
+// to the client queue, ahead of new connections, and the client thread
+// that takes it sends the answer (watch_resume).
+//
+// An answered session is parked again, idle, until the client sends its
+// next command, so a client that keeps re-issuing WATCH only holds a
+// client thread while a command runs. A client that hangs up while parked
+// is closed here.
+
+static struct {
+    server_context_t *server;
+    pthread_t thread;
+    int running;
+    int stopping;
+    int wake_pipe[2];
+    int wake_pending;                    // a byte is in the pipe
+    watch_t *parked;
+    int parked_count;                    // including idle sessions
+    int idle_count;
+    unsigned long answered;              // parked watches handed back
+    unsigned long timed_out;
+    unsigned long hung_up;
+    pthread_mutex_t mutex;
+} watcher = {
+    .wake_pipe = { -1, -1 },
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// Caller holds watcher.mutex
+static void wake_locked(void) {
+    if (watcher.wake_pending || watcher.wake_pipe[1] < 0) return;
+    watcher.wake_pending = 1;
+    char byte = 1;
+    if (write(watcher.wake_pipe[1], &byte, 1) != 1) watcher.wake_pending = 0;
+}
+
+// A change was recorded: let the watcher look at its parked sessions
+static void watch_notify(void) {
+    pthread_mutex_lock(&watcher.mutex);
+    if (watcher.parked_count > watcher.idle_count) wake_locked();
+    pthread_mutex_unlock(&watcher.mutex);
+}
+
+// Send the answer to a WATCH, followed by the prompt, in one write
+static void watch_reply(int socket_fd, const char *username, const char *cursor) {
+    size_t len = 0;
+    char *reply = NULL;
+    char *full = changes_reply(username, cursor, &reply, &len) >= 0 ? realloc(reply, len + 3) : NULL;
+    if (!full) {
+        free(reply);
+        send_response(socket_fd, "ERROR: Failed to read changes\n> ");
+        return;
+    }
+    memcpy(full + len, "> ", 3);
+    send_response(socket_fd, full);
+    free(full);
+}
+
+// Hand a session to the watcher: waiting for a change after cursor, or
+// idle until the client speaks. Returns 0 if it cannot be parked (shutting
+// down or too many parked sessions) and the caller keeps the socket.
+static int park(int socket_fd, const char *username, const char *cursor, int idle) {
+    watch_t *watch = calloc(1, sizeof(watch_t));
+    pthread_mutex_lock(&watcher.mutex);
+    if (!watch || !watcher.running || watcher.stopping || watcher.parked_count >= WATCH_MAX_PARKED) {
+        pthread_mutex_unlock(&watcher.mutex);
+        free(watch);
+        return 0;
+    }
+    watch->socket = socket_fd;
+    strncpy(watch->username, username, MAX_USERNAME - 1);
+    if (cursor) strncpy(watch->cursor, cursor, CHANGE_CURSOR_LEN - 1);
+    watch->idle = idle;
+    watch->deadline_ms = idle ? 0 : monotonic_ms() + (long long)g_config.watch_timeout_s * 1000;
+    watch->poll_slot = -1;
+    watch->next = watcher.parked;
+    watcher.parked = watch;
+    watcher.parked_count++;
+    if (idle) watcher.idle_count++;
+    // The watcher re-checks every parked session when woken, so a change
+    // recorded since changes_pending is not missed
+    wake_locked();
+    pthread_mutex_unlock(&watcher.mutex);
+    return 1;
+}
+
+// Answer a WATCH now, or park the connection until there is something to
+// say. Returns 1 if the session was parked, waiting or idle after its
+// answer: the caller must let go of the socket.
+int watch_command(int socket_fd, const char *username, const char *cursor) {
+    if (!changes_pending(username, cursor) && park(socket_fd, username, cursor, 0)) return 1;
+    watch_reply(socket_fd, username, cursor);
+    return park(socket_fd, username, NULL, 1);
+}
+
+// Take back a session the watcher requeued, answering its WATCH if it was
+// waiting on one. Frees watch; returns 1 if the session was parked again.
+int watch_resume(watch_t *watch) {
+    int parked = 0;
+    if (!watch->idle) {
+        watch_reply(watch->socket, watch->username, watch->cursor);
+        parked = park(watch->socket, watch->username, NULL, 1);
+    }
+    free(watch);
+    return parked;
+}
+
+// True once the peer has closed its end; pending input does not count
+static int peer_closed(int socket_fd) {
+    char probe;
+    ssize_t n = recv(socket_fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n == 0) return 1;
+    return n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+}
+
+static void* watcher_thread(void *arg) {
+    (void)arg;
+    struct pollfd *fds = malloc((WATCH_MAX_PARKED + 1) * sizeof(struct pollfd));
+    if (!fds) return NULL;
+
+    pthread_mutex_lock(&watcher.mutex);
+    while (!watcher.stopping) {
+        // Poll the wake pipe and every parked socket until the nearest deadline
+        int count = 0;
+        long long now = monotonic_ms(), timeout = 1000;
+        fds[0].fd = watcher.wake_pipe[0];
+        fds[0].events = POLLIN;
+        for (watch_t *watch = watcher.parked; watch; watch = watch->next) {
+            fds[count + 1].fd = watch->socket;
+            fds[count + 1].events = POLLIN;
+            watch->poll_slot = ++count;
+            if (watch->idle) continue;
+            long long left = watch->deadline_ms - now;
+            if (left < timeout) timeout = left > 0 ? left : 0;
+        }
+        pthread_mutex_unlock(&watcher.mutex);
+
+        for (int i = 0; i <= count; i++) fds[i].revents = 0;
+        if (poll(fds, (nfds_t)count + 1, (int)timeout) < 0 && errno != EINTR) perror("Watcher poll failed");
+
+        pthread_mutex_lock(&watcher.mutex);
+        if (fds[0].revents & POLLIN) {
+            char drain[64];
+            while (read(watcher.wake_pipe[0], drain, sizeof(drain)) == (ssize_t)sizeof(drain)) {}
+            watcher.wake_pending = 0;
+        }
+
+        // Sessions parked since the poll have no events yet
+        now = monotonic_ms();
+        for (watch_t **link = &watcher.parked; *link;) {
+            watch_t *watch = *link;
+            short revents = watch->poll_slot > 0 ? fds[watch->poll_slot].revents : 0;
+            int closed = revents && peer_closed(watch->socket);
+            int due = revents || (!watch->idle && (watch->deadline_ms <= now ||
+                                                  changes_pending(watch->username, watch->cursor)));
+            if (!closed && !due) {
+                link = &watch->next;
+                continue;
+            }
+            *link = watch->next;
+            watcher.parked_count--;
+            if (watch->idle) watcher.idle_count--;
+            if (closed) {
+                watcher.hung_up++;
+                printf("Client on socket %d (user: %s) went away while parked\n", watch->socket, watch->username);
+                close(watch->socket);
+                free(watch);
+            } else {
+                if (!watch->idle) {
+                    if (!revents && watch->deadline_ms <= now) watcher.timed_out++;
+                    watcher.answered++;
+                }
+                requeue_watch(watcher.server->client_queue, watch);
+            }
+        }
+    }
+    pthread_mutex_unlock(&watcher.mutex);
+    free(fds);
+    return NULL;
+}
+
+int watch_start(server_context_t *server) {
+    if (!server) return -1;
+    if (pipe(watcher.wake_pipe) != 0) {
+        perror("Failed to create watcher wake pipe");
+        return -1;
+    }
+    fcntl(watcher.wake_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(watcher.wake_pipe[1], F_SETFL, O_NONBLOCK);
+    watcher.server = server;
+    watcher.stopping = 0;
+    if (pthread_create(&watcher.thread, NULL, watcher_thread, NULL) != 0) {
+        perror("Failed to create watcher thread");
+        close(watcher.wake_pipe[0]);
+        close(watcher.wake_pipe[1]);
+        watcher.wake_pipe[0] = watcher.wake_pipe[1] = -1;
+        return -1;
+    }
+    watcher.running = 1;
+    changes_listen(watch_notify);
+    return 0;
+}
+
+// Stop the watcher and close every connection still parked
+void watch_stop(void) {
+    pthread_mutex_lock(&watcher.mutex);
+    int running = watcher.running;
+    watcher.stopping = 1;
+    if (running) wake_locked();
+    pthread_mutex_unlock(&watcher.mutex);
+    if (!running) return;
+    changes_listen(NULL);
+    pthread_join(watcher.thread, NULL);
+
+    pthread_mutex_lock(&watcher.mutex);
+    while (watcher.parked) {
+        watch_t *watch = watcher.parked;
+        watcher.parked = watch->next;
+        close(watch->socket);
+        free(watch);
+    }
+    watcher.parked_count = 0;
+    watcher.idle_count = 0;
+    watcher.running = 0;
+    close(watcher.wake_pipe[0]);
+    close(watcher.wake_pipe[1]);
+    watcher.wake_pipe[0] = watcher.wake_pipe[1] = -1;
+    pthread_mutex_unlock(&watcher.mutex);
+}
+
+void format_watch_stats(char *buffer, size_t buffer_size) {
+    if (!buffer || buffer_size == 0) return;
+    pthread_mutex_lock(&watcher.mutex);
+    snprintf(buffer, buffer_size, "[watch] parked=%d idle=%d answered=%lu timed_out=%lu hung_up=%lu timeout_s=%d\n",
+             watcher.parked_count - watcher.idle_count, watcher.idle_count, watcher.answered, watcher.timed_out, watcher.hung_up,
+             g_config.watch_timeout_s);
+    pthread_mutex_unlock(&watcher.mutex);
+}